@@ -0,0 +1,345 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "../src/thrpool.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * Benchmarks of the thread pool. Every result is one record
+ *      benchmark, queue, producers, workers, metric, value
+ * printed as CSV (default) or as a JSON array with -j.
+ * -q runs a quick pass with smaller counts, e.g. on CI.
+ */
+
+static int json = 0;
+static int nrecords = 0;
+static long scale = 1;      /* divides the number of jobs with -q */
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000u + (uint64_t) ts.tv_nsec;
+}
+
+static const char *queue_name(int queue_mode)
+{
+    return queue_mode == THR_QUEUE_RING ? "ring" : "list";
+}
+
+static void record(const char *bench, int queue_mode, int producers,
+                   int workers, const char *metric, double value)
+{
+    if (json) {
+        printf("%s\n  {\"benchmark\": \"%s\", \"queue\": \"%s\", "
+               "\"producers\": %d, \"workers\": %d, "
+               "\"metric\": \"%s\", \"value\": %.1f}",
+               nrecords ? "," : "[", bench, queue_name(queue_mode),
+               producers, workers, metric, value);
+    } else {
+        if (nrecords == 0)
+            printf("benchmark,queue,producers,workers,metric,value\n");
+        printf("%s,%s,%d,%d,%s,%.1f\n", bench, queue_name(queue_mode),
+               producers, workers, metric, value);
+    }
+    nrecords++;
+    fflush(stdout);
+}
+
+static void create_pool(thr_pool_t *pool, int queue_mode, int workers)
+{
+    thr_pool_options_t opts;
+    thr_pool_options_init(&opts);
+    opts.min_threads = workers;
+    opts.max_threads = workers;
+    opts.timeout = -1;
+    opts.queue_mode = queue_mode;
+    opts.queue_capacity = 4096;
+    if (thr_pool_create_ex(pool, &opts) != 0) {
+        fprintf(stderr, "thr_pool_create_ex() failed!\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *) a;
+    uint64_t y = *(const uint64_t *) b;
+    return x < y ? -1 : x > y;
+}
+
+/* Record the percentiles of n latencies, in nanoseconds */
+static void record_percentiles(const char *bench, int queue_mode,
+                               int workers, uint64_t *lat, long n)
+{
+    static const struct { const char *name; double q; } pct[] = {
+        {"p50_ns", 0.50}, {"p90_ns", 0.90}, {"p99_ns", 0.99},
+        {"p999_ns", 0.999}
+    };
+
+    qsort(lat, n, sizeof(uint64_t), compare_u64);
+    for (size_t i = 0; i < sizeof(pct) / sizeof(pct[0]); i++)
+        record(bench, queue_mode, 1, workers, pct[i].name,
+               (double) lat[(long) (pct[i].q * (n - 1))]);
+    record(bench, queue_mode, 1, workers, "max_ns", (double) lat[n - 1]);
+}
+
+/* Empty-job throughput versus producer and worker count */
+
+static void *empty_task(void *arg) { return arg; }
+
+typedef struct producer {
+    thr_pool_t *pool;
+    long njobs;
+} producer_t;
+
+static void *producer_thread(void *arg)
+{
+    producer_t *p = (producer_t *) arg;
+    for (long i = 0; i < p->njobs; i++)
+        thr_pool_add(p->pool, empty_task, NULL);
+    return NULL;
+}
+
+static void bench_throughput(int queue_mode, int producers, int workers)
+{
+    thr_pool_t pool;
+    pthread_t threads[16];
+    producer_t p;
+    long njobs = 400000 / scale;
+
+    create_pool(&pool, queue_mode, workers);
+    p.pool = &pool;
+    p.njobs = njobs / producers;
+
+    uint64_t start = now_ns();
+    for (int i = 0; i < producers; i++)
+        pthread_create(&threads[i], NULL, producer_thread, &p);
+    for (int i = 0; i < producers; i++)
+        pthread_join(threads[i], NULL);
+    thr_pool_wait(&pool);
+    uint64_t elapsed = now_ns() - start;
+
+    record("throughput", queue_mode, producers, workers, "jobs_per_sec",
+           (double) p.njobs * producers * 1e9 / elapsed);
+    thr_pool_destroy(&pool);
+}
+
+/* Submit-to-start latency under open-loop load */
+
+typedef struct sample {
+    uint64_t submitted;
+    uint64_t latency;
+} sample_t;
+
+static void *stamp_task(void *arg)
+{
+    sample_t *s = (sample_t *) arg;
+    s->latency = now_ns() - s->submitted;
+    return NULL;
+}
+
+/* Wait until the given time without giving up the CPU */
+static void wait_until(uint64_t deadline)
+{
+    while (now_ns() < deadline)
+        ;
+}
+
+static void bench_latency(int queue_mode, int workers)
+{
+    thr_pool_t pool;
+    long n = 100000 / scale;
+    uint64_t interval = 10000;  /* one job every 10 us */
+    sample_t *samples = (sample_t *) malloc(n * sizeof(sample_t));
+    uint64_t *lat = (uint64_t *) malloc(n * sizeof(uint64_t));
+
+    create_pool(&pool, queue_mode, workers);
+    uint64_t next = now_ns();
+    for (long i = 0; i < n; i++, next += interval) {
+        /* open loop: the schedule does not wait for the jobs */
+        wait_until(next);
+        samples[i].submitted = now_ns();
+        thr_pool_add(&pool, stamp_task, &samples[i]);
+    }
+    thr_pool_wait(&pool);
+
+    for (long i = 0; i < n; i++) lat[i] = samples[i].latency;
+    record_percentiles("latency", queue_mode, workers, lat, n);
+    thr_pool_destroy(&pool);
+    free(samples);
+    free(lat);
+}
+
+/* Fan-out/fan-in: a batch of jobs, then wait for the whole group */
+
+static void bench_fanout(int queue_mode, int workers, int width)
+{
+    thr_pool_t pool;
+    thr_group_t group;
+    int rounds = 20000 / (int) scale / (width / 8);
+
+    create_pool(&pool, queue_mode, workers);
+    thr_group_init(&group);
+    uint64_t start = now_ns();
+    for (int r = 0; r < rounds; r++) {
+        for (int i = 0; i < width; i++)
+            thr_pool_add_group(&pool, &group, empty_task, NULL);
+        thr_group_wait(&group);
+    }
+    uint64_t elapsed = now_ns() - start;
+
+    char metric[32];
+    snprintf(metric, sizeof(metric), "ns_per_round_w%d", width);
+    record("fanout", queue_mode, 1, workers, metric,
+           (double) elapsed / rounds);
+    thr_pool_destroy(&pool);
+}
+
+/* Recursive spawn: every job adds two children down to a depth */
+
+static thr_pool_t *spawn_pool;
+
+static void *spawn_task(void *arg)
+{
+    long depth = (long) arg;
+    if (depth > 0) {
+        thr_pool_add(spawn_pool, spawn_task, (void *) (depth - 1));
+        thr_pool_add(spawn_pool, spawn_task, (void *) (depth - 1));
+    }
+    return NULL;
+}
+
+static void bench_spawn(int queue_mode, int workers)
+{
+    thr_pool_t pool;
+    long depth = scale > 1 ? 14 : 18;
+
+    create_pool(&pool, queue_mode, workers);
+    spawn_pool = &pool;
+    uint64_t start = now_ns();
+    thr_pool_add(&pool, spawn_task, (void *) depth);
+    thr_pool_wait(&pool);
+    uint64_t elapsed = now_ns() - start;
+
+    record("spawn", queue_mode, 1, workers, "jobs_per_sec",
+           (double) ((2L << depth) - 1) * 1e9 / elapsed);
+    thr_pool_destroy(&pool);
+}
+
+/* Idle wake-up: submit-to-start latency of a job when all workers sleep */
+
+static void bench_wakeup(int queue_mode, int workers)
+{
+    thr_pool_t pool;
+    long n = 2000 / scale;
+    uint64_t *lat = (uint64_t *) malloc(n * sizeof(uint64_t));
+    struct timespec pause = {0, 1000000};
+    sample_t s;
+
+    create_pool(&pool, queue_mode, workers);
+    for (long i = 0; i < n; i++) {
+        nanosleep(&pause, NULL);    /* let the workers park */
+        s.submitted = now_ns();
+        thr_pool_add(&pool, stamp_task, &s);
+        thr_pool_wait(&pool);
+        lat[i] = s.latency;
+    }
+
+    record_percentiles("wakeup", queue_mode, workers, lat, n);
+    thr_pool_destroy(&pool);
+    free(lat);
+}
+
+/* Jobs carrying a small context: malloc()'d argument versus inline copy */
+
+typedef struct closure {
+    long *sum;
+    long value;
+    void *pad[2];
+} closure_t;
+
+static void *closure_task(void *arg)
+{
+    closure_t *c = (closure_t *) arg;
+    __atomic_add_fetch(c->sum, c->value, __ATOMIC_RELAXED);
+    return NULL;
+}
+
+static void *closure_free_task(void *arg)
+{
+    closure_task(arg);
+    free(arg);
+    return NULL;
+}
+
+static void bench_closure(int queue_mode, int workers)
+{
+    thr_pool_t pool;
+    long njobs = 400000 / scale;
+    long sum = 0;
+    closure_t c = {&sum, 1, {NULL, NULL}};
+
+    create_pool(&pool, queue_mode, workers);
+    uint64_t start = now_ns();
+    for (long i = 0; i < njobs; i++) {
+        closure_t *copy = (closure_t *) malloc(sizeof(closure_t));
+        *copy = c;
+        thr_pool_add(&pool, closure_free_task, copy);
+    }
+    thr_pool_wait(&pool);
+    uint64_t elapsed = now_ns() - start;
+    record("closure", queue_mode, 1, workers, "malloc_jobs_per_sec",
+           (double) njobs * 1e9 / elapsed);
+
+    start = now_ns();
+    for (long i = 0; i < njobs; i++)
+        thr_pool_add_inline(&pool, closure_task, &c, sizeof(c));
+    thr_pool_wait(&pool);
+    elapsed = now_ns() - start;
+    record("closure", queue_mode, 1, workers, "inline_jobs_per_sec",
+           (double) njobs * 1e9 / elapsed);
+    thr_pool_destroy(&pool);
+}
+
+int main(int argc, char *argv[])
+{
+    int opt;
+    while ((opt = getopt(argc, argv, "jq")) != -1) {
+        switch (opt) {
+        case 'j': json = 1; break;
+        case 'q': scale = 10; break;
+        default:
+            fprintf(stderr, "usage: %s [-j] [-q]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int workers[] = {1, 2, 4, (int) ncpus};
+    int nworkers = ncpus > 4 ? 4 : 3;
+    int queue_modes[] = {THR_QUEUE_LIST, THR_QUEUE_RING};
+
+    for (int q = 0; q < 2; q++) {
+        int mode = queue_modes[q];
+        for (int w = 0; w < nworkers; w++) {
+            for (int producers = 1; producers <= 4; producers *= 2)
+                bench_throughput(mode, producers, workers[w]);
+        }
+        for (int w = 0; w < nworkers; w++) {
+            bench_latency(mode, workers[w]);
+            bench_fanout(mode, workers[w], 8);
+            bench_fanout(mode, workers[w], 64);
+            bench_spawn(mode, workers[w]);
+            bench_wakeup(mode, workers[w]);
+            bench_closure(mode, workers[w]);
+        }
+    }
+
+    if (json) printf("\n]\n");
+    return 0;
+}
@@ -8,15 +8,131 @@
 
 #include "thrpool.h"
 #include "thrpool_assert.h"
+#include "thrpool_atomic.h"
+#include "thrpool_ring.h"
+#include "thrpool_deque.h"
+#include "thrpool_slab.h"
+#include "thrpool_futex.h"
+#include "thrpool_topo.h"
+#include "thrpool_trace.h"
+#include "thrpool_wheel.h"
+#include "thrpool_scale.h"
+#include "thrpool_reactor.h"
 #include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sched.h>
+#include <time.h>
 #include <errno.h>
+#include <limits.h>
+#include <string.h>
 
 static void clone_pthread_attr(pthread_attr_t *dst,
                                const pthread_attr_t *src);
 static void worker_cleanup(void *arg);
 static void job_cleanup(void *arg);
 static void * worker_thread(void *arg);
-static int create_worker(void *arg);
+static int create_worker(thr_pool_t *pool);
+static void spawn_worker(thr_pool_t *pool, worker_t *slot);
+static void slot_release(thr_pool_t *pool, worker_t *slot);
+static void *spawner_thread(void *arg);
+static void spawner_stop(thr_pool_t *pool);
+static void jobs_drop(thr_pool_t *pool);
+static job_t *job_dequeue(thr_pool_t *pool, worker_t *self);
+static job_t *job_steal(thr_pool_t *pool, worker_t *self);
+static int jobs_visible(thr_pool_t *pool);
+static void job_run(worker_t *self, job_t *job);
+static int wait_help(int *word, int val, const struct timespec *abstime);
+static void job_done(thr_pool_t *pool, long n);
+static void wake_workers(thr_pool_t *pool, int n);
+static void wake_locked(thr_pool_t *pool, int n);
+static int worker_park(thr_pool_t *pool, worker_t *self);
+static void idle_push(thr_pool_t *pool, worker_t *w);
+static void idle_remove(thr_pool_t *pool, worker_t *w);
+static void idle_wake(thr_pool_t *pool, worker_t *w);
+static void io_poll(thr_pool_t *pool, worker_t *self);
+static void poller_handoff(thr_pool_t *pool, worker_t *self);
+static job_t *job_poll(thr_pool_t *pool, worker_t *self);
+static job_t *worker_spin(thr_pool_t *pool, worker_t *self);
+static void idle_end(thr_pool_t *pool, worker_t *self, int phase,
+                     uint64_t idle_start);
+static job_t *job_alloc(thr_pool_t *pool);
+static job_t *job_alloc_chain(thr_pool_t *pool, int n);
+static void job_free(thr_pool_t *pool, job_t *job);
+static void job_init(job_t *job, void *(*func)(void *), void *arg);
+static void group_done(thr_group_t *group);
+static void job_submit(thr_pool_t *pool, job_t *job);
+static void job_queue(thr_pool_t *pool, job_t *job, int local);
+static void list_insert(thr_pool_t *pool, job_t *first, job_t *last,
+                        int n, int prio);
+static job_t *list_pop(thr_pool_t *pool);
+static void future_finish(thr_future_t *future, void *result, int state);
+static void future_unref(thr_future_t *future);
+static void task_over(thr_task_t *task);
+static void strand_drop(thr_pool_t *pool, thr_strand_t *strand);
+static void pfor_over(void *arg);
+static uint64_t now_ns(void);
+static void stats_enqueued(thr_pool_t *pool, int n);
+static void stats_started(worker_t *self, job_t *job);
+static void stats_finished(worker_t *self);
+static void stats_failed(thr_pool_t *pool, int dequeued);
+static int queue_admit(thr_pool_t *pool, long n, int mode,
+                       const struct timespec *abstime);
+static void queue_leave(thr_pool_t *pool, long n);
+static int timers_start(thr_pool_t *pool);
+static void timers_stop(thr_pool_t *pool);
+static int scaler_start(thr_pool_t *pool, const thr_pool_options_t *opts);
+static void scale_decide(thr_pool_t *pool);
+static inline int tracing(thr_pool_t *pool);
+static inline void trace(thr_pool_t *pool, int type, void *arg);
+
+/* Set when somebody sleeps on the state of a pending future */
+#define FUTURE_WAITERS (1<<2)
+
+/* future->then once the continuations were released */
+#define FUTURE_FIRED ((thr_future_t *) 1)
+
+/* States of a timer */
+#define TIMER_ARMED 0       /* in the wheel */
+#define TIMER_FIRED 1       /* a delayed job that was queued */
+#define TIMER_CANCELLED 2
+
+/* Longest sleep of a worker waiting inside a job, see wait_help() */
+#define HELP_POLL_NS 1000000L
+
+/* The file descriptor a job of thr_pool_add_io() waits on */
+#define JOB_IO_FD(job) (*(int *) (job)->data)
+
+/* How queue_admit() handles a full bounded queue */
+#define ADMIT_TRY 0     /* fail with EAGAIN */
+#define ADMIT_WAIT 1    /* wait for room */
+#define ADMIT_FORCE 2   /* admit the jobs over the bound */
+
+/* The worker slot of the calling thread, NULL outside of any pool */
+static __thread worker_t *current_worker = NULL;
+
+/*
+ * Free job nodes of a thread adding jobs to a pool it is no worker of.
+ * The thread caches the nodes of the last such pool only; the cache goes
+ * back to the pool when the thread moves on to another pool or exits,
+ * unless the pool was destroyed meanwhile, which released the nodes.
+ */
+typedef struct ext_cache {
+    thr_pool_t *pool;       /* the pool owning the nodes, or NULL */
+    unsigned long serial;   /* of that pool */
+    void *cache;
+    int ncache;
+} ext_cache_t;
+
+static __thread ext_cache_t ext_cache;
+static pthread_once_t ext_once = PTHREAD_ONCE_INIT;
+static pthread_key_t ext_key;   /* flushes ext_cache at thread exit */
+static int ext_keyed = 0;       /* ext_key was created */
+
+/* The live pools, to tell whether the pool of a cache is still there */
+static pthread_mutex_t pools_lock = PTHREAD_MUTEX_INITIALIZER;
+static thr_pool_t *live_pools = NULL;
+static unsigned long pools_serial = 0;
 
 /*
  * Copy all attributes from src to dst.
@@ -61,247 +177,3457 @@ static void clone_pthread_attr(pthread_attr_t *dst,
 static void worker_cleanup(void *arg)
 {
     if (arg == NULL) return;
-    
-    thr_pool_t *pool = (thr_pool_t *)arg;
-    
-    --pool->nthreads;
-    if (pool->nthreads < pool->min && !(pool->status & THR_POOL_DESTROY))
-        create_worker(pool);
 
-    /* If this is the last thread, wake up thr_pool_destroy */
-    if ((pool->status & THR_POOL_DESTROY) && pool->nthreads == 0) {
-        pthread_cond_broadcast(&pool->busycv);
-    }
+    worker_t *self = (worker_t *)arg;
+    thr_pool_t *pool = self->pool;
+
+    thr_slab_flush(pool->jobs, &self->job_cache, &self->job_ncache);
+
+    pthread_mutex_lock(&pool->mutex);
+    slot_release(pool, self);
+    if (pool->nthreads < pool->min &&
+        !(pool->status & (THR_POOL_DESTROY | THR_POOL_STOP)))
+        create_worker(pool);
     DEBUG("CLEANUP THREAD #%u", (unsigned int) pthread_self());
     pthread_mutex_unlock(&pool->mutex);
 }
 
+/*
+ * Runs when a job returns or when its worker is cancelled in the middle
+ * of the job.
+ */
 static void job_cleanup(void *arg)
 {
     if (arg == NULL) return;
 
-    thr_pool_t *pool = (thr_pool_t *)arg;
-    pthread_t self = pthread_self();
+    worker_t *self = (worker_t *)arg;
+    thr_pool_t *pool = self->pool;
 
-    pthread_mutex_lock(&pool->mutex);
+    __atomic_store_n(&self->busy, 0, __ATOMIC_RELEASE);
+    /* Still running: the worker was cancelled in the middle of the job */
+    if (self->job_start != 0) {
+        self->job_start = 0;
+        stats_failed(pool, 1);
+    }
+    job_free(pool, self->job);
+    self->job = NULL;
+    job_done(pool, 1);
+}
 
-    /* TODO: Need to refactor this snippet code */
-    worker_t *prev_worker = NULL;
-    worker_t *curr_worker = pool->worker;
-    while (curr_worker != NULL) {
-        if (pthread_equal(curr_worker->thread, self)) {
-            if (curr_worker == pool->worker)
-                pool->worker = curr_worker->next;
-            else
-                prev_worker->next = curr_worker->next;
+/*
+ * Account for n jobs that returned or were dropped, without any lock.
+ * The last one wakes up the threads blocked in thr_pool_wait(), if any;
+ * the jobs waiting there themselves do not count.
+ */
+static void job_done(thr_pool_t *pool, long n)
+{
+    long left = __atomic_sub_fetch(&pool->pending, n, __ATOMIC_SEQ_CST);
+    if (left != 0 &&
+        left > __atomic_load_n(&pool->wait_nested, __ATOMIC_SEQ_CST))
+        return;
 
-            break;
+    /* Pairs with thr_pool_wait() announcing itself, then checking pending */
+    if (__atomic_load_n(&pool->wait_waiters, __ATOMIC_SEQ_CST) > 0) {
+        __atomic_add_fetch(&pool->wait_seq, 1, __ATOMIC_SEQ_CST);
+        thr_futex_wake(&pool->wait_seq, INT_MAX);
+    }
+}
+
+static void pool_register(thr_pool_t *pool)
+{
+    pthread_mutex_lock(&pools_lock);
+    pool->serial = ++pools_serial;
+    pool->live_prev = NULL;
+    pool->live_next = live_pools;
+    if (live_pools != NULL) live_pools->live_prev = pool;
+    live_pools = pool;
+    pthread_mutex_unlock(&pools_lock);
+}
+
+/* The caches of other threads holding nodes of the pool are dropped */
+static void pool_unregister(thr_pool_t *pool)
+{
+    pthread_mutex_lock(&pools_lock);
+    if (pool->live_prev != NULL)
+        pool->live_prev->live_next = pool->live_next;
+    else
+        live_pools = pool->live_next;
+    if (pool->live_next != NULL)
+        pool->live_next->live_prev = pool->live_prev;
+    pthread_mutex_unlock(&pools_lock);
+}
+
+/* Give the nodes of a thread cache back to its pool, if still alive */
+static void ext_flush(ext_cache_t *c)
+{
+    if (c->cache != NULL) {
+        pthread_mutex_lock(&pools_lock);
+        for (thr_pool_t *p = live_pools; p != NULL; p = p->live_next) {
+            if (p == c->pool && p->serial == c->serial) {
+                thr_slab_flush(p->jobs, &c->cache, &c->ncache);
+                break;
+            }
         }
-        prev_worker = curr_worker;
-        curr_worker = curr_worker->next;
+        pthread_mutex_unlock(&pools_lock);
     }
+    c->pool = NULL;
+    c->cache = NULL;
+    c->ncache = 0;
+}
+
+static void ext_exit(void *arg)
+{
+    ext_flush((ext_cache_t *) arg);
+}
 
-    /* If run out of job and all threads is idle */
-    if (pool->status & THR_POOL_WAIT &&
-        pool->job_head == NULL &&
-        pool->worker == NULL) {
+static void ext_key_create(void)
+{
+    ext_keyed = pthread_key_create(&ext_key, ext_exit) == 0;
+}
+
+/*
+ * The node cache of the calling thread for the pool: the one of the
+ * worker, or the thread cache, which moves over to the pool if needed.
+ * Return NULL, so that the depot is used directly, if the thread cache
+ * could not be flushed at thread exit.
+ */
+static void **job_cache(thr_pool_t *pool, int **ncache)
+{
+    worker_t *self = current_worker;
+    if (self != NULL && self->pool == pool) {
+        *ncache = &self->job_ncache;
+        return &self->job_cache;
+    }
 
-        pool->status &= ~THR_POOL_WAIT;
-        pthread_cond_broadcast(&pool->waitcv);
-        DEBUG("#%u broadcast pool->waitcv", (unsigned int) self);
+    ext_cache_t *c = &ext_cache;
+    if (c->pool != pool || c->serial != pool->serial) {
+        pthread_once(&ext_once, ext_key_create);
+        if (!ext_keyed) return NULL;
+        if (c->pool != NULL)
+            ext_flush(c);
+        else
+            pthread_setspecific(ext_key, c);
+        c->pool = pool;
+        c->serial = pool->serial;
     }
-    pthread_mutex_unlock(&pool->mutex);
+    *ncache = &c->ncache;
+    return &c->cache;
+}
+
+/*
+ * Job nodes come from the cache of the calling thread, and from the
+ * shared depot, half a cache at a time, when it runs dry.
+ */
+static job_t *job_alloc(thr_pool_t *pool)
+{
+    int *ncache = NULL;
+    void **cache = job_cache(pool, &ncache);
+    return (job_t *) thr_slab_alloc(pool->jobs, cache, ncache);
+}
+
+/* Allocate a chain of n job nodes linked through job->next */
+static job_t *job_alloc_chain(thr_pool_t *pool, int n)
+{
+    int *ncache = NULL;
+    void **cache = job_cache(pool, &ncache);
+    return (job_t *) thr_slab_alloc_chain(pool->jobs, cache, ncache, n);
+}
+
+/* Fill a job node of default priority, outside of any group */
+static void job_init(job_t *job, void *(*func)(void *), void *arg)
+{
+    job->func = func;
+    job->arg = arg;
+    job->flags = 0;
+    job->prio = THR_PRIO_NORMAL;
+    job->group = NULL;
+#ifndef THR_POOL_NO_STATS
+    job->queued_at = now_ns();
+#endif
+}
+
+static void job_free(thr_pool_t *pool, job_t *job)
+{
+    /* The copy of the argument of thr_pool_add_inline() */
+    if (job->flags & THR_JOB_BUFFER)
+        thr_slab_free(pool->buffers, NULL, NULL, job->arg);
+    else if (job->flags & THR_JOB_HEAP)
+        free(job->arg);
+
+    /* The job returned, was cancelled or dropped: it is over anyway */
+    if (job->group != NULL)
+        group_done(job->group);
+
+    if (job->flags & THR_JOB_FUTURE) {
+        thr_future_t *future = (thr_future_t *) job;
+        /* The job was dropped or cancelled before it returned */
+        if ((__atomic_load_n(&future->state, __ATOMIC_ACQUIRE) &
+             ~FUTURE_WAITERS) == THR_FUTURE_PENDING)
+            future_finish(future, NULL, THR_FUTURE_CANCELLED);
+        future_unref(future);
+        return;
+    }
+
+    /* Release the successors once the node is back in the cache */
+    thr_task_t *task = job->flags & THR_JOB_TASK ? (thr_task_t *) job->arg :
+                       NULL;
+    /* The run of a strand was dropped or cancelled, so are its jobs */
+    thr_strand_t *strand = job->flags & THR_JOB_STRAND ?
+                           (thr_strand_t *) job->arg : NULL;
+    /* A helper of a parallel loop returned, or never will */
+    void *part = job->flags & THR_JOB_PFOR ? job->arg : NULL;
+
+    int *ncache = NULL;
+    void **cache = job_cache(pool, &ncache);
+    thr_slab_free(pool->jobs, cache, ncache, job);
+
+    if (task != NULL)
+        task_over(task);
+    if (strand != NULL)
+        strand_drop(pool, strand);
+    if (part != NULL)
+        pfor_over(part);
 }
 
 /*
+ * Claim a free worker slot and hand it to the spawner, which creates its
+ * thread without the pool lock. The slot counts in nthreads right away,
+ * so that concurrent producers do not ask for the same worker twice.
  * Only call this function when acquire lock
  */
-static int create_worker(void *arg)
+static int create_worker(thr_pool_t *pool)
 {
-    if (arg == NULL) return EINVAL;
-    thr_pool_t *pool = (thr_pool_t *)arg;
-    pthread_t thr;
-    int err = pthread_create(&thr, &pool->attr, worker_thread, pool);
-    if (err) return err;
+    if (pool->spawn_stop) return ECANCELED;
+
+    worker_t *slot = NULL;
+    for (int i = 0; i < pool->max; i++) {
+        if (!pool->workers[i].live) {
+            slot = &pool->workers[i];
+            break;
+        }
+    }
+    if (slot == NULL) return EAGAIN;
 
-    ++pool->nthreads;
+    slot->live = 1;
+    slot->spawn_next = pool->spawn_list;
+    pool->spawn_list = slot;
+    pool->spawning++;
+    __atomic_store_n(&pool->nthreads, pool->nthreads + 1, __ATOMIC_RELAXED);
+    pthread_cond_signal(&pool->spawncv);
     return 0;
 }
 
-static void *worker_thread(void *arg)
+/*
+ * Give back the slot of a worker that exited, or whose thread could not
+ * be created. Only call this function when acquire lock
+ */
+static void slot_release(thr_pool_t *pool, worker_t *slot)
 {
-    if (arg == NULL) return NULL;
-    thr_pool_t *pool = (thr_pool_t *)arg;
-    job_t *job = NULL;
-    worker_t self = { .thread = pthread_self(), .next = NULL };
-    int rc = 0;
-    struct timespec ts;
+    slot->live = 0;
+    __atomic_store_n(&pool->nthreads, pool->nthreads - 1, __ATOMIC_RELAXED);
 
-    pthread_mutex_lock(&pool->mutex);
-    pthread_cleanup_push(worker_cleanup, pool);
-    while (1) {
-        /*
-         * we don't know what the previous job do with cancelability state.
-         * So we need to reset the cancelability state
-         */
-        pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
-        pthread_setcanceltype(PTHREAD_CANCEL_ASYNCHRONOUS, NULL);
+    /* If this is the last thread, wake up thr_pool_destroy or shutdown */
+    if ((pool->status & (THR_POOL_DESTROY | THR_POOL_STOP)) &&
+        pool->nthreads == 0) {
+        pthread_cond_broadcast(&pool->busycv);
+    }
+}
 
-        while (pool->job_head == NULL &&
-               !(pool->status & THR_POOL_DESTROY) &&
-               rc == 0) {
-            ++pool->idle;
-            if (pool->timeout < 0) {
-                rc = pthread_cond_wait(&pool->jobcv, &pool->mutex);
-            } else {
-                clock_gettime(CLOCK_REALTIME, &ts);
-                ts.tv_sec += pool->timeout;
-                rc = pthread_cond_timedwait(&pool->jobcv, &pool->mutex, &ts);
-            }
-            --pool->idle;
-        }
+/*
+ * Create the thread of a claimed slot. Only the spawner calls this
+ * function, which serializes the uses of pool->attr
+ */
+static void spawn_worker(thr_pool_t *pool, worker_t *slot)
+{
+    if (pool->topo != NULL) {
+        cpu_set_t cpuset;
+        thr_topo_place((thr_topo_t *) pool->topo, pool->placement,
+                       slot->index, &cpuset, &slot->node);
+        pthread_attr_setaffinity_np(&pool->attr, sizeof(cpu_set_t), &cpuset);
+    }
 
-        if (pool->status & THR_POOL_DESTROY) break;
+    /* The worker stores its own pthread_t, see worker_thread() */
+    pthread_t thread;
+    int err = pthread_create(&thread, &pool->attr, worker_thread, slot);
+    if (err) {
+        pthread_mutex_lock(&pool->mutex);
+        slot_release(pool, slot);
+        pthread_mutex_unlock(&pool->mutex);
+        return;
+    }
 
-        if (pool->job_head != NULL) {
-            /* get a job, then do it */
-            job = pool->job_head;
-            pool->job_head = job->next;
-            if (job == pool->job_tail)
-                pool->job_tail = NULL;
+    __atomic_add_fetch(&pool->spawned, 1, __ATOMIC_RELAXED);
+}
 
-            self.next = pool->worker;
-            pool->worker = &self;
-            pthread_mutex_unlock(&pool->mutex);
+/*
+ * Create the threads of the slots claimed by create_worker(), one at a
+ * time, until thr_pool_destroy() stops it.
+ */
+static void *spawner_thread(void *arg)
+{
+    thr_pool_t *pool = (thr_pool_t *) arg;
+    worker_t *slot;
 
-            pthread_cleanup_push(job_cleanup, pool);
-            /*
-             * Call the specified job function
-             */
-            job->func(job->arg);
-            pthread_cleanup_pop(1);
-            free(job);
-            pthread_mutex_lock(&pool->mutex);
-            rc = 0;
+    pthread_mutex_lock(&pool->mutex);
+    while (!pool->spawn_stop) {
+        slot = pool->spawn_list;
+        if (slot == NULL) {
+            pthread_cond_wait(&pool->spawncv, &pool->mutex);
             continue;
         }
+        pool->spawn_list = slot->spawn_next;
+        pthread_mutex_unlock(&pool->mutex);
+
+        spawn_worker(pool, slot);
 
-        if (rc == ETIMEDOUT && pool->nthreads > pool->min) break;
-        rc = 0;
+        pthread_mutex_lock(&pool->mutex);
+        /* thr_pool_create_ex() waits for the prewarmed workers */
+        if (--pool->spawning == 0)
+            pthread_cond_broadcast(&pool->busycv);
     }
-    pthread_cleanup_pop(1);
+
+    /* The remaining slots never get a thread */
+    while ((slot = pool->spawn_list) != NULL) {
+        pool->spawn_list = slot->spawn_next;
+        pool->spawning--;
+        slot_release(pool, slot);
+    }
+    pthread_mutex_unlock(&pool->mutex);
     return NULL;
 }
 
-int thr_pool_create(thr_pool_t *pool,
-                    int min_threads,
-                    int max_threads,
-                    int timeout,
-                    const pthread_attr_t *attr)
+/* Stop the spawner and wait for it to exit */
+static void spawner_stop(thr_pool_t *pool)
 {
-    if (min_threads > max_threads || max_threads < 1 || pool == NULL) {
-        return EINVAL;
+    pthread_mutex_lock(&pool->mutex);
+    pool->spawn_stop = 1;
+    pthread_cond_signal(&pool->spawncv);
+    pthread_mutex_unlock(&pool->mutex);
+    pthread_join(pool->spawner, NULL);
+}
+
+/*
+ * Take the next job off the shared queues, or steal one from another
+ * worker. Only call this function when acquire lock
+ */
+static job_t *job_dequeue(thr_pool_t *pool, worker_t *self)
+{
+    job_t *job;
+
+    /* Urgent jobs are only queued on the list */
+    if (pool->ring != NULL && pool->urgent == 0 &&
+        (job = thr_ring_pop(pool->ring)) != NULL)
+        return job;
+
+    job = list_pop(pool);
+    if (job != NULL) return job;
+
+    return job_steal(pool, self);
+}
+
+/*
+ * Steal the oldest job of a random victim, visiting every other worker
+ * at most once.
+ */
+static job_t *job_steal(thr_pool_t *pool, worker_t *self)
+{
+    if (self->deque == NULL) return NULL;
+
+    /* xorshift32 */
+    unsigned int x = self->seed;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    self->seed = x;
+
+    int n = pool->max;
+    int start = (int)(x % (unsigned int)n);
+    for (int i = 0; i < n; i++) {
+        worker_t *victim = &pool->workers[(start + i) % n];
+        if (victim == self) continue;
+
+        job_t *job = (job_t *) thr_deque_steal(victim->deque);
+        if (job != NULL) return job;
     }
+    return NULL;
+}
 
-    pthread_mutex_init(&pool->mutex, NULL);
-    pthread_cond_init(&pool->jobcv, NULL);
-    pthread_cond_init(&pool->waitcv, NULL);
-    pthread_cond_init(&pool->busycv, NULL);
-    pool->worker = NULL;
-    pool->job_head = NULL;
-    pool->job_tail = NULL;
-    pool->status = THR_POOL_NEW;
-    pool->timeout = timeout;
-    pool->min = min_threads;
-    pool->max = max_threads;
-    pool->nthreads = 0;
-    pool->idle = 0;
-    
-    clone_pthread_attr(&pool->attr, attr);
+/*
+ * Return nonzero if a job may be waiting somewhere that does not need
+ * the pool lock to be published.
+ */
+static int jobs_visible(thr_pool_t *pool)
+{
+    if (pool->ring != NULL && !thr_ring_empty(pool->ring)) return 1;
 
+    if (pool->workers[0].deque != NULL) {
+        for (int i = 0; i < pool->max; i++) {
+            if (!thr_deque_empty(pool->workers[i].deque)) return 1;
+        }
+    }
     return 0;
 }
 
-int thr_pool_add(thr_pool_t *pool,
-                 void *(*func)(void *), void *arg)
+/*
+ * Wake up to n idle workers, and create as many workers as needed for
+ * the jobs no idle worker will pick up. Only call this function when
+ * acquire lock
+ */
+static void wake_locked(thr_pool_t *pool, int n)
 {
-    if (!pool || !func) return EINVAL;
+    /* Spinning workers will pick up that many jobs by themselves */
+    n -= __atomic_load_n(&pool->spinning, __ATOMIC_SEQ_CST);
 
-    job_t *job = (job_t *) malloc(sizeof(job_t));
-    if (!job) return ENOMEM;
+    /* The most recently parked workers first, their caches are hot */
+    while (n > 0 && pool->idle_stack != NULL) {
+        worker_t *w = pool->idle_stack;
+        /* The poller keeps polling while others are idle */
+        if (w == pool->poller && w->idle_next != NULL) w = w->idle_next;
+        idle_remove(pool, w);
+        idle_wake(pool, w);
+        n--;
+    }
 
-    job->func = func;
-    job->arg = arg;
-    job->next = NULL;
+    for (; n > 0 && pool->nthreads < pool->target; n--) {
+        if (create_worker(pool)) break;
+    }
+    if (n > 0 && pool->nthreads >= pool->target && pool->target < pool->max)
+        __atomic_store_n(&pool->throttled, pool->throttled + n,
+                         __ATOMIC_RELAXED);
+}
 
-    pthread_mutex_lock(&pool->mutex);
-    if (pool->job_head == NULL) {
-        pool->job_head = job;
-        pool->job_tail = job;
-    } else {
-        pool->job_tail->next = job;
-        pool->job_tail = job;
+/*
+ * Make sure somebody picks up n jobs that were queued without the pool
+ * lock, see wake_locked().
+ */
+static void wake_workers(thr_pool_t *pool, int n)
+{
+    /* Pairs with the idle worker re-checking the queues, see worker_park() */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&pool->spinning, __ATOMIC_RELAXED) >= n)
+        return;
+    if (__atomic_load_n(&pool->idle, __ATOMIC_RELAXED) > 0 ||
+        __atomic_load_n(&pool->nthreads, __ATOMIC_RELAXED) <
+        __atomic_load_n(&pool->target, __ATOMIC_RELAXED)) {
+        pthread_mutex_lock(&pool->mutex);
+        wake_locked(pool, n);
+        pthread_mutex_unlock(&pool->mutex);
     }
+}
 
-    if (pool->job_head != NULL && pool->idle > 0) {
-        pthread_cond_broadcast(&pool->jobcv);
-    } else if (pool->nthreads < pool->max) {
-        create_worker(pool);
+/*
+ * The idle workers form a stack, each of them waiting on its own condition
+ * variable so that a producer wakes exactly the worker it hands a job to.
+ * Only call these functions when acquire lock
+ */
+static void idle_push(thr_pool_t *pool, worker_t *w)
+{
+    w->idle_prev = NULL;
+    w->idle_next = pool->idle_stack;
+    if (pool->idle_stack != NULL) pool->idle_stack->idle_prev = w;
+    pool->idle_stack = w;
+    w->parked = 1;
+    __atomic_add_fetch(&pool->idle, 1, __ATOMIC_SEQ_CST);
+}
+
+static void idle_remove(thr_pool_t *pool, worker_t *w)
+{
+    if (w->idle_prev != NULL)
+        w->idle_prev->idle_next = w->idle_next;
+    else
+        pool->idle_stack = w->idle_next;
+    if (w->idle_next != NULL) w->idle_next->idle_prev = w->idle_prev;
+    w->idle_prev = NULL;
+    w->idle_next = NULL;
+    w->parked = 0;
+    __atomic_sub_fetch(&pool->idle, 1, __ATOMIC_SEQ_CST);
+}
+
+/* Wake up a worker taken off the idle stack, wherever it sleeps */
+static void idle_wake(thr_pool_t *pool, worker_t *w)
+{
+    if (w == pool->poller)
+        thr_reactor_wake((thr_reactor_t *) pool->reactor);
+    else
+        pthread_cond_signal(&w->parkcv);
+}
+
+/*
+ * Park the calling worker until a producer takes it off the idle stack,
+ * the pool is destroyed or the idle timeout expires. Meanwhile, the first
+ * idle worker polls the reactor if I/O is waiting.
+ * Return ETIMEDOUT if the worker timed out, 0 otherwise.
+ * Only call this function when acquire lock
+ */
+static int worker_park(thr_pool_t *pool, worker_t *self)
+{
+    struct timespec ts;
+    int rc = 0;
+
+    /*
+     * Announce ourselves idle before checking the lock-free queues again:
+     * a producer pushes first and then looks at pool->idle, so one of us
+     * is guaranteed to see the other.
+     */
+    idle_push(pool, self);
+    if (!jobs_visible(pool)) {
+        if (pool->timeout_ms >= 0) {
+            /* parkcv measures time against CLOCK_MONOTONIC */
+            clock_gettime(CLOCK_MONOTONIC, &ts);
+            ts.tv_sec += pool->timeout_ms / 1000;
+            ts.tv_nsec += (pool->timeout_ms % 1000) * 1000000L;
+            if (ts.tv_nsec >= 1000000000L) {
+                ts.tv_sec++;
+                ts.tv_nsec -= 1000000000L;
+            }
+        }
+        trace(pool, THR_TRACE_PARK, NULL);
+        while (self->parked && !(pool->status & THR_POOL_DESTROY) &&
+               rc == 0) {
+            /* One idle worker waits for I/O, and never times out then */
+            if (pool->io_waiting > 0 && pool->poller == NULL)
+                io_poll(pool, self);
+            else if (pool->timeout_ms < 0)
+                rc = pthread_cond_wait(&self->parkcv, &pool->mutex);
+            else
+                rc = pthread_cond_timedwait(&self->parkcv, &pool->mutex, &ts);
+        }
+        trace(pool, THR_TRACE_WAKE, NULL);
+    }
+
+    /* Nobody handed us a job */
+    if (self->parked) {
+        idle_remove(pool, self);
+        return rc;
     }
-    pthread_mutex_unlock(&pool->mutex);
     return 0;
 }
 
-int thr_pool_wait(thr_pool_t *pool)
+static uint64_t now_ns(void)
 {
-    if (pool == NULL) return EINVAL;
-    pthread_mutex_lock(&pool->mutex);
-    pool->status |= THR_POOL_WAIT;
-    while (pool->job_head != NULL || pool->worker != NULL) {
-        DEBUG("idle = %d,  nthreads = %d", pool->idle, pool->nthreads);
-        pthread_cond_wait(&pool->waitcv, &pool->mutex);
-        DEBUG("WAKE UP, idle = %d,  nthreads = %d", pool->idle, pool->nthreads);
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+/*
+ * Look for a job everywhere but in our own deque, which is empty.
+ * The pool lock is only taken when the list is not empty.
+ */
+static job_t *job_poll(thr_pool_t *pool, worker_t *self)
+{
+    job_t *job = NULL;
+
+    if (__atomic_load_n(&pool->urgent, __ATOMIC_RELAXED) == 0) {
+        if (pool->ring != NULL)
+            job = (job_t *) thr_ring_pop(pool->ring);
+        if (job == NULL)
+            job = job_steal(pool, self);
     }
-    pthread_mutex_unlock(&pool->mutex);
-    return 0;
+    if (job == NULL &&
+        __atomic_load_n(&pool->job_head, __ATOMIC_RELAXED) != NULL) {
+        pthread_mutex_lock(&pool->mutex);
+        job = job_dequeue(pool, self);
+        pthread_mutex_unlock(&pool->mutex);
+    }
+    return job;
 }
 
-void thr_pool_destroy(thr_pool_t *pool) {
-    if (pool == NULL) return;
-    
-    pthread_mutex_lock(&pool->mutex);
-    pthread_cleanup_push(pthread_mutex_unlock, &pool->mutex);
-    pool->status |= THR_POOL_DESTROY;
-    
-    /* Cancel all active thread */
-    worker_t *cur_worker;
-    while (pool->worker != NULL) {
-        cur_worker = pool->worker;
-        pool->worker = pool->worker->next;
-        pthread_cancel(cur_worker->thread);
-        DEBUG("CANCELED THREAD #%u", (unsigned int) cur_worker->thread);
+/*
+ * Busy-wait for a job before parking: spin with a pause instruction for
+ * the spin budget of the worker, then yield the CPU yield_count times.
+ * Producers skip waking anybody up as long as somebody is spinning, so a
+ * job found here costs neither the pool lock nor a futex wake.
+ */
+static job_t *worker_spin(thr_pool_t *pool, worker_t *self)
+{
+    job_t *job = NULL;
+    int phase = THR_IDLE_SPIN;
+    int budget = self->spin_budget;
+    uint64_t start = pool->adaptive_spin ? now_ns() : 0;
+    int i;
+
+    __atomic_add_fetch(&pool->spinning, 1, __ATOMIC_SEQ_CST);
+    for (i = 1; i <= budget && job == NULL; i++) {
+        thr_cpu_relax();
+        if ((i & 15) == 0 || i == budget) job = job_poll(pool, self);
     }
 
-    /* Destroy the job queue */
-    job_t *cur_job;
-    pool->job_tail = NULL;
-    while (pool->job_head != NULL) {
-        cur_job = pool->job_head;
-        pool->job_head = pool->job_head->next;
-        free(cur_job);
+    /* Calibrate the cost of 16 spins */
+    if (pool->adaptive_spin && i > 16) {
+        uint64_t cost = (now_ns() - start) * 16 / (uint64_t)(i - 1);
+        self->spin_cost = self->spin_cost ?
+                          (3 * self->spin_cost + cost) / 4 : cost;
     }
 
-    /* wake up all idle thread */
-    DEBUG("broadcast pool->jobcv");
-    pthread_cond_broadcast(&pool->jobcv);
+    for (i = 0; job == NULL && i < pool->yield_count; i++) {
+        phase = THR_IDLE_YIELD;
+        sched_yield();
+        job = job_poll(pool, self);
+    }
+    __atomic_sub_fetch(&pool->spinning, 1, __ATOMIC_SEQ_CST);
 
-    /* Wait for the last worker thread cleanup done */
-    while (pool->nthreads > 0) {
-        pthread_cond_wait(&pool->busycv, &pool->mutex);
+    if (job == NULL) return NULL;
+
+    idle_end(pool, self, phase, start);
+    /*
+     * Producers did not wake anybody up because we were spinning,
+     * pass the baton if there is more work.
+     */
+    if (jobs_visible(pool) ||
+        __atomic_load_n(&pool->job_head, __ATOMIC_RELAXED) != NULL)
+        wake_workers(pool, 1);
+    return job;
+}
+
+/*
+ * A job ended the idle period of the worker during the given phase.
+ * With adaptive spinning, track the average time the worker waits for a
+ * job and spin about twice as long, unless jobs come too rarely for the
+ * maximum budget to catch them; then only spin a little to keep learning.
+ */
+static void idle_end(thr_pool_t *pool, worker_t *self, int phase,
+                     uint64_t idle_start)
+{
+    __atomic_store_n(&self->handoffs[phase], self->handoffs[phase] + 1,
+                     __ATOMIC_RELAXED);
+
+    if (!pool->adaptive_spin || idle_start == 0 || self->spin_cost == 0)
+        return;
+
+    uint64_t gap = now_ns() - idle_start;
+    self->avg_gap = self->avg_gap ? (7 * self->avg_gap + gap) / 8 : gap;
+
+    uint64_t window = (uint64_t)pool->spin_count * self->spin_cost / 16;
+    if (self->avg_gap <= window) {
+        uint64_t budget = 2 * self->avg_gap * 16 / self->spin_cost + 16;
+        self->spin_budget = budget < (uint64_t)pool->spin_count ?
+                            (int)budget : pool->spin_count;
+    } else {
+        self->spin_budget = pool->spin_count / 16;
+    }
+}
+
+static void job_run(worker_t *self, job_t *job)
+{
+    self->job = job;
+
+    /* Nobody cancels the workers of a cooperative pool */
+    if (self->pool->cooperative) {
+        void *result = job->func(job->arg);
+        if (job->flags & THR_JOB_FUTURE)
+            future_finish((thr_future_t *) job, result, THR_FUTURE_READY);
+        stats_finished(self);
+        trace(self->pool, THR_TRACE_END, job);
+        job_cleanup(self);
+        return;
     }
+
+    pthread_cleanup_push(job_cleanup, self);
+    /*
+     * we don't know what the previous job do with cancelability state.
+     * So we need to reset the cancelability state
+     */
+    pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+    pthread_setcanceltype(PTHREAD_CANCEL_ASYNCHRONOUS, NULL);
+
+    /*
+     * Call the specified job function
+     */
+    void *result = job->func(job->arg);
+
+    /* Cancellation is only allowed while a job is running */
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+    /* It may queue continuations, out of the reach of cancellation */
+    if (job->flags & THR_JOB_FUTURE)
+        future_finish((thr_future_t *) job, result, THR_FUTURE_READY);
+    stats_finished(self);
+    trace(self->pool, THR_TRACE_END, job);
     pthread_cleanup_pop(1);
+}
+
+/* What a worker was running before it helped, see worker_help() */
+typedef struct help_frame {
+    worker_t *self;
+    job_t *job;
+    uint64_t job_start;
+} help_frame_t;
+
+/* Back to the job that waits, even if the helped one was cancelled */
+static void help_cleanup(void *arg)
+{
+    help_frame_t *frame = (help_frame_t *) arg;
+    frame->self->job = frame->job;
+    frame->self->job_start = frame->job_start;
+}
+
+/*
+ * Run one queued job on a worker whose job waits: the most recent job of
+ * its own deque first, likely one the waiting job added, else any other.
+ * Return 0 if there was none.
+ */
+static int worker_help(worker_t *self)
+{
+    thr_pool_t *pool = self->pool;
+    job_t *job = NULL;
+    int state;
+
+    /* The lookup may take the pool lock */
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &state);
+    if (self->deque != NULL &&
+        __atomic_load_n(&pool->urgent, __ATOMIC_RELAXED) == 0)
+        job = (job_t *) thr_deque_pop(self->deque);
+    if (job == NULL)
+        job = job_poll(pool, self);
+    if (job == NULL) {
+        pthread_setcancelstate(state, NULL);
+        return 0;
+    }
+
+    queue_leave(pool, 1);
+    if (__atomic_load_n(&pool->status, __ATOMIC_SEQ_CST) &
+        THR_POOL_DESTROY) {
+        stats_failed(pool, 0);
+        job_free(pool, job);
+        job_done(pool, 1);
+    } else {
+        help_frame_t frame = { self, self->job, self->job_start };
+        pthread_cleanup_push(help_cleanup, &frame);
+        stats_started(self, job);
+        trace(pool, THR_TRACE_START, job);
+        job_run(self, job);
+        pthread_cleanup_pop(1);
+        /* job_cleanup() marked the worker idle */
+        if (!pool->cooperative)
+            __atomic_store_n(&self->busy, 1, __ATOMIC_SEQ_CST);
+    }
+    pthread_setcancelstate(state, NULL);
+    return 1;
+}
+
+/*
+ * Wait for *word to change from val as thr_futex_wait() does, or run a
+ * queued job instead when called from a job: the caller checks its
+ * condition again either way. Having nothing to run, a worker sleeps
+ * HELP_POLL_NS at most, since producers only wake up idle workers.
+ */
+static int wait_help(int *word, int val, const struct timespec *abstime)
+{
+    worker_t *self = current_worker;
+    if (self == NULL || self->job == NULL)
+        return thr_futex_wait(word, val, abstime);
+
+    if (worker_help(self)) return 0;
+
+    struct timespec poll;
+    clock_gettime(CLOCK_REALTIME, &poll);
+    poll.tv_nsec += HELP_POLL_NS;
+    if (poll.tv_nsec >= 1000000000L) {
+        poll.tv_sec++;
+        poll.tv_nsec -= 1000000000L;
+    }
+    if (abstime != NULL &&
+        (abstime->tv_sec < poll.tv_sec ||
+         (abstime->tv_sec == poll.tv_sec && abstime->tv_nsec <= poll.tv_nsec)))
+        return thr_futex_wait(word, val, abstime);
+
+    thr_futex_wait(word, val, &poll);
+    return 0;
+}
+
+static void *worker_thread(void *arg)
+{
+    if (arg == NULL) return NULL;
+    worker_t *self = (worker_t *)arg;
+    thr_pool_t *pool = self->pool;
+    job_t *job = NULL;
+
+    current_worker = self;
+    /* Before the first job, which destroy may cancel through it */
+    self->thread = pthread_self();
+    trace(pool, THR_TRACE_SPAWN, (void *) (intptr_t) self->index);
+    self->seed = (unsigned int)self->index * 2654435761u + 1;
+
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+    pthread_cleanup_push(worker_cleanup, self);
+    while (1) {
+        /*
+         * Lock-free fast path: own deque, the ring, then the others,
+         * unless jobs of a higher priority wait on the list
+         */
+        job = NULL;
+        if (__atomic_load_n(&pool->urgent, __ATOMIC_RELAXED) == 0) {
+            if (self->deque != NULL)
+                job = (job_t *) thr_deque_pop(self->deque);
+            if (job == NULL && pool->ring != NULL)
+                job = (job_t *) thr_ring_pop(pool->ring);
+            if (job == NULL)
+                job = job_steal(pool, self);
+        }
+
+        /* Idle: spin, yield, then park */
+        uint64_t idle_start = 0;
+        if (job == NULL && (pool->spin_count > 0 || pool->yield_count > 0)) {
+            job = worker_spin(pool, self);
+            idle_start = pool->adaptive_spin && job == NULL ? now_ns() : 0;
+        }
+
+        if (job == NULL) {
+            int parked = 0;
+            pthread_mutex_lock(&pool->mutex);
+            while ((job = job_dequeue(pool, self)) == NULL &&
+                   !(pool->status & (THR_POOL_DESTROY | THR_POOL_STOP))) {
+                parked = 1;
+                /* Above the target of the scaler, if any, or the minimum */
+                if (worker_park(pool, self) == ETIMEDOUT &&
+                    pool->nthreads > pool->min &&
+                    (pool->scaler == NULL ||
+                     pool->nthreads > pool->target))
+                    break;
+            }
+
+            /* The pool is being destroyed, stopped, or we timed out */
+            if (job == NULL) {
+                if (!(pool->status & (THR_POOL_DESTROY | THR_POOL_STOP))) {
+                    __atomic_store_n(&pool->retired, pool->retired + 1,
+                                     __ATOMIC_RELAXED);
+                    trace(pool, THR_TRACE_RETIRE, NULL);
+                }
+                pthread_mutex_unlock(&pool->mutex);
+                break;
+            }
+
+            if (parked) {
+                idle_end(pool, self, THR_IDLE_PARK, idle_start);
+            } else if (pool->spin_count > 0 || pool->yield_count > 0) {
+                /* We were spinning until just now, see worker_spin() */
+                if (pool->job_head != NULL || jobs_visible(pool))
+                    wake_locked(pool, 1);
+            }
+            if (!pool->cooperative)
+                __atomic_store_n(&self->busy, 1, __ATOMIC_SEQ_CST);
+            pthread_mutex_unlock(&pool->mutex);
+        } else if (!pool->cooperative) {
+            __atomic_store_n(&self->busy, 1, __ATOMIC_SEQ_CST);
+        }
+
+        queue_leave(pool, 1);
+
+        /*
+         * Either thr_pool_destroy() sees us busy and cancels us,
+         * or we see it here and drop the job.
+         */
+        if (__atomic_load_n(&pool->status, __ATOMIC_SEQ_CST) &
+            THR_POOL_DESTROY) {
+            __atomic_store_n(&self->busy, 0, __ATOMIC_RELEASE);
+            stats_failed(pool, 0);
+            job_free(pool, job);
+            job_done(pool, 1);
+            break;
+        }
+
+        stats_started(self, job);
+        trace(pool, THR_TRACE_START, job);
+        job_run(self, job);
+    }
+    pthread_cleanup_pop(1);
+    current_worker = NULL;
+    return NULL;
+}
+
+/*
+ * Allocate one slot for each possible worker thread of the pool, and
+ * a deque of deque_capacity jobs for each of them unless it is 0.
+ */
+static int alloc_workers(thr_pool_t *pool, size_t deque_capacity)
+{
+    void *mem;
+    if (posix_memalign(&mem, THR_CACHE_LINE, pool->max * sizeof(worker_t)))
+        return ENOMEM;
+    pool->workers = (worker_t *) mem;
+
+    thr_deque_t *deques = NULL;
+    if (deque_capacity > 0) {
+        if (posix_memalign(&mem, THR_CACHE_LINE,
+                           pool->max * sizeof(thr_deque_t))) {
+            free(pool->workers);
+            return ENOMEM;
+        }
+        deques = (thr_deque_t *) mem;
+    }
+
+    pthread_condattr_t condattr;
+    pthread_condattr_init(&condattr);
+    pthread_condattr_setclock(&condattr, CLOCK_MONOTONIC);
+
+    for (int i = 0; i < pool->max; i++) {
+        worker_t *slot = &pool->workers[i];
+        slot->pool = pool;
+        slot->job = NULL;
+        slot->deque = NULL;
+        slot->seed = 0;
+        slot->job_cache = NULL;
+        slot->job_ncache = 0;
+        slot->index = i;
+        slot->node = -1;
+        slot->live = 0;
+        slot->busy = 0;
+        slot->idle_prev = NULL;
+        slot->idle_next = NULL;
+        slot->parked = 0;
+        slot->spawn_next = NULL;
+        pthread_cond_init(&slot->parkcv, &condattr);
+        slot->spin_budget = pool->spin_count;
+        slot->spin_cost = 0;
+        slot->avg_gap = 0;
+        for (int phase = 0; phase < THR_IDLE_PHASES; phase++)
+            slot->handoffs[phase] = 0;
+        memset(&slot->stats, 0, sizeof(slot->stats));
+        slot->job_start = 0;
+        if (deques != NULL) {
+            if (thr_deque_init(&deques[i], deque_capacity)) {
+                while (--i >= 0) thr_deque_destroy(&deques[i]);
+                free(deques);
+                free(pool->workers);
+                pthread_condattr_destroy(&condattr);
+                return ENOMEM;
+            }
+            slot->deque = (struct thr_deque *) &deques[i];
+        }
+    }
+    pthread_condattr_destroy(&condattr);
+    return 0;
+}
+
+/*
+ * Release the worker slots and their deques
+ */
+static void free_workers(thr_pool_t *pool)
+{
+    for (int i = 0; i < pool->max; i++)
+        pthread_cond_destroy(&pool->workers[i].parkcv);
+
+    if (pool->workers[0].deque != NULL) {
+        for (int i = 0; i < pool->max; i++)
+            thr_deque_destroy((thr_deque_t *) pool->workers[i].deque);
+        free(pool->workers[0].deque);
+    }
+    free(pool->workers);
+    pool->workers = NULL;
+}
+
+/*
+ * Release the job node allocator and every node it still holds
+ */
+static void free_jobs(thr_pool_t *pool)
+{
+    thr_slab_destroy((thr_slab_t *) pool->buffers);
+    free(pool->buffers);
+    pool->buffers = NULL;
+    thr_slab_destroy((thr_slab_t *) pool->futures);
+    free(pool->futures);
+    pool->futures = NULL;
+    thr_slab_destroy((thr_slab_t *) pool->jobs);
+    free(pool->jobs);
+    pool->jobs = NULL;
+}
+
+/*
+ * One trace ring for each worker slot, and one more for the threads
+ * outside of the pool.
+ */
+static int alloc_traces(thr_pool_t *pool, size_t capacity)
+{
+    void *mem;
+    if (posix_memalign(&mem, THR_CACHE_LINE,
+                       (pool->max + 1) * sizeof(thr_trace_t)))
+        return ENOMEM;
+
+    thr_trace_t *traces = (thr_trace_t *) mem;
+    for (int i = 0; i <= pool->max; i++) {
+        int err = thr_trace_init(&traces[i], capacity);
+        if (err) {
+            while (i-- > 0) thr_trace_destroy(&traces[i]);
+            free(traces);
+            return err;
+        }
+    }
+    pool->traces = (struct thr_trace *) traces;
+    return 0;
+}
+
+static void free_traces(thr_pool_t *pool)
+{
+    if (pool->traces == NULL) return;
+    for (int i = 0; i <= pool->max; i++)
+        thr_trace_destroy(&((thr_trace_t *) pool->traces)[i]);
+    free(pool->traces);
+    pool->traces = NULL;
+}
+
+void thr_pool_options_init(thr_pool_options_t *opts)
+{
+    if (opts == NULL) return;
+
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    opts->min_threads = 1;
+    opts->max_threads = ncpu > 0 ? (int)ncpu : 1;
+    opts->timeout = 60;
+    opts->attr = NULL;
+    opts->queue_mode = THR_QUEUE_LIST;
+    opts->queue_capacity = 1024;
+    opts->deque_capacity = 256;
+    opts->job_cache_size = 64;
+    opts->job_high_water = 1024;
+    opts->spin_count = 0;
+    opts->yield_count = 0;
+    opts->adaptive_spin = 0;
+    opts->prio_aging = 0;
+    opts->placement = THR_PLACE_NONE;
+    opts->trace_capacity = 0;
+    opts->max_queued = 0;
+    opts->timeout_ms = -1;
+    opts->scale_interval_ms = 0;
+    opts->scale_policy = NULL;
+    opts->scale_wait_us = 1000;
+    opts->scale_shrink_after = 10;
+    opts->prewarm = 0;
+    opts->cooperative = 0;
+}
+
+int thr_pool_create(thr_pool_t *pool,
+                    int min_threads,
+                    int max_threads,
+                    int timeout,
+                    const pthread_attr_t *attr)
+{
+    thr_pool_options_t opts;
+    thr_pool_options_init(&opts);
+    opts.min_threads = min_threads;
+    opts.max_threads = max_threads;
+    opts.timeout = timeout;
+    opts.attr = attr;
+    return thr_pool_create_ex(pool, &opts);
+}
+
+int thr_pool_create_ex(thr_pool_t *pool, const thr_pool_options_t *opts)
+{
+    thr_pool_options_t defaults;
+    if (opts == NULL) {
+        thr_pool_options_init(&defaults);
+        opts = &defaults;
+    }
+
+    if (opts->min_threads > opts->max_threads || opts->max_threads < 1 ||
+        pool == NULL) {
+        return EINVAL;
+    }
+    if (opts->queue_mode != THR_QUEUE_LIST &&
+        opts->queue_mode != THR_QUEUE_RING) {
+        return EINVAL;
+    }
+    if (opts->placement < THR_PLACE_NONE || opts->placement > THR_PLACE_NODE)
+        return EINVAL;
+    if (opts->scale_policy != NULL && opts->scale_policy->decide == NULL)
+        return EINVAL;
+#ifdef THR_POOL_NO_STATS
+    /* The scaler samples the statistics */
+    if (opts->scale_interval_ms > 0) return ENOTSUP;
+#endif
+
+    pool->jobs = (struct thr_slab *) malloc(sizeof(thr_slab_t));
+    if (pool->jobs == NULL) return ENOMEM;
+    int err = thr_slab_init((thr_slab_t *) pool->jobs, sizeof(job_t),
+                            opts->job_cache_size, opts->job_high_water);
+    if (err) {
+        free(pool->jobs);
+        return err;
+    }
+    pool->futures = (struct thr_slab *) malloc(sizeof(thr_slab_t));
+    err = pool->futures == NULL ? ENOMEM :
+          thr_slab_init((thr_slab_t *) pool->futures, sizeof(thr_future_t),
+                        0, opts->job_high_water);
+    if (err) {
+        free(pool->futures);
+        thr_slab_destroy((thr_slab_t *) pool->jobs);
+        free(pool->jobs);
+        return err;
+    }
+    pool->buffers = (struct thr_slab *) malloc(sizeof(thr_slab_t));
+    err = pool->buffers == NULL ? ENOMEM :
+          thr_slab_init((thr_slab_t *) pool->buffers, THR_JOB_BUFFER_SIZE,
+                        0, opts->job_high_water * sizeof(job_t) /
+                           THR_JOB_BUFFER_SIZE);
+    if (err) {
+        free(pool->buffers);
+        thr_slab_destroy((thr_slab_t *) pool->futures);
+        free(pool->futures);
+        thr_slab_destroy((thr_slab_t *) pool->jobs);
+        free(pool->jobs);
+        return err;
+    }
+
+    pool->max = opts->max_threads;
+    pool->spin_count = opts->spin_count > 0 ? opts->spin_count : 0;
+    pool->yield_count = opts->yield_count > 0 ? opts->yield_count : 0;
+    pool->adaptive_spin = opts->adaptive_spin;
+    pool->cooperative = opts->cooperative;
+    pool->spinning = 0;
+    err = alloc_workers(pool, opts->deque_capacity);
+    if (err) {
+        free_jobs(pool);
+        return err;
+    }
+
+    void *mem;
+    pool->ring = NULL;
+    if (opts->queue_mode == THR_QUEUE_RING) {
+        err = ENOMEM;
+        if (posix_memalign(&mem, THR_CACHE_LINE, sizeof(thr_ring_t)) == 0) {
+            err = thr_ring_init((thr_ring_t *) mem, opts->queue_capacity);
+            if (err) free(mem);
+        }
+        if (err) {
+            free_workers(pool);
+            free_jobs(pool);
+            return err;
+        }
+        pool->ring = (struct thr_ring *) mem;
+    }
+
+    pool->tracing = 0;
+    pool->trace_origin = now_ns();
+    pool->traces = NULL;
+    if (opts->trace_capacity > 0) {
+        err = alloc_traces(pool, opts->trace_capacity);
+        if (err) {
+            if (pool->ring != NULL) {
+                thr_ring_destroy((thr_ring_t *) pool->ring);
+                free(pool->ring);
+            }
+            free_workers(pool);
+            free_jobs(pool);
+            return err;
+        }
+        pool->tracing = 1;
+    }
+
+    pool->placement = opts->placement;
+    pool->topo = NULL;
+    if (opts->placement != THR_PLACE_NONE) {
+        pool->topo = (struct thr_topo *) malloc(sizeof(thr_topo_t));
+        err = pool->topo == NULL ? ENOMEM :
+              thr_topo_load((thr_topo_t *) pool->topo);
+        if (err) {
+            free(pool->topo);
+            free_traces(pool);
+            if (pool->ring != NULL) {
+                thr_ring_destroy((thr_ring_t *) pool->ring);
+                free(pool->ring);
+            }
+            free_workers(pool);
+            free_jobs(pool);
+            return err;
+        }
+    }
+
+    pthread_mutex_init(&pool->mutex, NULL);
+    pthread_cond_init(&pool->busycv, NULL);
+    pthread_cond_init(&pool->notfullcv, NULL);
+    pthread_cond_init(&pool->spawncv, NULL);
+    pthread_mutex_init(&pool->timer_mutex, NULL);
+    pthread_condattr_t condattr;
+    pthread_condattr_init(&condattr);
+    pthread_condattr_setclock(&condattr, CLOCK_MONOTONIC);
+    pthread_cond_init(&pool->timercv, &condattr);
+    pthread_condattr_destroy(&condattr);
+    pool->wheel = NULL;
+    pool->timers = NULL;
+    pool->timer_stop = 0;
+    pool->timer_wakeup = ~0ULL;
+    pool->reactor = NULL;
+    pool->io_waiting = 0;
+    pool->poller = NULL;
+    pool->idle_stack = NULL;
+    pool->job_head = NULL;
+    pool->job_tail = NULL;
+    for (int prio = 0; prio < THR_PRIO_LEVELS; prio++)
+        pool->prio_tail[prio] = NULL;
+    pool->urgent = 0;
+    pool->prio_aging = opts->prio_aging > 0 ? opts->prio_aging : 0;
+    pool->prio_served = 0;
+    pool->pending = 0;
+    pool->wait_waiters = 0;
+    pool->wait_nested = 0;
+    pool->wait_seq = 0;
+    memset(&pool->ext_stats, 0, sizeof(pool->ext_stats));
+    pool->depth = 0;
+    pool->peak_depth = 0;
+    pool->queued = 0;
+    pool->max_queued = opts->max_queued < LONG_MAX ?
+                       (long) opts->max_queued : LONG_MAX;
+    pool->add_waiters = 0;
+    pool->spawned = 0;
+    pool->retired = 0;
+    pool->status = THR_POOL_NEW;
+    pool->timeout = opts->timeout;
+    if (opts->timeout_ms >= 0)
+        pool->timeout_ms = opts->timeout_ms;
+    else
+        pool->timeout_ms = opts->timeout < 0 ? -1 : opts->timeout * 1000L;
+    pool->scale_ups = 0;
+    pool->scale_downs = 0;
+    pool->throttled = 0;
+    pool->min = opts->min_threads;
+    pool->nthreads = 0;
+    pool->idle = 0;
+
+    clone_pthread_attr(&pool->attr, opts->attr);
+    pool->spawn_list = NULL;
+    pool->spawning = 0;
+    pool->spawn_stop = 0;
+
+    pool->scaler = NULL;
+    pool->target = pool->max;
+    err = pthread_create(&pool->spawner, NULL, spawner_thread, pool);
+    if (!err && opts->scale_interval_ms > 0) {
+        err = scaler_start(pool, opts);
+        if (err) spawner_stop(pool);
+    }
+    if (err) {
+        pthread_attr_destroy(&pool->attr);
+        pthread_cond_destroy(&pool->spawncv);
+        pthread_mutex_destroy(&pool->timer_mutex);
+        pthread_cond_destroy(&pool->timercv);
+        pthread_cond_destroy(&pool->notfullcv);
+        pthread_cond_destroy(&pool->busycv);
+        pthread_mutex_destroy(&pool->mutex);
+        if (pool->topo != NULL) {
+            thr_topo_destroy((thr_topo_t *) pool->topo);
+            free(pool->topo);
+        }
+        free_traces(pool);
+        if (pool->ring != NULL) {
+            thr_ring_destroy((thr_ring_t *) pool->ring);
+            free(pool->ring);
+        }
+        free_workers(pool);
+        free_jobs(pool);
+        return err;
+    }
+
+    pool_register(pool);
+
+    if (opts->prewarm) {
+        pthread_mutex_lock(&pool->mutex);
+        while (pool->nthreads < pool->min && create_worker(pool) == 0)
+            ;
+        while (pool->spawning > 0)
+            pthread_cond_wait(&pool->busycv, &pool->mutex);
+        err = pool->nthreads < pool->min ? EAGAIN : 0;
+        pthread_mutex_unlock(&pool->mutex);
+        if (err) {
+            thr_pool_destroy(pool);
+            return err;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Lock-free submission of a THR_QUEUE_RING pool.
+ * Return EAGAIN if the ring is full.
+ */
+static int ring_add(thr_pool_t *pool, job_t *job)
+{
+    if (thr_ring_push(pool->ring, job) != 0) return EAGAIN;
+
+    wake_workers(pool, 1);
+    return 0;
+}
+
+/*
+ * Push a job on the deque of the calling worker.
+ * Return EAGAIN if the deque is full.
+ */
+static int local_add(thr_pool_t *pool, worker_t *self, job_t *job)
+{
+    if (thr_deque_push(self->deque, job) != 0) return EAGAIN;
+
+    wake_workers(pool, 1);
+    return 0;
+}
+
+/* Queue a job: local deque, else ring, else list */
+static void job_submit(thr_pool_t *pool, job_t *job)
+{
+    job_queue(pool, job, 1);
+}
+
+/*
+ * Queue a job on the deque of the calling worker if local is nonzero,
+ * else behind the jobs already in the shared queue.
+ */
+static void job_queue(thr_pool_t *pool, job_t *job, int local)
+{
+    stats_enqueued(pool, 1);
+    trace(pool, THR_TRACE_ENQUEUE, job);
+    /* Counted before anybody can pick it up, see job_done() */
+    __atomic_add_fetch(&pool->pending, 1, __ATOMIC_RELAXED);
+
+    worker_t *self = current_worker;
+    if (local && self != NULL && self->pool == pool && self->deque != NULL) {
+        if (local_add(pool, self, job) == 0) return;
+        /* The deque is full, fall back on the shared queue */
+    }
+
+    /* The ring is full, overflow on the list */
+    if (pool->ring != NULL && ring_add(pool, job) == 0) return;
+
+    pthread_mutex_lock(&pool->mutex);
+    list_insert(pool, job, job, 1, job->prio);
+    wake_locked(pool, 1);
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+/*
+ * Reserve room for n jobs in a bounded queue. A batch larger than the
+ * bound is only admitted into an empty queue.
+ * Return 0 on success, or EAGAIN if the queue is full.
+ */
+static int queue_reserve(thr_pool_t *pool, long n)
+{
+    long queued = __atomic_load_n(&pool->queued, __ATOMIC_SEQ_CST);
+    do {
+        if (queued > 0 && queued + n > pool->max_queued) return EAGAIN;
+    } while (!__atomic_compare_exchange_n(&pool->queued, &queued, queued + n,
+                                          1, __ATOMIC_SEQ_CST,
+                                          __ATOMIC_SEQ_CST));
+    return 0;
+}
+
+/*
+ * Admit n jobs into the queue of the pool, see ADMIT_*. Waiting for room
+ * gives up at abstime if it is not NULL, or when the pool is destroyed.
+ * Return 0 on success; otherwise return an error number.
+ */
+static int queue_admit(thr_pool_t *pool, long n, int mode,
+                       const struct timespec *abstime)
+{
+    /* A stopped pool only takes the jobs its workers add while draining */
+    worker_t *self;
+    int status = __atomic_load_n(&pool->status, __ATOMIC_ACQUIRE);
+    if (THR_UNLIKELY(status & THR_POOL_STOP)) {
+        self = current_worker;
+        if ((status & THR_POOL_DISCARD) || self == NULL || self->pool != pool)
+            return ECANCELED;
+    }
+
+    if (pool->max_queued == 0) return 0;
+
+    /* A worker waiting for its own pool to drain may wait forever */
+    self = current_worker;
+    if (mode == ADMIT_WAIT && abstime == NULL &&
+        self != NULL && self->pool == pool)
+        mode = ADMIT_FORCE;
+
+    if (mode == ADMIT_FORCE) {
+        __atomic_add_fetch(&pool->queued, n, __ATOMIC_SEQ_CST);
+        return 0;
+    }
+    if (queue_reserve(pool, n) == 0) return 0;
+    if (mode == ADMIT_TRY) return EAGAIN;
+
+    int err = 0;
+    pthread_mutex_lock(&pool->mutex);
+    /* Pairs with queue_leave() looking for waiters once it made room */
+    __atomic_add_fetch(&pool->add_waiters, 1, __ATOMIC_SEQ_CST);
+    for (;;) {
+        if (pool->status & (THR_POOL_DESTROY | THR_POOL_STOP)) {
+            err = ECANCELED;
+            break;
+        }
+        if (queue_reserve(pool, n) == 0) {
+            err = 0;
+            break;
+        }
+        if (err != 0) break;
+        if (abstime == NULL)
+            err = pthread_cond_wait(&pool->notfullcv, &pool->mutex);
+        else
+            err = pthread_cond_timedwait(&pool->notfullcv, &pool->mutex,
+                                         abstime);
+    }
+    __atomic_sub_fetch(&pool->add_waiters, 1, __ATOMIC_SEQ_CST);
+
+    if (pool->status & (THR_POOL_DESTROY | THR_POOL_STOP)) {
+        /* thr_pool_destroy() and shutdown wait for the last of us to leave */
+        if (pool->add_waiters == 0)
+            pthread_cond_broadcast(&pool->busycv);
+    } else if (err == 0 && pool->add_waiters > 0 &&
+               __atomic_load_n(&pool->queued, __ATOMIC_RELAXED) <
+               pool->max_queued) {
+        /* There is room left for the next producer */
+        pthread_cond_signal(&pool->notfullcv);
+    }
+    pthread_mutex_unlock(&pool->mutex);
+    return err;
+}
+
+/*
+ * n admitted jobs left the queue: they started, or were dropped.
+ * The pool lock is only taken when producers wait for room.
+ */
+static void queue_leave(thr_pool_t *pool, long n)
+{
+    if (pool->max_queued == 0) return;
+
+    __atomic_sub_fetch(&pool->queued, n, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&pool->add_waiters, __ATOMIC_SEQ_CST) > 0) {
+        pthread_mutex_lock(&pool->mutex);
+        pthread_cond_signal(&pool->notfullcv);
+        pthread_mutex_unlock(&pool->mutex);
+    }
+}
+
+static int add_job(thr_pool_t *pool, void *(*func)(void *), void *arg,
+                   int mode, const struct timespec *abstime)
+{
+    if (!pool || !func) return EINVAL;
+
+    int err = queue_admit(pool, 1, mode, abstime);
+    if (err) return err;
+
+    job_t *job = job_alloc(pool);
+    if (!job) {
+        queue_leave(pool, 1);
+        return ENOMEM;
+    }
+
+    job_init(job, func, arg);
+    job->next = NULL;
+
+    job_submit(pool, job);
+    return 0;
+}
+
+int thr_pool_add(thr_pool_t *pool,
+                 void *(*func)(void *), void *arg)
+{
+    return add_job(pool, func, arg, ADMIT_WAIT, NULL);
+}
+
+int thr_pool_try_add(thr_pool_t *pool,
+                     void *(*func)(void *), void *arg)
+{
+    return add_job(pool, func, arg, ADMIT_TRY, NULL);
+}
+
+int thr_pool_timed_add(thr_pool_t *pool, void *(*func)(void *), void *arg,
+                       const struct timespec *abstime)
+{
+    if (abstime == NULL) return EINVAL;
+    return add_job(pool, func, arg, ADMIT_WAIT, abstime);
+}
+
+int thr_pool_add_inline(thr_pool_t *pool, void *(*func)(void *),
+                        const void *data, size_t size)
+{
+    if (!pool || !func || (size > 0 && !data)) return EINVAL;
+
+    int err = queue_admit(pool, 1, ADMIT_WAIT, NULL);
+    if (err) return err;
+
+    job_t *job = job_alloc(pool);
+    if (!job) {
+        queue_leave(pool, 1);
+        return ENOMEM;
+    }
+    job_init(job, func, job->data);
+    job->next = NULL;
+
+    if (size > THR_JOB_INLINE) {
+        if (size <= THR_JOB_BUFFER_SIZE) {
+            job->arg = thr_slab_alloc(pool->buffers, NULL, NULL);
+            job->flags |= THR_JOB_BUFFER;
+        } else {
+            job->arg = malloc(size);
+            job->flags |= THR_JOB_HEAP;
+        }
+        if (!job->arg) {
+            job->flags = 0;
+            job_free(pool, job);
+            queue_leave(pool, 1);
+            return ENOMEM;
+        }
+    }
+    if (size > 0) memcpy(job->arg, data, size);
+
+    job_submit(pool, job);
+    return 0;
+}
+
+int thr_pool_add_prio(thr_pool_t *pool,
+                      void *(*func)(void *), void *arg, int prio)
+{
+    if (prio < 0 || prio >= THR_PRIO_LEVELS) return EINVAL;
+    if (prio == THR_PRIO_NORMAL) return thr_pool_add(pool, func, arg);
+    if (!pool || !func) return EINVAL;
+
+    int err = queue_admit(pool, 1, ADMIT_WAIT, NULL);
+    if (err) return err;
+
+    job_t *job = job_alloc(pool);
+    if (!job) {
+        queue_leave(pool, 1);
+        return ENOMEM;
+    }
+
+    job_init(job, func, arg);
+    job->prio = prio;
+    job->next = NULL;
+
+    stats_enqueued(pool, 1);
+    trace(pool, THR_TRACE_ENQUEUE, job);
+
+    __atomic_add_fetch(&pool->pending, 1, __ATOMIC_RELAXED);
+
+    /* Only the list orders jobs by priority */
+    pthread_mutex_lock(&pool->mutex);
+    list_insert(pool, job, job, 1, prio);
+    wake_locked(pool, 1);
+    pthread_mutex_unlock(&pool->mutex);
+    return 0;
+}
+
+/*
+ * Link the n jobs first..last, all of priority prio, behind the last job
+ * of the same or a higher priority, so that the list stays sorted by
+ * priority then by age. Only call this function when acquire lock.
+ */
+static void list_insert(thr_pool_t *pool, job_t *first, job_t *last,
+                        int n, int prio)
+{
+    job_t *prev = NULL;
+    for (int p = prio; p >= 0 && prev == NULL; p--)
+        prev = pool->prio_tail[p];
+
+    if (prev == NULL) {
+        last->next = pool->job_head;
+        /* spinning workers peek at job_head without the lock */
+        __atomic_store_n(&pool->job_head, first, __ATOMIC_RELAXED);
+    } else {
+        last->next = prev->next;
+        prev->next = first;
+    }
+    if (last->next == NULL)
+        pool->job_tail = last;
+    pool->prio_tail[prio] = last;
+
+    if (prio < THR_PRIO_NORMAL)
+        __atomic_add_fetch(&pool->urgent, n, __ATOMIC_RELAXED);
+}
+
+/*
+ * Unlink the oldest job of the highest priority. With aging, every
+ * prio_aging-th job taken while jobs of a lower priority wait is the oldest
+ * job of the lowest priority instead. Only call this function when
+ * acquire lock.
+ */
+static job_t *list_pop(thr_pool_t *pool)
+{
+    job_t *job = pool->job_head;
+    job_t *prev = NULL;
+
+    if (job == NULL) return NULL;
+
+    int lowest = pool->job_tail->prio;
+    if (pool->prio_aging > 0 && job->prio < lowest &&
+        ++pool->prio_served >= pool->prio_aging) {
+        pool->prio_served = 0;
+        for (int p = lowest - 1; p >= 0 && prev == NULL; p--)
+            prev = pool->prio_tail[p];
+        job = prev->next;
+    }
+
+    if (prev == NULL)
+        __atomic_store_n(&pool->job_head, job->next, __ATOMIC_RELAXED);
+    else
+        prev->next = job->next;
+    if (job == pool->job_tail)
+        pool->job_tail = prev;
+    /* job was the last of its level */
+    if (pool->prio_tail[job->prio] == job)
+        pool->prio_tail[job->prio] = NULL;
+
+    if (job->prio < THR_PRIO_NORMAL)
+        __atomic_sub_fetch(&pool->urgent, 1, __ATOMIC_RELAXED);
+    return job;
+}
+
+int thr_pool_submit(thr_pool_t *pool, void *(*func)(void *), void *arg,
+                    thr_future_t **future)
+{
+    if (!pool || !func || !future) return EINVAL;
+
+    int err = queue_admit(pool, 1, ADMIT_WAIT, NULL);
+    if (err) return err;
+
+    thr_future_t *f = (thr_future_t *)
+                      thr_slab_alloc(pool->futures, NULL, NULL);
+    if (!f) {
+        queue_leave(pool, 1);
+        return ENOMEM;
+    }
+
+    job_init(&f->job, func, arg);
+    f->job.flags = THR_JOB_FUTURE;
+    f->job.next = NULL;
+    f->pool = pool;
+    f->result = NULL;
+    f->state = THR_FUTURE_PENDING;
+    f->refs = 2;
+    f->then = NULL;
+
+    *future = f;
+    job_submit(pool, &f->job);
+    return 0;
+}
+
+/*
+ * Queue the continuation of a future whose job returned, or cancel it
+ * along with its own continuations if its predecessor did not return.
+ */
+static void future_continue(thr_future_t *next, int state)
+{
+    thr_pool_t *pool = next->pool;
+
+    /* Added by a worker most of the time, never held by a full queue */
+    if (state == THR_FUTURE_READY &&
+        queue_admit(pool, 1, ADMIT_FORCE, NULL) == 0) {
+#ifndef THR_POOL_NO_STATS
+        next->job.queued_at = now_ns();
+#endif
+        job_submit(pool, &next->job);
+        return;
+    }
+    future_finish(next, NULL, THR_FUTURE_CANCELLED);
+    future_unref(next);
+}
+
+/*
+ * Publish the result of a future: a single store of the state,
+ * and a futex wake only if somebody sleeps on it. Then release the
+ * continuations added so far, the later ones see the state.
+ */
+static void future_finish(thr_future_t *future, void *result, int state)
+{
+    future->result = result;
+    int old = __atomic_exchange_n(&future->state, state, __ATOMIC_RELEASE);
+    if (old & FUTURE_WAITERS)
+        thr_futex_wake(&future->state, INT_MAX);
+
+    thr_future_t *next = __atomic_exchange_n(&future->then, FUTURE_FIRED,
+                                             __ATOMIC_ACQ_REL);
+    while (next != NULL) {
+        /* save the link first: once queued, the job may be freed */
+        thr_future_t *link = (thr_future_t *) next->job.next;
+        next->job.next = NULL;
+        future_continue(next, state);
+        next = link;
+    }
+}
+
+int thr_future_then(thr_future_t *future, void *(*func)(void *), void *arg,
+                    thr_future_t **next)
+{
+    if (!future || !func || !next) return EINVAL;
+
+    thr_pool_t *pool = future->pool;
+    thr_future_t *f = (thr_future_t *)
+                      thr_slab_alloc(pool->futures, NULL, NULL);
+    if (!f) return ENOMEM;
+
+    job_init(&f->job, func, arg);
+    f->job.flags = THR_JOB_FUTURE;
+    f->pool = pool;
+    f->result = NULL;
+    f->state = THR_FUTURE_PENDING;
+    f->refs = 2;
+    f->then = NULL;
+    *next = f;
+
+    thr_future_t *head = __atomic_load_n(&future->then, __ATOMIC_ACQUIRE);
+    while (head != FUTURE_FIRED) {
+        f->job.next = (job_t *) head;
+        if (__atomic_compare_exchange_n(&future->then, &head, f, 1,
+                                        __ATOMIC_RELEASE, __ATOMIC_ACQUIRE))
+            return 0;
+    }
+
+    /* The job is already over */
+    f->job.next = NULL;
+    future_continue(f, __atomic_load_n(&future->state, __ATOMIC_ACQUIRE) &
+                       ~FUTURE_WAITERS);
+    return 0;
+}
+
+static void future_unref(thr_future_t *future)
+{
+    if (__atomic_sub_fetch(&future->refs, 1, __ATOMIC_ACQ_REL) == 0)
+        thr_slab_free(future->pool->futures, NULL, NULL, future);
+}
+
+int thr_future_timedwait(thr_future_t *future, const struct timespec *abstime)
+{
+    if (future == NULL) return EINVAL;
+
+    int state = __atomic_load_n(&future->state, __ATOMIC_ACQUIRE);
+    while ((state & ~FUTURE_WAITERS) == THR_FUTURE_PENDING) {
+        if (state != FUTURE_WAITERS &&
+            !__atomic_compare_exchange_n(&future->state, &state,
+                                         FUTURE_WAITERS, 0,
+                                         __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE))
+            continue;
+        int err = wait_help(&future->state, FUTURE_WAITERS, abstime);
+        state = __atomic_load_n(&future->state, __ATOMIC_ACQUIRE);
+        if (err == ETIMEDOUT && state == FUTURE_WAITERS) return ETIMEDOUT;
+    }
+    return state == THR_FUTURE_READY ? 0 : ECANCELED;
+}
+
+int thr_future_wait(thr_future_t *future)
+{
+    return thr_future_timedwait(future, NULL);
+}
+
+int thr_future_get(thr_future_t *future, void **result)
+{
+    if (result == NULL) return EINVAL;
+
+    int err = thr_future_timedwait(future, NULL);
+    *result = err == 0 ? future->result : NULL;
+    return err;
+}
+
+void thr_future_release(thr_future_t *future)
+{
+    if (future == NULL) return;
+    future_unref(future);
+}
+
+/*
+ * Queue a chain of n jobs: as many as possible without the lock on the
+ * deque of the calling worker or on the ring, the rest spliced on the list
+ * under a single lock acquisition. Then wake up just enough workers.
+ */
+static void batch_add(thr_pool_t *pool, job_t *chain, int n)
+{
+    job_t *job = chain;
+    job_t *next;
+    int queued = 0;     /* jobs queued without the lock */
+
+    stats_enqueued(pool, n);
+    if (tracing(pool)) {
+        for (job = chain; job != NULL; job = job->next)
+            trace(pool, THR_TRACE_ENQUEUE, job);
+        job = chain;
+    }
+
+    __atomic_add_fetch(&pool->pending, n, __ATOMIC_RELAXED);
+
+    worker_t *self = current_worker;
+    if (self != NULL && self->pool == pool && self->deque != NULL) {
+        /* save next first: once pushed, a job may be stolen and freed */
+        for (; job != NULL; job = next, queued++) {
+            next = job->next;
+            if (thr_deque_push(self->deque, job) != 0) break;
+        }
+    }
+
+    if (job != NULL && pool->ring != NULL) {
+        for (; job != NULL; job = next, queued++) {
+            next = job->next;
+            if (thr_ring_push(pool->ring, job) != 0) break;
+        }
+    }
+
+    if (job == NULL) {
+        wake_workers(pool, queued);
+        return;
+    }
+
+    job_t *tail = job;
+    while (tail->next != NULL) tail = tail->next;
+
+    pthread_mutex_lock(&pool->mutex);
+    list_insert(pool, job, tail, n - queued, THR_PRIO_NORMAL);
+    wake_locked(pool, n);
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+int thr_pool_add_batch(thr_pool_t *pool, const thr_job_desc_t *jobs, int n)
+{
+    if (!pool || n < 0 || (n > 0 && !jobs)) return EINVAL;
+    for (int i = 0; i < n; i++) {
+        if (!jobs[i].func) return EINVAL;
+    }
+    if (n == 0) return 0;
+
+    int err = queue_admit(pool, n, ADMIT_WAIT, NULL);
+    if (err) return err;
+
+    job_t *chain = job_alloc_chain(pool, n);
+    if (!chain) {
+        queue_leave(pool, n);
+        return ENOMEM;
+    }
+
+    job_t *job = chain;
+    for (int i = 0; i < n; i++, job = job->next) {
+        job_init(job, jobs[i].func, jobs[i].arg);
+    }
+
+    batch_add(pool, chain, n);
+    return 0;
+}
+
+int thr_pool_add_batch_args(thr_pool_t *pool,
+                            void *(*func)(void *), void *const *args, int n)
+{
+    if (!pool || !func || n < 0 || (n > 0 && !args)) return EINVAL;
+    if (n == 0) return 0;
+
+    int err = queue_admit(pool, n, ADMIT_WAIT, NULL);
+    if (err) return err;
+
+    job_t *chain = job_alloc_chain(pool, n);
+    if (!chain) {
+        queue_leave(pool, n);
+        return ENOMEM;
+    }
+
+    job_t *job = chain;
+    for (int i = 0; i < n; i++, job = job->next) {
+        job_init(job, func, args[i]);
+    }
+
+    batch_add(pool, chain, n);
+    return 0;
+}
+
+int thr_group_init(thr_group_t *group)
+{
+    if (group == NULL) return EINVAL;
+    group->outstanding = 0;
+    return 0;
+}
+
+int thr_pool_add_group(thr_pool_t *pool, thr_group_t *group,
+                       void *(*func)(void *), void *arg)
+{
+    if (!pool || !group || !func) return EINVAL;
+
+    int err = queue_admit(pool, 1, ADMIT_WAIT, NULL);
+    if (err) return err;
+
+    job_t *job = job_alloc(pool);
+    if (!job) {
+        queue_leave(pool, 1);
+        return ENOMEM;
+    }
+
+    job_init(job, func, arg);
+    job->group = group;
+    job->next = NULL;
+
+    __atomic_add_fetch(&group->outstanding, 1, __ATOMIC_RELAXED);
+    job_submit(pool, job);
+    return 0;
+}
+
+/*
+ * A job of the group is over. Wake up the waiters of the group, and only
+ * them, when it was the last one. The group may be freed as soon as
+ * outstanding reaches 0, so do not look for waiters: a single wake on the
+ * address only.
+ */
+static void group_done(thr_group_t *group)
+{
+    if (__atomic_sub_fetch(&group->outstanding, 1, __ATOMIC_SEQ_CST) == 0)
+        thr_futex_wake(&group->outstanding, INT_MAX);
+}
+
+int thr_group_timedwait(thr_group_t *group, const struct timespec *abstime)
+{
+    if (group == NULL) return EINVAL;
+
+    int err = 0;
+    int outstanding;
+    while ((outstanding = __atomic_load_n(&group->outstanding,
+                                          __ATOMIC_SEQ_CST)) != 0) {
+        if (wait_help(&group->outstanding, outstanding, abstime) ==
+            ETIMEDOUT) {
+            err = ETIMEDOUT;
+            break;
+        }
+    }
+    return err;
+}
+
+int thr_group_wait(thr_group_t *group)
+{
+    return thr_group_timedwait(group, NULL);
+}
+
+int thr_strand_init(thr_strand_t *strand)
+{
+    if (strand == NULL) return EINVAL;
+    strand->head = NULL;
+    strand->count = 0;
+    strand->batch = NULL;
+    strand->current = NULL;
+    strand->over = 0;
+    return 0;
+}
+
+/*
+ * Take the jobs added to a strand so far, oldest first. Only call this
+ * function when count says some are there: one may still be on its way
+ * between the count and the list.
+ */
+static job_t *strand_take(thr_strand_t *strand)
+{
+    job_t *list;
+    while ((list = __atomic_exchange_n(&strand->head, NULL,
+                                       __ATOMIC_ACQUIRE)) == NULL)
+        thr_cpu_relax();
+
+    job_t *batch = NULL;
+    while (list != NULL) {
+        job_t *next = list->next;
+        list->next = batch;
+        batch = list;
+        list = next;
+    }
+    return batch;
+}
+
+/*
+ * Drop every job of a strand whose run will never happen. The pool lock
+ * may be held: the producers waiting for room are woken up by destroy
+ * or shutdown, which are the only callers, so queued is updated as is.
+ */
+static void strand_drop(thr_pool_t *pool, thr_strand_t *strand)
+{
+    long over = strand->over;   /* including those run by the last batch */
+    long freed = 0;
+    long dropped = 0;           /* jobs that never started */
+    job_t *job;
+
+    /* Cancelled in the middle of a job, which left the queue already */
+    if ((job = strand->current) != NULL) {
+        strand->current = NULL;
+        job_free(pool, job);
+        over++;
+        freed++;
+    }
+    for (;;) {
+        while ((job = strand->batch) != NULL) {
+            strand->batch = job->next;
+            job_free(pool, job);
+            over++;
+            freed++;
+            dropped++;
+        }
+        if (over < __atomic_load_n(&strand->count, __ATOMIC_ACQUIRE)) {
+            strand->batch = strand_take(strand);
+            continue;
+        }
+        /* Jobs added meanwhile found the strand busy, drop them too */
+        long left = __atomic_sub_fetch(&strand->count, over,
+                                       __ATOMIC_ACQ_REL);
+        over = 0;
+        if (left == 0) break;
+    }
+    strand->over = 0;
+    job_done(pool, freed);
+    if (pool->max_queued > 0)
+        __atomic_sub_fetch(&pool->queued, dropped, __ATOMIC_SEQ_CST);
+}
+
+static void *strand_run(void *arg);
+
+/*
+ * Queue the run of a strand, or drop its jobs if the pool refuses it.
+ * A run that follows a batch goes behind the shared queue: the deque of
+ * the worker is popped first, and would hand the strand straight back.
+ * Return 0 on success, or the error that dropped the jobs.
+ */
+static int strand_schedule(thr_pool_t *pool, thr_strand_t *strand, int again)
+{
+    job_t *job = NULL;
+
+    int err = queue_admit(pool, 1, ADMIT_FORCE, NULL);
+    if (err == 0) {
+        job = job_alloc(pool);
+        if (job == NULL) {
+            queue_leave(pool, 1);
+            err = ENOMEM;
+        }
+    }
+    if (err) {
+        strand_drop(pool, strand);
+        return err;
+    }
+
+    job_init(job, strand_run, strand);
+    job->flags = THR_JOB_STRAND;
+    job->next = NULL;
+    job_queue(pool, job, !again);
+    return 0;
+}
+
+/*
+ * Run the jobs of a strand in a row on the current worker. Once the
+ * batch is over, the strand is queued again behind the other jobs if it
+ * has more, so that it does not starve them.
+ */
+static void *strand_run(void *arg)
+{
+    thr_strand_t *strand = (thr_strand_t *) arg;
+    worker_t *self = current_worker;
+    thr_pool_t *pool = self->pool;
+    int cancellable = !pool->cooperative;
+    long ran = 0;       /* jobs run by this batch */
+
+    /* Cancellation is only allowed while a job of the strand is running */
+    if (cancellable)
+        pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+    for (;;) {
+        if (strand->batch == NULL)
+            strand->batch = strand_take(strand);
+        job_t *job = strand->batch;
+        strand->batch = job->next;
+        strand->current = job;
+        queue_leave(pool, 1);
+
+        if (cancellable)
+            pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+        job->func(job->arg);
+        if (cancellable)
+            pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+
+        strand->current = NULL;
+        job_free(pool, job);
+        job_done(pool, 1);
+        ran++;
+        strand->over++;
+
+        if (strand->batch == NULL || ran == THR_STRAND_BATCH) {
+            /* Once count drops to 0, the strand belongs to the next run */
+            long over = strand->over;
+            strand->over = 0;
+            long left = __atomic_sub_fetch(&strand->count, over,
+                                           __ATOMIC_ACQ_REL);
+            if (left == 0 || ran == THR_STRAND_BATCH) {
+                /* The strand is over for this node, see job_free() */
+                self->job->flags &= ~THR_JOB_STRAND;
+                if (left > 0) strand_schedule(pool, strand, 1);
+                break;
+            }
+        }
+    }
+    return NULL;
+}
+
+int thr_pool_add_strand(thr_pool_t *pool, thr_strand_t *strand,
+                        void *(*func)(void *), void *arg)
+{
+    if (!pool || !strand || !func) return EINVAL;
+
+    int err = queue_admit(pool, 1, ADMIT_WAIT, NULL);
+    if (err) return err;
+
+    job_t *job = job_alloc(pool);
+    if (!job) {
+        queue_leave(pool, 1);
+        return ENOMEM;
+    }
+    job_init(job, func, arg);
+    /* Counted before anybody can run it, see job_done() */
+    __atomic_add_fetch(&pool->pending, 1, __ATOMIC_RELAXED);
+
+    /* The job that finds the strand empty queues its run */
+    long count = __atomic_fetch_add(&strand->count, 1, __ATOMIC_ACQ_REL);
+    job->next = __atomic_load_n(&strand->head, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&strand->head, &job->next, job, 1,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+        ;
+    /* Its own job is dropped along with the strand on failure */
+    if (count == 0)
+        return strand_schedule(pool, strand, 0);
+    return 0;
+}
+
+/*
+ * A task graph. Tasks and edges are added while the graph is not
+ * running. A run counts down the predecessors of every task; the thread
+ * releasing the last one queues the task, on its own deque if it is a
+ * worker, where the outputs it just wrote are still in its cache.
+ */
+struct thr_task {
+    thr_graph_t *graph;
+    void *(*func)(void *);
+    void *arg;
+    void *result;           /* value returned by func in the last run */
+    thr_task_t **succ;      /* the tasks depending on this one */
+    int nsucc;
+    int cap;                /* room in succ */
+    int npred;              /* edges into the task */
+    int pending;            /* predecessors not over yet in this run */
+    int ran;                /* func returned in this run */
+    thr_task_t *next;       /* in graph->tasks */
+    thr_task_t *ready;      /* scratch of thr_pool_run_graph() */
+    thr_task_t *skipped;    /* link in the worklist of task_over() */
+};
+
+struct thr_graph {
+    thr_pool_t *pool;       /* the pool of the current run */
+    thr_task_t *tasks;
+    int ntasks;
+    int outstanding;        /* tasks not over yet, futex word */
+    int failed;             /* a task of the run did not run */
+};
+
+int thr_graph_create(thr_graph_t **graph)
+{
+    if (graph == NULL) return EINVAL;
+
+    thr_graph_t *g = (thr_graph_t *) calloc(1, sizeof(thr_graph_t));
+    if (g == NULL) return ENOMEM;
+    *graph = g;
+    return 0;
+}
+
+static int graph_running(thr_graph_t *graph)
+{
+    return __atomic_load_n(&graph->outstanding, __ATOMIC_ACQUIRE) != 0;
+}
+
+int thr_graph_add(thr_graph_t *graph, void *(*func)(void *), void *arg,
+                  thr_task_t **task)
+{
+    if (!graph || !func || !task) return EINVAL;
+    if (graph_running(graph)) return EBUSY;
+
+    thr_task_t *t = (thr_task_t *) calloc(1, sizeof(thr_task_t));
+    if (t == NULL) return ENOMEM;
+
+    t->graph = graph;
+    t->func = func;
+    t->arg = arg;
+    t->next = graph->tasks;
+    graph->tasks = t;
+    graph->ntasks++;
+    *task = t;
+    return 0;
+}
+
+int thr_graph_edge(thr_graph_t *graph, thr_task_t *before, thr_task_t *after)
+{
+    if (!graph || !before || !after || before == after ||
+        before->graph != graph || after->graph != graph)
+        return EINVAL;
+    if (graph_running(graph)) return EBUSY;
+
+    if (before->nsucc == before->cap) {
+        int cap = before->cap ? 2 * before->cap : 4;
+        thr_task_t **succ = (thr_task_t **)
+                            realloc(before->succ, cap * sizeof(thr_task_t *));
+        if (succ == NULL) return ENOMEM;
+        before->succ = succ;
+        before->cap = cap;
+    }
+    before->succ[before->nsucc++] = after;
+    after->npred++;
+    return 0;
+}
+
+/* Run a task, and remember whether it returned */
+static void *task_run(void *arg)
+{
+    thr_task_t *task = (thr_task_t *) arg;
+    task->result = task->func(task->arg);
+    task->ran = 1;
+    return NULL;
+}
+
+/*
+ * All the predecessors of a task are over: queue it, unless the run
+ * already failed. A successor is added by a worker most of the time, so
+ * it is never held by a full queue.
+ * Return 0 if the task was queued, nonzero if the caller must count it
+ * over instead.
+ */
+static int task_ready(thr_task_t *task)
+{
+    thr_graph_t *graph = task->graph;
+    thr_pool_t *pool = graph->pool;
+
+    if (!__atomic_load_n(&graph->failed, __ATOMIC_ACQUIRE) &&
+        queue_admit(pool, 1, ADMIT_FORCE, NULL) == 0) {
+        job_t *job = job_alloc(pool);
+        if (job != NULL) {
+            job_init(job, task_run, task);
+            job->flags = THR_JOB_TASK;
+            job->next = NULL;
+            job_submit(pool, job);
+            return 0;
+        }
+        queue_leave(pool, 1);
+    }
+    return 1;
+}
+
+/*
+ * The job of a task returned, was cancelled or dropped, or the task was
+ * skipped. Release its successors, then count it out of the run. The
+ * successors skipped in turn go on a worklist rather than recursing, so
+ * that a failed chain of any length fits the stack of a worker.
+ */
+static void task_over(thr_task_t *task)
+{
+    thr_task_t *skipped = NULL;
+
+    for (;;) {
+        thr_graph_t *graph = task->graph;
+
+        if (!task->ran)
+            __atomic_store_n(&graph->failed, 1, __ATOMIC_RELEASE);
+
+        /* Pairs with the other predecessors: their results are visible */
+        for (int i = 0; i < task->nsucc; i++) {
+            thr_task_t *next = task->succ[i];
+            if (__atomic_sub_fetch(&next->pending, 1, __ATOMIC_ACQ_REL) == 0 &&
+                task_ready(next) != 0) {
+                next->skipped = skipped;
+                skipped = next;
+            }
+        }
+
+        /*
+         * The graph may be freed as soon as outstanding reaches 0, so do
+         * not look for waiters: a single wake for each run, on the address
+         * only. The tasks of the worklist still count in outstanding.
+         */
+        if (__atomic_sub_fetch(&graph->outstanding, 1, __ATOMIC_ACQ_REL) == 0)
+            thr_futex_wake(&graph->outstanding, INT_MAX);
+
+        if (skipped == NULL) break;
+        task = skipped;
+        skipped = task->skipped;
+    }
+}
+
+int thr_pool_run_graph(thr_pool_t *pool, thr_graph_t *graph)
+{
+    if (!pool || !graph) return EINVAL;
+    if (graph_running(graph)) return EBUSY;
+    if (graph->ntasks == 0) return 0;
+
+    /* Sort the tasks first, the tasks of a cycle would never be queued */
+    thr_task_t *task;
+    thr_task_t *ready = NULL;
+    int nroots = 0;
+    int sorted = 0;
+    for (task = graph->tasks; task != NULL; task = task->next) {
+        task->pending = task->npred;
+        if (task->npred == 0) {
+            task->ready = ready;
+            ready = task;
+            nroots++;
+        }
+    }
+    while (ready != NULL) {
+        task = ready;
+        ready = task->ready;
+        sorted++;
+        for (int i = 0; i < task->nsucc; i++) {
+            thr_task_t *next = task->succ[i];
+            if (--next->pending == 0) {
+                next->ready = ready;
+                ready = next;
+            }
+        }
+    }
+    if (sorted != graph->ntasks) return EINVAL;
+
+    int err = queue_admit(pool, nroots, ADMIT_WAIT, NULL);
+    if (err) return err;
+
+    job_t *chain = job_alloc_chain(pool, nroots);
+    if (!chain) {
+        queue_leave(pool, nroots);
+        return ENOMEM;
+    }
+
+    graph->pool = pool;
+    graph->failed = 0;
+    job_t *job = chain;
+    for (task = graph->tasks; task != NULL; task = task->next) {
+        task->pending = task->npred;
+        task->ran = 0;
+        task->result = NULL;
+        if (task->npred == 0) {
+            job_init(job, task_run, task);
+            job->flags = THR_JOB_TASK;
+            job = job->next;
+        }
+    }
+    __atomic_store_n(&graph->outstanding, graph->ntasks, __ATOMIC_SEQ_CST);
+
+    batch_add(pool, chain, nroots);
+    return 0;
+}
+
+int thr_graph_timedwait(thr_graph_t *graph, const struct timespec *abstime)
+{
+    if (graph == NULL) return EINVAL;
+
+    int outstanding;
+    while ((outstanding = __atomic_load_n(&graph->outstanding,
+                                          __ATOMIC_ACQUIRE)) != 0) {
+        if (wait_help(&graph->outstanding, outstanding, abstime) ==
+            ETIMEDOUT)
+            return ETIMEDOUT;
+    }
+    return __atomic_load_n(&graph->failed, __ATOMIC_RELAXED) ? ECANCELED : 0;
+}
+
+int thr_graph_wait(thr_graph_t *graph)
+{
+    return thr_graph_timedwait(graph, NULL);
+}
+
+void *thr_task_result(thr_task_t *task)
+{
+    if (task == NULL) return NULL;
+    return task->ran ? task->result : NULL;
+}
+
+void thr_graph_destroy(thr_graph_t *graph)
+{
+    if (graph == NULL) return;
+
+    thr_task_t *task = graph->tasks;
+    while (task != NULL) {
+        thr_task_t *next = task->next;
+        free(task->succ);
+        free(task);
+        task = next;
+    }
+    free(graph);
+}
+
+/*
+ * Delayed and periodic jobs. The timers sit in a hierarchical wheel of
+ * THR_TIMER_TICK_NS ticks counted from the pool creation, which a timer
+ * thread advances with CLOCK_MONOTONIC. Wheel, allocator and thread are
+ * only created with the first timer.
+ */
+struct thr_timer {
+    thr_wheel_node_t node;  /* must stay first, see thrpool_slab.h */
+    thr_pool_t *pool;
+    void *(*func)(void *);
+    void *arg;
+    unsigned long long period;  /* ticks between runs, 0 if delayed */
+    int state;              /* TIMER_* */
+    int refs;               /* the wheel and the caller */
+};
+
+/*
+ * The scaling controller. The timer thread runs its decisions, so that
+ * they still happen when every worker is busy.
+ */
+struct thr_scaler {
+    thr_scale_policy_t policy;
+    thr_hill_t hill;            /* state of the default policy */
+    unsigned long long interval;    /* ticks between two decisions */
+    unsigned long long next;    /* tick of the next decision */
+    uint64_t last;              /* time of the previous decision */
+    unsigned long completed;    /* jobs completed by then */
+    unsigned long wait_hist[THR_HIST_BUCKETS];  /* queue waits by then */
+};
+
+static unsigned long long timer_now(thr_pool_t *pool)
+{
+    return (now_ns() - pool->trace_origin) / THR_TIMER_TICK_NS;
+}
+
+static void timer_unref(thr_timer_t *timer)
+{
+    if (__atomic_sub_fetch(&timer->refs, 1, __ATOMIC_ACQ_REL) == 0)
+        thr_slab_free(timer->pool->timers, NULL, NULL, timer);
+}
+
+/*
+ * Queue the jobs of the expired timers as a single batch, and put the
+ * periodic ones back in the wheel. A pool that refuses the jobs cancels
+ * the timers instead. Only call this function when acquire timer_mutex;
+ * it is released while the jobs are queued.
+ */
+static void timers_fire(thr_pool_t *pool, thr_wheel_node_t *expired)
+{
+    thr_wheel_t *wheel = (thr_wheel_t *) pool->wheel;
+    thr_wheel_node_t *node;
+    int n = 0;
+
+    for (node = expired; node != NULL; node = node->next) n++;
+
+    if (queue_admit(pool, n, ADMIT_FORCE, NULL) != 0) {
+        while (expired != NULL) {
+            thr_timer_t *timer = (thr_timer_t *) expired;
+            expired = expired->next;
+            timer->state = TIMER_CANCELLED;
+            timer_unref(timer);
+        }
+        return;
+    }
+
+    job_t *chain = job_alloc_chain(pool, n);
+    if (chain == NULL) {
+        /* Out of job nodes, try again at the next tick */
+        queue_leave(pool, n);
+        while (expired != NULL) {
+            node = expired;
+            expired = node->next;
+            node->expires = wheel->now;
+            thr_wheel_add(wheel, node);
+        }
+        return;
+    }
+
+    job_t *job = chain;
+    while (expired != NULL) {
+        thr_timer_t *timer = (thr_timer_t *) expired;
+        expired = expired->next;
+
+        job_init(job, timer->func, timer->arg);
+        job = job->next;
+        if (timer->period > 0) {
+            /* Fixed rate, skipping the runs that are already late */
+            unsigned long long late = wheel->now - 1 - timer->node.expires;
+            timer->node.expires += (late / timer->period + 1) *
+                                   timer->period;
+            thr_wheel_add(wheel, &timer->node);
+        } else {
+            timer->state = TIMER_FIRED;
+            timer_unref(timer);
+        }
+    }
+
+    pthread_mutex_unlock(&pool->timer_mutex);
+    batch_add(pool, chain, n);
+    pthread_mutex_lock(&pool->timer_mutex);
+}
+
+static void *timer_thread(void *arg)
+{
+    thr_pool_t *pool = (thr_pool_t *) arg;
+    thr_wheel_t *wheel = (thr_wheel_t *) pool->wheel;
+
+    pthread_mutex_lock(&pool->timer_mutex);
+    while (!pool->timer_stop) {
+        unsigned long long now = timer_now(pool);
+        struct thr_scaler *scaler = pool->scaler;
+        if (scaler != NULL && now >= scaler->next) {
+            scaler->next = now + scaler->interval;
+            pthread_mutex_unlock(&pool->timer_mutex);
+            scale_decide(pool);
+            pthread_mutex_lock(&pool->timer_mutex);
+            continue;
+        }
+
+        thr_wheel_node_t *expired = thr_wheel_advance(wheel, now);
+        if (expired != NULL) {
+            timers_fire(pool, expired);
+            continue;
+        }
+
+        /* Sleep until the next tick with something to do */
+        unsigned long long next = thr_wheel_next(wheel);
+        if (scaler != NULL && scaler->next < next)
+            next = scaler->next;
+        pool->timer_wakeup = next;
+        if (next == ~0ULL) {
+            pthread_cond_wait(&pool->timercv, &pool->timer_mutex);
+        } else {
+            struct timespec ts;
+            uint64_t at = pool->trace_origin + next * THR_TIMER_TICK_NS;
+            ts.tv_sec = (time_t) (at / 1000000000u);
+            ts.tv_nsec = (long) (at % 1000000000u);
+            pthread_cond_timedwait(&pool->timercv, &pool->timer_mutex, &ts);
+        }
+        pool->timer_wakeup = ~0ULL;
+    }
+    pthread_mutex_unlock(&pool->timer_mutex);
+    return NULL;
+}
+
+/*
+ * Create the wheel, the allocator and the thread of the timers.
+ * Only call this function when acquire timer_mutex
+ */
+static int timers_start(thr_pool_t *pool)
+{
+    thr_wheel_t *wheel = (thr_wheel_t *) malloc(sizeof(thr_wheel_t));
+    thr_slab_t *timers = (thr_slab_t *) malloc(sizeof(thr_slab_t));
+    int err = wheel == NULL || timers == NULL ? ENOMEM :
+              thr_slab_init(timers, sizeof(thr_timer_t), 0, 0);
+    if (err) {
+        free(wheel);
+        free(timers);
+        return err;
+    }
+    thr_wheel_init(wheel, timer_now(pool));
+    pool->wheel = (struct thr_wheel *) wheel;
+    pool->timers = (struct thr_slab *) timers;
+
+    err = pthread_create(&pool->timer_thread, NULL, timer_thread, pool);
+    if (err) {
+        thr_slab_destroy(timers);
+        free(timers);
+        free(wheel);
+        pool->wheel = NULL;
+        pool->timers = NULL;
+    }
+    return err;
+}
+
+/*
+ * Stop the timer thread, and cancel the timers still pending. No timer
+ * can be added afterwards. Call this function without holding any lock
+ * of the pool.
+ */
+static void timers_stop(thr_pool_t *pool)
+{
+    pthread_mutex_lock(&pool->timer_mutex);
+    thr_wheel_t *wheel = (thr_wheel_t *) pool->wheel;
+    if (wheel == NULL || pool->timer_stop) {
+        pool->timer_stop = 1;
+        pthread_mutex_unlock(&pool->timer_mutex);
+        return;
+    }
+    pool->timer_stop = 1;
+    pthread_cond_signal(&pool->timercv);
+    pthread_mutex_unlock(&pool->timer_mutex);
+    pthread_join(pool->timer_thread, NULL);
+
+    /* Every timer is due within THR_WHEEL_MAX_DELTA ticks */
+    thr_wheel_node_t *node = thr_wheel_advance(wheel,
+                                               wheel->now + THR_WHEEL_MAX_DELTA);
+    while (node != NULL) {
+        thr_timer_t *timer = (thr_timer_t *) node;
+        node = node->next;
+        timer->state = TIMER_CANCELLED;
+        timer_unref(timer);
+    }
+}
+
+static void timers_free(thr_pool_t *pool)
+{
+    if (pool->wheel == NULL) return;
+    thr_slab_destroy((thr_slab_t *) pool->timers);
+    free(pool->timers);
+    free(pool->wheel);
+    pool->timers = NULL;
+    pool->wheel = NULL;
+}
+
+static int timer_add(thr_pool_t *pool, unsigned long long delay_ns,
+                     unsigned long long period_ns,
+                     void *(*func)(void *), void *arg, thr_timer_t **timer)
+{
+    if (!pool || !func) return EINVAL;
+
+    pthread_mutex_lock(&pool->timer_mutex);
+    if (pool->timer_stop) {
+        pthread_mutex_unlock(&pool->timer_mutex);
+        return ECANCELED;
+    }
+    if (pool->wheel == NULL) {
+        int err = timers_start(pool);
+        if (err) {
+            pthread_mutex_unlock(&pool->timer_mutex);
+            return err;
+        }
+    }
+
+    thr_timer_t *t = (thr_timer_t *)
+                     thr_slab_alloc(pool->timers, NULL, NULL);
+    if (!t) {
+        pthread_mutex_unlock(&pool->timer_mutex);
+        return ENOMEM;
+    }
+    t->pool = pool;
+    t->func = func;
+    t->arg = arg;
+    t->period = (period_ns + THR_TIMER_TICK_NS - 1) / THR_TIMER_TICK_NS;
+    t->state = TIMER_ARMED;
+    t->refs = timer != NULL ? 2 : 1;
+
+    /* Round up: the job never runs early */
+    uint64_t due = now_ns() - pool->trace_origin + delay_ns;
+    t->node.expires = (due + THR_TIMER_TICK_NS - 1) / THR_TIMER_TICK_NS;
+    thr_wheel_add((thr_wheel_t *) pool->wheel, &t->node);
+    if (t->node.expires < pool->timer_wakeup)
+        pthread_cond_signal(&pool->timercv);
+    pthread_mutex_unlock(&pool->timer_mutex);
+
+    if (timer != NULL) *timer = t;
+    return 0;
+}
+
+int thr_pool_add_delayed(thr_pool_t *pool, unsigned long long delay_ns,
+                         void *(*func)(void *), void *arg,
+                         thr_timer_t **timer)
+{
+    return timer_add(pool, delay_ns, 0, func, arg, timer);
+}
+
+int thr_pool_add_periodic(thr_pool_t *pool, unsigned long long delay_ns,
+                          unsigned long long period_ns,
+                          void *(*func)(void *), void *arg,
+                          thr_timer_t **timer)
+{
+    if (period_ns == 0) return EINVAL;
+    return timer_add(pool, delay_ns, period_ns, func, arg, timer);
+}
+
+int thr_timer_cancel(thr_timer_t *timer)
+{
+    if (timer == NULL) return EINVAL;
+    thr_pool_t *pool = timer->pool;
+
+    pthread_mutex_lock(&pool->timer_mutex);
+    if (timer->state != TIMER_ARMED) {
+        pthread_mutex_unlock(&pool->timer_mutex);
+        return EALREADY;
+    }
+    timer->state = TIMER_CANCELLED;
+    thr_wheel_del((thr_wheel_t *) pool->wheel, &timer->node);
+    timer_unref(timer);
+    pthread_mutex_unlock(&pool->timer_mutex);
+    return 0;
+}
+
+void thr_timer_release(thr_timer_t *timer)
+{
+    if (timer == NULL) return;
+    timer_unref(timer);
+}
+
+/*
+ * Create the reactor of the pool.
+ * Only call this function when acquire lock
+ */
+static int reactor_start(thr_pool_t *pool)
+{
+    thr_reactor_t *reactor = (thr_reactor_t *) malloc(sizeof(thr_reactor_t));
+    if (reactor == NULL) return ENOMEM;
+
+    int err = thr_reactor_init(reactor);
+    if (err) {
+        free(reactor);
+        return err;
+    }
+    pool->reactor = (struct thr_reactor *) reactor;
+    return 0;
+}
+
+static void reactor_free(thr_pool_t *pool)
+{
+    if (pool->reactor == NULL) return;
+    thr_reactor_destroy((thr_reactor_t *) pool->reactor);
+    free(pool->reactor);
+    pool->reactor = NULL;
+}
+
+/*
+ * Wait for I/O readiness in place of parkcv, then queue the jobs of the
+ * ready registrations: the caller takes the first one, idle workers the
+ * others. Only call this function when acquire lock; it is released
+ * while polling.
+ */
+static void io_poll(thr_pool_t *pool, worker_t *self)
+{
+    thr_reactor_t *reactor = (thr_reactor_t *) pool->reactor;
+    void *ready[THR_REACTOR_EVENTS];
+
+    /* From now on, waking us up goes through the reactor, see idle_wake() */
+    pool->poller = self;
+    pthread_mutex_unlock(&pool->mutex);
+    int n = thr_reactor_poll(reactor, ready, THR_REACTOR_EVENTS, -1);
+    /* Before its job may run, and register the fd again */
+    for (int i = 0; i < n; i++)
+        thr_reactor_disarm(reactor, JOB_IO_FD((job_t *) ready[i]));
+    pthread_mutex_lock(&pool->mutex);
+    pool->poller = NULL;
+    if (n == 0) {
+        poller_handoff(pool, self);
+        return;
+    }
+
+    pool->io_waiting -= n;
+    if ((pool->status & THR_POOL_DESTROY) ||
+        queue_admit(pool, n, ADMIT_FORCE, NULL) != 0) {
+        /* The pool is going away, or discarding its jobs */
+        for (int i = 0; i < n; i++)
+            job_free(pool, (job_t *) ready[i]);
+        return;
+    }
+
+    stats_enqueued(pool, n);
+    for (int i = 0; i < n; i++) {
+        job_t *job = (job_t *) ready[i];
+        job->next = i + 1 < n ? (job_t *) ready[i + 1] : NULL;
+#ifndef THR_POOL_NO_STATS
+        /* Queue waits start now, not at the registration */
+        job->queued_at = now_ns();
+#endif
+        trace(pool, THR_TRACE_ENQUEUE, job);
+    }
+    /* Counted before anybody can pick them up, see job_done() */
+    __atomic_add_fetch(&pool->pending, n, __ATOMIC_RELAXED);
+    list_insert(pool, (job_t *) ready[0], (job_t *) ready[n - 1], n,
+                THR_PRIO_NORMAL);
+
+    if (self->parked) idle_remove(pool, self);
+    wake_locked(pool, n - 1);
+    poller_handoff(pool, self);
+}
+
+/*
+ * Leaving the idle workers, the poller wakes up one still parked to poll
+ * in its place, see worker_park(). Without any, the next one to park does.
+ */
+static void poller_handoff(thr_pool_t *pool, worker_t *self)
+{
+    if (self->parked || pool->io_waiting == 0 || pool->poller != NULL)
+        return;
+    if (pool->idle_stack != NULL)
+        pthread_cond_signal(&pool->idle_stack->parkcv);
+}
+
+int thr_pool_add_io(thr_pool_t *pool, int fd, int events,
+                    void *(*func)(void *), void *arg)
+{
+    if (!pool || !func || fd < 0) return EINVAL;
+    if (events == 0 || (events & ~(THR_IO_READ | THR_IO_WRITE)))
+        return EINVAL;
+
+    job_t *job = job_alloc(pool);
+    if (!job) return ENOMEM;
+    job_init(job, func, arg);
+    JOB_IO_FD(job) = fd;
+
+    int err = 0;
+    pthread_mutex_lock(&pool->mutex);
+    if (pool->status & (THR_POOL_DESTROY | THR_POOL_STOP))
+        err = ECANCELED;
+    else if (pool->reactor == NULL)
+        err = reactor_start(pool);
+    if (err == 0) {
+        int ev = (events & THR_IO_READ ? THR_REACTOR_READ : 0) |
+                 (events & THR_IO_WRITE ? THR_REACTOR_WRITE : 0);
+        err = thr_reactor_arm((thr_reactor_t *) pool->reactor, fd, ev, job);
+    }
+    if (err) {
+        pthread_mutex_unlock(&pool->mutex);
+        job_free(pool, job);
+        return err;
+    }
+
+    /* Any idle worker becomes the poller, or the next one to go idle */
+    pool->io_waiting++;
+    if (pool->poller == NULL)
+        wake_locked(pool, 1);
+    pthread_mutex_unlock(&pool->mutex);
+    return 0;
+}
+
+/*
+ * Start a scaling controller deciding every scale_interval_ms, with the
+ * hill climbing policy unless the options name another one.
+ */
+static int scaler_start(thr_pool_t *pool, const thr_pool_options_t *opts)
+{
+    struct thr_scaler *scaler = (struct thr_scaler *)
+                                malloc(sizeof(struct thr_scaler));
+    if (scaler == NULL) return ENOMEM;
+
+    thr_hill_init(&scaler->hill, opts->scale_wait_us * 1000ULL,
+                  opts->scale_shrink_after);
+    if (opts->scale_policy != NULL) {
+        scaler->policy = *opts->scale_policy;
+    } else {
+        scaler->policy.decide = thr_hill_decide;
+        scaler->policy.ctx = &scaler->hill;
+    }
+    scaler->interval = (opts->scale_interval_ms * 1000000ULL +
+                        THR_TIMER_TICK_NS - 1) / THR_TIMER_TICK_NS;
+    scaler->last = now_ns();
+    scaler->completed = 0;
+    memset(scaler->wait_hist, 0, sizeof(scaler->wait_hist));
+
+    pthread_mutex_lock(&pool->timer_mutex);
+    scaler->next = timer_now(pool) + scaler->interval;
+    pool->scaler = scaler;
+    pool->target = pool->min > 1 ? pool->min : 1;
+    int err = timers_start(pool);
+    if (err) {
+        pool->scaler = NULL;
+        free(scaler);
+    }
+    pthread_mutex_unlock(&pool->timer_mutex);
+    return err;
+}
+
+/*
+ * Sample the pool, let the policy pick the new target and create workers
+ * at once if jobs wait for them.
+ */
+static void scale_decide(thr_pool_t *pool)
+{
+    struct thr_scaler *scaler = pool->scaler;
+    thr_scale_sample_t sample;
+    unsigned long completed = 0;
+    unsigned long hist[THR_HIST_BUCKETS];
+
+    memset(hist, 0, sizeof(hist));
+    for (int i = 0; i < pool->max; i++) {
+        thr_counters_t *c = &pool->workers[i].stats;
+        completed += __atomic_load_n(&c->completed, __ATOMIC_RELAXED);
+        for (int b = 0; b < THR_HIST_BUCKETS; b++)
+            hist[b] += __atomic_load_n(&c->wait_hist[b], __ATOMIC_RELAXED);
+    }
+
+    /* The mean wait, taking the middle of every bucket */
+    unsigned long started = 0;
+    double waited = 0;
+    for (int b = 0; b < THR_HIST_BUCKETS; b++) {
+        unsigned long n = hist[b] - scaler->wait_hist[b];
+        started += n;
+        waited += n * (b == 0 ? 0.5 : 1.5 * (double) (1ULL << (b - 1)));
+    }
+
+    uint64_t now = now_ns();
+    sample.interval_ns = now - scaler->last;
+    sample.completed = completed - scaler->completed;
+    sample.wait_ns = started ? (unsigned long long) (waited / started) : 0;
+    sample.depth = __atomic_load_n(&pool->depth, __ATOMIC_RELAXED);
+    sample.nthreads = __atomic_load_n(&pool->nthreads, __ATOMIC_RELAXED);
+    sample.idle = __atomic_load_n(&pool->idle, __ATOMIC_RELAXED);
+    sample.target = __atomic_load_n(&pool->target, __ATOMIC_RELAXED);
+    sample.min = pool->min;
+    sample.max = pool->max;
+    scaler->last = now;
+    scaler->completed = completed;
+    memcpy(scaler->wait_hist, hist, sizeof(hist));
+
+    int target = scaler->policy.decide(scaler->policy.ctx, &sample);
+    if (target < pool->min) target = pool->min;
+    if (target < 1) target = 1;
+    if (target > pool->max) target = pool->max;
+
+    pthread_mutex_lock(&pool->mutex);
+    if (target > pool->target)
+        __atomic_store_n(&pool->scale_ups, pool->scale_ups + 1,
+                         __ATOMIC_RELAXED);
+    else if (target < pool->target)
+        __atomic_store_n(&pool->scale_downs, pool->scale_downs + 1,
+                         __ATOMIC_RELAXED);
+    __atomic_store_n(&pool->target, target, __ATOMIC_RELAXED);
+
+    if (sample.depth > 0 && pool->nthreads < target &&
+        !(pool->status & THR_POOL_DESTROY)) {
+        long n = target - pool->nthreads;
+        wake_locked(pool, (int) (sample.depth < n ? sample.depth : n));
+    }
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+/*
+ * A parallel loop. It is shared by the caller and the helper jobs, and
+ * freed by the last of them to leave, since helpers may start after the
+ * caller returned.
+ */
+typedef struct pfor {
+    long next THR_CACHE_ALIGNED;    /* first index not claimed yet */
+    long remaining THR_CACHE_ALIGNED;   /* indexes not performed yet */
+    int done;           /* remaining reached 0, futex word */
+    int waiting;        /* the caller sleeps on done */
+    int refs;           /* the caller and the helpers */
+    long end;
+    long grain;
+    int nparts;         /* the caller and the helpers */
+    void (*body)(long, long, void *);
+    void (*reduce_body)(long, long, void *, void *);
+    void *ctx;
+    char *parts;        /* nparts parts of stride bytes */
+} pfor_t;
+
+/*
+ * What one participant needs, padded to whole cache lines. The
+ * accumulator starts a line of its own, aligned for any type.
+ */
+typedef struct pfor_part {
+    pfor_t *loop;
+    /* partial accumulator of a reduction */
+    char acc[] __attribute__((aligned(THR_CACHE_LINE)));
+} pfor_part_t;
+
+static void pfor_unref(pfor_t *loop)
+{
+    if (__atomic_sub_fetch(&loop->refs, 1, __ATOMIC_ACQ_REL) == 0)
+        free(loop);
+}
+
+/*
+ * Claim chunks until the range is exhausted. Chunks are guided: a share
+ * of what is left for each participant, never less than the grain, so
+ * they shrink as the loop ends and the last ones balance the load.
+ */
+static void pfor_run(pfor_part_t *part)
+{
+    pfor_t *loop = part->loop;
+    long begin = __atomic_load_n(&loop->next, __ATOMIC_RELAXED);
+
+    while (begin < loop->end) {
+        long chunk = (loop->end - begin) / (2 * loop->nparts);
+        if (chunk < loop->grain) chunk = loop->grain;
+        long end = loop->end - begin > chunk ? begin + chunk : loop->end;
+        if (!__atomic_compare_exchange_n(&loop->next, &begin, end, 1,
+                                         __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            continue;
+
+        if (loop->reduce_body != NULL)
+            loop->reduce_body(begin, end, part->acc, loop->ctx);
+        else
+            loop->body(begin, end, loop->ctx);
+
+        if (__atomic_sub_fetch(&loop->remaining, end - begin,
+                               __ATOMIC_ACQ_REL) == 0) {
+            __atomic_store_n(&loop->done, 1, __ATOMIC_SEQ_CST);
+            if (__atomic_load_n(&loop->waiting, __ATOMIC_SEQ_CST))
+                thr_futex_wake(&loop->done, 1);
+        }
+        begin = __atomic_load_n(&loop->next, __ATOMIC_RELAXED);
+    }
+}
+
+/* The loop reference of a helper is released by job_free(), see pfor_over() */
+static void *pfor_helper(void *arg)
+{
+    pfor_run((pfor_part_t *) arg);
+    return NULL;
+}
+
+/* The helper job is over, whether it ran or was dropped */
+static void pfor_over(void *arg)
+{
+    pfor_unref(((pfor_part_t *) arg)->loop);
+}
+
+/*
+ * Split [begin, end) between the caller and up to max - 1 helper jobs,
+ * queued as a single batch. The caller takes part, then waits for the
+ * chunks still running and folds the partial accumulators into result.
+ */
+static int pfor(thr_pool_t *pool, long begin, long end, long grain,
+                void (*body)(long, long, void *),
+                void (*reduce_body)(long, long, void *, void *),
+                void (*combine)(void *, const void *, void *),
+                void *result, size_t size, void *ctx)
+{
+    if (grain < 1) grain = 1;
+    if (end - begin <= grain) {
+        if (reduce_body != NULL)
+            reduce_body(begin, end, result, ctx);
+        else
+            body(begin, end, ctx);
+        return 0;
+    }
+
+    long nchunks = (end - begin + grain - 1) / grain;
+    int nparts = nchunks < pool->max ? (int) nchunks : pool->max;
+    size_t head = (sizeof(pfor_t) + THR_CACHE_LINE - 1) &
+                  ~(size_t) (THR_CACHE_LINE - 1);
+    size_t stride = (offsetof(pfor_part_t, acc) + size + THR_CACHE_LINE - 1) &
+                    ~(size_t) (THR_CACHE_LINE - 1);
+
+    void *mem;
+    if (posix_memalign(&mem, THR_CACHE_LINE, head + nparts * stride))
+        return ENOMEM;
+
+    pfor_t *loop = (pfor_t *) mem;
+    loop->next = begin;
+    loop->remaining = end - begin;
+    loop->done = 0;
+    loop->waiting = 0;
+    loop->end = end;
+    loop->grain = grain;
+    loop->body = body;
+    loop->reduce_body = reduce_body;
+    loop->ctx = ctx;
+    loop->parts = (char *) mem + head;
+    for (int i = 0; i < nparts; i++) {
+        pfor_part_t *part = (pfor_part_t *) (loop->parts + i * stride);
+        part->loop = loop;
+        if (size > 0) memcpy(part->acc, result, size);
+    }
+
+    /*
+     * Without job nodes for the helpers, or once the pool is shut down,
+     * the caller does it all. The caller makes progress on its own, so
+     * helpers are never held by a bounded queue.
+     */
+    job_t *chain = nparts > 1 ? job_alloc_chain(pool, nparts - 1) : NULL;
+    if (chain != NULL && queue_admit(pool, nparts - 1, ADMIT_FORCE, NULL)) {
+        for (job_t *next; chain != NULL; chain = next) {
+            next = chain->next;
+            job_init(chain, pfor_helper, NULL);
+            job_free(pool, chain);
+        }
+    }
+    if (chain == NULL) nparts = 1;
+    loop->nparts = nparts;
+    loop->refs = nparts;
+
+    job_t *job = chain;
+    for (int i = 1; i < nparts; i++, job = job->next) {
+        job_init(job, pfor_helper, loop->parts + i * stride);
+        job->flags = THR_JOB_PFOR;
+    }
+    if (chain != NULL)
+        batch_add(pool, chain, nparts - 1);
+
+    pfor_part_t *own = (pfor_part_t *) loop->parts;
+    pfor_run(own);
+
+    __atomic_store_n(&loop->waiting, 1, __ATOMIC_SEQ_CST);
+    while (!__atomic_load_n(&loop->done, __ATOMIC_SEQ_CST))
+        wait_help(&loop->done, 0, NULL);
+
+    if (size > 0) {
+        memcpy(result, own->acc, size);
+        for (int i = 1; i < nparts; i++) {
+            pfor_part_t *part = (pfor_part_t *) (loop->parts + i * stride);
+            combine(result, part->acc, ctx);
+        }
+    }
+    pfor_unref(loop);
+    return 0;
+}
+
+int thr_pool_parallel_for(thr_pool_t *pool, long begin, long end, long grain,
+                          void (*body)(long, long, void *), void *ctx)
+{
+    if (!pool || !body || end < begin) return EINVAL;
+    if (begin == end) return 0;
+    return pfor(pool, begin, end, grain, body, NULL, NULL, NULL, 0, ctx);
+}
+
+int thr_pool_parallel_reduce(thr_pool_t *pool, long begin, long end,
+                             long grain,
+                             void (*body)(long, long, void *, void *),
+                             void (*combine)(void *, const void *, void *),
+                             void *result, size_t size, void *ctx)
+{
+    if (!pool || !body || !combine || !result || !size || end < begin)
+        return EINVAL;
+    if (begin == end) return 0;
+    return pfor(pool, begin, end, grain, NULL, body, combine,
+                result, size, ctx);
+}
+
+int thr_worker_index(void)
+{
+    return current_worker != NULL ? current_worker->index : -1;
+}
+
+int thr_worker_node(void)
+{
+    return current_worker != NULL ? current_worker->node : -1;
+}
+
+void thr_pool_idle_stats(thr_pool_t *pool, thr_idle_stats_t *stats)
+{
+    if (pool == NULL || stats == NULL) return;
+
+    stats->spin = stats->yield = stats->park = 0;
+    for (int i = 0; i < pool->max; i++) {
+        worker_t *w = &pool->workers[i];
+        stats->spin += __atomic_load_n(&w->handoffs[THR_IDLE_SPIN],
+                                       __ATOMIC_RELAXED);
+        stats->yield += __atomic_load_n(&w->handoffs[THR_IDLE_YIELD],
+                                        __ATOMIC_RELAXED);
+        stats->park += __atomic_load_n(&w->handoffs[THR_IDLE_PARK],
+                                       __ATOMIC_RELAXED);
+    }
+}
+
+#ifndef THR_POOL_NO_STATS
+/*
+ * Counters of the calling thread: its own if it is a worker of the pool,
+ * else those shared by the threads outside of the pool.
+ */
+static thr_counters_t *stats_counters(thr_pool_t *pool, int *shared)
+{
+    worker_t *self = current_worker;
+    *shared = self == NULL || self->pool != pool;
+    return *shared ? &pool->ext_stats : &self->stats;
+}
+
+/* Only the owner of the counter writes it, unless it is shared */
+static void stats_add(unsigned long *counter, unsigned long n, int shared)
+{
+    if (shared)
+        __atomic_add_fetch(counter, n, __ATOMIC_RELAXED);
+    else
+        __atomic_store_n(counter, *counter + n, __ATOMIC_RELAXED);
+}
+
+/* Bucket b > 0 counts the values in [2^(b-1), 2^b) */
+static int stats_bucket(uint64_t ns)
+{
+    int b = ns == 0 ? 0 : 64 - __builtin_clzll(ns);
+    return b < THR_HIST_BUCKETS ? b : THR_HIST_BUCKETS - 1;
+}
+
+static void stats_enqueued(thr_pool_t *pool, int n)
+{
+    int shared;
+    thr_counters_t *c = stats_counters(pool, &shared);
+    stats_add(&c->enqueued, n, shared);
+
+    long depth = __atomic_add_fetch(&pool->depth, n, __ATOMIC_RELAXED);
+    long peak = __atomic_load_n(&pool->peak_depth, __ATOMIC_RELAXED);
+    while (depth > peak &&
+           !__atomic_compare_exchange_n(&pool->peak_depth, &peak, depth, 1,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+static void stats_started(worker_t *self, job_t *job)
+{
+    uint64_t now = now_ns();
+    __atomic_sub_fetch(&self->pool->depth, 1, __ATOMIC_RELAXED);
+    stats_add(&self->stats.wait_hist[stats_bucket(now - job->queued_at)],
+              1, 0);
+    self->job_start = now;
+}
+
+static void stats_finished(worker_t *self)
+{
+    uint64_t run = now_ns() - self->job_start;
+    self->job_start = 0;
+    stats_add(&self->stats.completed, 1, 0);
+    stats_add(&self->stats.run_hist[stats_bucket(run)], 1, 0);
+}
+
+/* A job was cancelled, or dropped while still counted in the queue */
+static void stats_failed(thr_pool_t *pool, int dequeued)
+{
+    int shared;
+    thr_counters_t *c = stats_counters(pool, &shared);
+    stats_add(&c->failed, 1, shared);
+    if (!dequeued)
+        __atomic_sub_fetch(&pool->depth, 1, __ATOMIC_RELAXED);
+}
+
+static void stats_sum(thr_pool_stats_t *stats, const thr_counters_t *c)
+{
+    stats->enqueued += __atomic_load_n(&c->enqueued, __ATOMIC_RELAXED);
+    stats->completed += __atomic_load_n(&c->completed, __ATOMIC_RELAXED);
+    stats->failed += __atomic_load_n(&c->failed, __ATOMIC_RELAXED);
+    for (int b = 0; b < THR_HIST_BUCKETS; b++) {
+        stats->wait_hist[b] += __atomic_load_n(&c->wait_hist[b],
+                                               __ATOMIC_RELAXED);
+        stats->run_hist[b] += __atomic_load_n(&c->run_hist[b],
+                                              __ATOMIC_RELAXED);
+    }
+}
+#else
+static void stats_enqueued(thr_pool_t *pool, int n) { }
+static void stats_started(worker_t *self, job_t *job) { }
+static void stats_finished(worker_t *self) { }
+static void stats_failed(thr_pool_t *pool, int dequeued) { }
+#endif  /* THR_POOL_NO_STATS */
+
+int thr_pool_stats(thr_pool_t *pool, thr_pool_stats_t *stats)
+{
+    if (pool == NULL || stats == NULL) return EINVAL;
+
+    memset(stats, 0, sizeof(*stats));
+    stats->nthreads = __atomic_load_n(&pool->nthreads, __ATOMIC_RELAXED);
+    stats->idle = __atomic_load_n(&pool->idle, __ATOMIC_RELAXED);
+    stats->spawned = __atomic_load_n(&pool->spawned, __ATOMIC_RELAXED);
+    stats->retired = __atomic_load_n(&pool->retired, __ATOMIC_RELAXED);
+    stats->target = __atomic_load_n(&pool->target, __ATOMIC_RELAXED);
+    stats->scale_ups = __atomic_load_n(&pool->scale_ups, __ATOMIC_RELAXED);
+    stats->scale_downs = __atomic_load_n(&pool->scale_downs,
+                                         __ATOMIC_RELAXED);
+    stats->throttled = __atomic_load_n(&pool->throttled, __ATOMIC_RELAXED);
+    thr_pool_idle_stats(pool, &stats->handoffs);
+#ifdef THR_POOL_NO_STATS
+    return ENOTSUP;
+#else
+    stats->depth = __atomic_load_n(&pool->depth, __ATOMIC_RELAXED);
+    stats->peak_depth = __atomic_load_n(&pool->peak_depth, __ATOMIC_RELAXED);
+    stats_sum(stats, &pool->ext_stats);
+    for (int i = 0; i < pool->max; i++)
+        stats_sum(stats, &pool->workers[i].stats);
+    return 0;
+#endif
+}
+
+static inline int tracing(thr_pool_t *pool)
+{
+#ifndef THR_POOL_NO_TRACE
+    return THR_UNLIKELY(__atomic_load_n(&pool->tracing, __ATOMIC_RELAXED));
+#else
+    return 0;
+#endif
+}
+
+/*
+ * Record an event into the ring of the calling worker, or into the ring
+ * shared by the other threads. A single well predicted branch when
+ * tracing is disabled.
+ */
+static inline void trace(thr_pool_t *pool, int type, void *arg)
+{
+    if (!tracing(pool)) return;
+
+    thr_trace_t *traces = (thr_trace_t *) pool->traces;
+    worker_t *self = current_worker;
+    if (self != NULL && self->pool == pool)
+        thr_trace_push(&traces[self->index], 0, type, arg, now_ns());
+    else
+        thr_trace_push(&traces[pool->max], 1, type, arg, now_ns());
+}
+
+int thr_pool_trace_enable(thr_pool_t *pool, int enable)
+{
+    if (pool == NULL || pool->traces == NULL) return EINVAL;
+#ifdef THR_POOL_NO_TRACE
+    return ENOTSUP;
+#endif
+    __atomic_store_n(&pool->tracing, enable != 0, __ATOMIC_RELAXED);
+    return 0;
+}
+
+int thr_pool_trace_dump(thr_pool_t *pool, FILE *out)
+{
+    if (pool == NULL || out == NULL || pool->traces == NULL) return EINVAL;
+
+    char (*names)[24] = malloc((pool->max + 1) * sizeof(*names));
+    const char **pnames = malloc((pool->max + 1) * sizeof(char *));
+    if (names == NULL || pnames == NULL) {
+        free(names);
+        free(pnames);
+        return ENOMEM;
+    }
+    for (int i = 0; i < pool->max; i++) {
+        snprintf(names[i], sizeof(names[i]), "worker %d", i);
+        pnames[i] = names[i];
+    }
+    pnames[pool->max] = "other threads";
+
+    int err = thr_trace_write((thr_trace_t *) pool->traces, pool->max + 1,
+                              pnames, pool->trace_origin, out);
+    free(names);
+    free(pnames);
+    return err;
+}
+
+/*
+ * Drop all the queued jobs, as if cancelled before they started.
+ * Only call this function when acquire lock
+ */
+static void jobs_drop(thr_pool_t *pool)
+{
+    job_t *cur_job;
+    long dropped = 0;
+    if (pool->ring != NULL) {
+        while ((cur_job = thr_ring_pop(pool->ring)) != NULL) {
+            stats_failed(pool, 0);
+            job_free(pool, cur_job);
+            dropped++;
+        }
+    }
+    for (int i = 0; i < pool->max; i++) {
+        if (pool->workers[i].deque == NULL) break;
+        while ((cur_job = thr_deque_steal(pool->workers[i].deque)) != NULL) {
+            stats_failed(pool, 0);
+            job_free(pool, cur_job);
+            dropped++;
+        }
+    }
+    while ((cur_job = list_pop(pool)) != NULL) {
+        stats_failed(pool, 0);
+        job_free(pool, cur_job);
+        dropped++;
+    }
+    if (pool->max_queued > 0)
+        __atomic_sub_fetch(&pool->queued, dropped, __ATOMIC_SEQ_CST);
+    if (dropped > 0) job_done(pool, dropped);
+}
+
+int thr_pool_shutdown(thr_pool_t *pool, int how,
+                      const struct timespec *deadline)
+{
+    if (pool == NULL) return EINVAL;
+    if (how != THR_SHUTDOWN_DRAIN && how != THR_SHUTDOWN_DISCARD)
+        return EINVAL;
+    /* The worker would wait for itself to exit */
+    if (current_worker != NULL && current_worker->pool == pool)
+        return EDEADLK;
+
+    /* Pending timers never fire, the scaler stops deciding */
+    timers_stop(pool);
+
+    pthread_mutex_lock(&pool->mutex);
+    __atomic_fetch_or(&pool->status, THR_POOL_STOP |
+                      (how == THR_SHUTDOWN_DISCARD ? THR_POOL_DISCARD : 0),
+                      __ATOMIC_SEQ_CST);
+    if (how == THR_SHUTDOWN_DISCARD) jobs_drop(pool);
+
+    /* Producers waiting for room give up */
+    pthread_cond_broadcast(&pool->notfullcv);
+
+    /* Idle workers exit, the others once the queues are empty */
+    while (pool->idle_stack != NULL) {
+        worker_t *w = pool->idle_stack;
+        idle_remove(pool, w);
+        idle_wake(pool, w);
+    }
+
+    int err = 0;
+    while ((pool->nthreads > 0 || pool->add_waiters > 0) && err == 0) {
+        if (deadline == NULL)
+            pthread_cond_wait(&pool->busycv, &pool->mutex);
+        else
+            err = pthread_cond_timedwait(&pool->busycv, &pool->mutex,
+                                         deadline);
+    }
+    err = pool->nthreads > 0 || pool->add_waiters > 0 ? ETIMEDOUT : 0;
+    pthread_mutex_unlock(&pool->mutex);
+    return err;
+}
+
+int thr_pool_wait(thr_pool_t *pool)
+{
+    if (pool == NULL) return EINVAL;
+
+    /*
+     * A job of the pool does not wait for itself, nor for the other jobs
+     * waiting here, which wait for it as well
+     */
+    worker_t *self = current_worker;
+    int nested = self != NULL && self->pool == pool && self->job != NULL;
+
+    __atomic_add_fetch(&pool->wait_waiters, 1, __ATOMIC_SEQ_CST);
+    if (nested) {
+        __atomic_add_fetch(&pool->wait_nested, 1, __ATOMIC_SEQ_CST);
+        /* This may be all the other nested waiters were waiting for */
+        __atomic_add_fetch(&pool->wait_seq, 1, __ATOMIC_SEQ_CST);
+        thr_futex_wake(&pool->wait_seq, INT_MAX);
+    }
+    for (;;) {
+        /* Read the sequence first: a later wake up changes it */
+        int seq = __atomic_load_n(&pool->wait_seq, __ATOMIC_SEQ_CST);
+        long pending = __atomic_load_n(&pool->pending, __ATOMIC_SEQ_CST);
+        if (pending == 0 || (nested && pending <=
+            __atomic_load_n(&pool->wait_nested, __ATOMIC_SEQ_CST)))
+            break;
+        wait_help(&pool->wait_seq, seq, NULL);
+    }
+    if (nested)
+        __atomic_sub_fetch(&pool->wait_nested, 1, __ATOMIC_SEQ_CST);
+    __atomic_sub_fetch(&pool->wait_waiters, 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+void thr_pool_destroy(thr_pool_t *pool) {
+    if (pool == NULL) return;
+
+    /* Pending timers never fire, the scaler stops deciding */
+    timers_stop(pool);
+
+    pthread_mutex_lock(&pool->mutex);
+    pthread_cleanup_push(pthread_mutex_unlock, &pool->mutex);
+    __atomic_fetch_or(&pool->status, THR_POOL_DESTROY, __ATOMIC_SEQ_CST);
+
+    /* No new worker, the slots claimed already are given back */
+    pool->spawn_stop = 1;
+    pthread_cond_signal(&pool->spawncv);
+
+    /* Cancel all active thread, unless they return on their own */
+    for (int i = 0; i < pool->max && !pool->cooperative; i++) {
+        worker_t *slot = &pool->workers[i];
+        if (slot->live && __atomic_load_n(&slot->busy, __ATOMIC_SEQ_CST)) {
+            pthread_cancel(slot->thread);
+            DEBUG("CANCELED THREAD #%u", (unsigned int) slot->thread);
+        }
+    }
+
+    /* Destroy the job queue */
+    jobs_drop(pool);
+
+    /* Producers waiting for room give up */
+    pthread_cond_broadcast(&pool->notfullcv);
+
+    /* wake up all idle thread */
+    DEBUG("wake up the idle workers");
+    while (pool->idle_stack != NULL) {
+        worker_t *w = pool->idle_stack;
+        idle_remove(pool, w);
+        idle_wake(pool, w);
+    }
+
+    /* Wait for the last worker thread cleanup done, and the producers */
+    while (pool->nthreads > 0 || pool->add_waiters > 0) {
+        pthread_cond_wait(&pool->busycv, &pool->mutex);
+    }
+    pthread_cleanup_pop(1);
+    pthread_join(pool->spawner, NULL);
+
+    if (pool->ring != NULL) {
+        thr_ring_destroy((thr_ring_t *) pool->ring);
+        free(pool->ring);
+        pool->ring = NULL;
+    }
+    if (pool->topo != NULL) {
+        thr_topo_destroy((thr_topo_t *) pool->topo);
+        free(pool->topo);
+        pool->topo = NULL;
+    }
+    free_traces(pool);
+    timers_free(pool);
+    reactor_free(pool);
+    free(pool->scaler);
+    pool->scaler = NULL;
+    free_workers(pool);
+    pool_unregister(pool);
+    free_jobs(pool);
 
     pthread_attr_destroy(&pool->attr);
-    pthread_cond_destroy(&pool->jobcv);
-    pthread_cond_destroy(&pool->waitcv);
+    pthread_cond_destroy(&pool->notfullcv);
+    pthread_cond_destroy(&pool->spawncv);
+    pthread_cond_destroy(&pool->timercv);
+    pthread_mutex_destroy(&pool->timer_mutex);
 }
@@ -2,39 +2,383 @@
 #define _THRPOOL_H
 
 #include <pthread.h>
+#include <stddef.h>
+#include <stdio.h>
 
 #define THR_POOL_NEW 0
-#define THR_POOL_WAIT (1<<0)
+#define THR_POOL_WAIT (1<<0)    /* no longer set, see wait_waiters */
 #define THR_POOL_DESTROY (1<<1)
+#define THR_POOL_STOP (1<<2)    /* thr_pool_shutdown() was called */
+#define THR_POOL_DISCARD (1<<3) /* it dropped the queued jobs */
+
+/* What thr_pool_shutdown() does with the queued jobs */
+#define THR_SHUTDOWN_DRAIN 0    /* perform them all */
+#define THR_SHUTDOWN_DISCARD 1  /* drop them */
+
+/* Queue modes, see thr_pool_options_t */
+#define THR_QUEUE_LIST 0    /* mutex protected linked list */
+#define THR_QUEUE_RING 1    /* lock-free bounded MPMC ring buffer */
+
+#define THR_CACHE_LINE 64
+
+/* Phases of an idle worker, see thr_pool_options_t */
+#define THR_IDLE_SPIN 0     /* busy-waiting with a pause instruction */
+#define THR_IDLE_YIELD 1    /* giving up the CPU with sched_yield() */
+#define THR_IDLE_PARK 2     /* sleeping on its condition variable */
+#define THR_IDLE_PHASES 3
+
+/* Placement policies of the worker threads, see thr_pool_options_t */
+#define THR_PLACE_NONE 0    /* the affinity of attr, if any */
+#define THR_PLACE_COMPACT 1 /* one CPU each, filling a core before the next */
+#define THR_PLACE_SCATTER 2 /* one CPU each, spread over nodes and cores */
+#define THR_PLACE_CORE 3    /* one core each, with its hardware threads */
+#define THR_PLACE_NODE 4    /* all the CPUs of one NUMA node each */
+
+/* Priority levels, see thr_pool_add_prio() */
+#define THR_PRIO_HIGH 0
+#define THR_PRIO_NORMAL 1       /* jobs added by thr_pool_add() */
+#define THR_PRIO_LOW 2
+#define THR_PRIO_BACKGROUND 3
+#define THR_PRIO_LEVELS 4
+
+/* Buckets of the latency histograms, see thr_pool_stats() */
+#define THR_HIST_BUCKETS 48
+
+/* Resolution of the timers, see thr_pool_add_delayed() */
+#define THR_TIMER_TICK_NS 1000000ULL
+
+/* Flags of a job node */
+#define THR_JOB_FUTURE (1<<0)   /* the node is the job of a thr_future_t */
+#define THR_JOB_BUFFER (1<<1)   /* arg is a buffer of pool->buffers */
+#define THR_JOB_HEAP (1<<2)     /* arg was allocated with malloc() */
+#define THR_JOB_TASK (1<<3)     /* arg is a task of a thr_graph_t */
+#define THR_JOB_STRAND (1<<4)   /* the node runs the jobs of a strand */
+#define THR_JOB_PFOR (1<<5)     /* arg is a helper of a parallel loop */
+
+/* Argument bytes stored in the job node, see thr_pool_add_inline() */
+#define THR_JOB_INLINE 80
+/* Size of the pooled buffers holding larger arguments */
+#define THR_JOB_BUFFER_SIZE 1024
+
+/* Jobs of a strand a worker runs in a row, see thr_pool_add_strand() */
+#define THR_STRAND_BATCH 64
+
+/* Readiness a job waits for, see thr_pool_add_io() */
+#define THR_IO_READ (1<<0)
+#define THR_IO_WRITE (1<<1)
+
+/* States of a future, see thr_pool_submit() */
+#define THR_FUTURE_PENDING 0    /* the job has not returned yet */
+#define THR_FUTURE_READY 1      /* the result of the job is available */
+#define THR_FUTURE_CANCELLED 2  /* the job was dropped or cancelled */
 
 typedef struct job {
-    struct job *next;
+    struct job *next;       /* must stay first, see thrpool_slab.h */
     void *(*func)(void *);
     void *arg;
+    int flags;              /* THR_JOB_* */
+    int prio;               /* THR_PRIO_* */
+    struct thr_group *group;/* the group of the job, or NULL */
+    unsigned long long queued_at;   /* CLOCK_MONOTONIC nanoseconds */
+    unsigned char data[THR_JOB_INLINE] __attribute__((aligned(16)));
+                            /* argument of thr_pool_add_inline(), or the fd
+                               of thr_pool_add_io(); the node spans two cache
+                               lines */
 } job_t;
 
+/*
+ * A set of jobs that can be waited for independently of the rest of the
+ * pool, see thr_pool_add_group().
+ */
+typedef struct thr_group {
+    int outstanding;        /* jobs not over yet, futex word */
+} thr_group_t;
+
+/*
+ * Jobs run one at a time in the order they were added, see
+ * thr_pool_add_strand(). Producers only touch the first cache line,
+ * the worker running the strand the second one.
+ */
+typedef struct thr_strand {
+    struct job *head;       /* jobs added, most recent first */
+    long count;             /* jobs added and not over yet */
+    struct job *batch __attribute__((aligned(THR_CACHE_LINE)));
+                            /* jobs taken off head, oldest first */
+    struct job *current;    /* the job running */
+    long over;              /* jobs over, still in count */
+} thr_strand_t;
+
+struct thr_pool;
+
+/*
+ * The result of a job, see thr_pool_submit(). The future and the job node
+ * are a single allocation, freed once both the job is over and the caller
+ * released the future.
+ */
+typedef struct thr_future {
+    job_t job;              /* must stay first */
+    struct thr_pool *pool;  /* the pool owning the memory */
+    void *result;           /* the value returned by the job */
+    int state;              /* THR_FUTURE_*, futex word */
+    int refs;               /* the job and the caller */
+    struct thr_future *then;/* continuations, see thr_future_then() */
+} thr_future_t;
+
+/* A delayed or periodic job, see thr_pool_add_delayed() */
+typedef struct thr_timer thr_timer_t;
+
+/* A graph of jobs and their dependencies, see thr_graph_create() */
+typedef struct thr_graph thr_graph_t;
+typedef struct thr_task thr_task_t;
+
+/* One job of a batch, see thr_pool_add_batch() */
+typedef struct thr_job_desc {
+    void *(*func)(void *);
+    void *arg;
+} thr_job_desc_t;
+
+/*
+ * Statistics of the jobs handled by one thread. Only that thread writes
+ * them, with relaxed atomics, unless they are shared by the threads
+ * outside of the pool.
+ */
+typedef struct thr_counters {
+    unsigned long enqueued;     /* jobs added */
+    unsigned long completed;    /* jobs that returned */
+    unsigned long failed;       /* jobs cancelled, or dropped */
+    unsigned long wait_hist[THR_HIST_BUCKETS];  /* queue wait */
+    unsigned long run_hist[THR_HIST_BUCKETS];   /* run time */
+} thr_counters_t;
+
+/*
+ * What a scaling policy sees at each decision, see thr_pool_options_t.
+ * Counts cover the interval since the previous decision.
+ */
+typedef struct thr_scale_sample {
+    unsigned long long interval_ns; /* since the previous decision */
+    unsigned long completed;    /* jobs that returned */
+    unsigned long long wait_ns; /* mean queue wait of the jobs started */
+    long depth;                 /* jobs queued, not started yet */
+    int nthreads;               /* current worker threads */
+    int idle;                   /* idle worker threads */
+    int target;                 /* workers the pool may grow to */
+    int min;                    /* see thr_pool_create() */
+    int max;                    /* see thr_pool_create() */
+} thr_scale_sample_t;
+
+/*
+ * A scaling policy: decide() returns the new target number of workers,
+ * which the pool clamps to [min, max]. The pool creates workers on demand
+ * up to the target, and idle workers above the target exit after the idle
+ * timeout.
+ */
+typedef struct thr_scale_policy {
+    int (*decide)(void *ctx, const thr_scale_sample_t *sample);
+    void *ctx;
+} thr_scale_policy_t;
+
+struct thr_ring;
+struct thr_deque;
+struct thr_slab;
+struct thr_topo;
+struct thr_trace;
+struct thr_wheel;
+struct thr_scaler;
+struct thr_reactor;
+
 typedef struct worker {
-    struct worker *next;
     pthread_t thread;
-} worker_t;
+    struct thr_pool *pool;  /* the pool owning this slot */
+    job_t *job;             /* the job being performed */
+    struct thr_deque *deque;/* jobs submitted by this worker */
+    unsigned int seed;      /* state of the victim picker */
+    void *job_cache;        /* free job nodes owned by this worker */
+    int job_ncache;         /* number of nodes in job_cache */
+    int index;              /* position in pool->workers */
+    int node;               /* NUMA node the worker is placed on, or -1 */
+    int live;               /* a thread occupies this slot, or is being
+                               created for it */
+    int busy;               /* the thread is performing a job */
+    struct worker *idle_prev;   /* links in pool->idle_stack */
+    struct worker *idle_next;
+    int parked;             /* linked in pool->idle_stack */
+    struct worker *spawn_next;  /* link in pool->spawn_list */
+    pthread_cond_t parkcv;  /* signal wake up this idle worker */
+    int spin_budget;        /* spins before yielding */
+    unsigned long spin_cost;/* nanoseconds taken by 16 spins */
+    unsigned long avg_gap;  /* average nanoseconds waited for a job */
+    unsigned long handoffs[THR_IDLE_PHASES]; /* jobs got in each phase */
+    unsigned long long job_start;   /* when the job started, 0 if none */
+    thr_counters_t stats;   /* jobs handled by this worker */
+} __attribute__((aligned(THR_CACHE_LINE))) worker_t;
 
 typedef struct thr_pool {
     pthread_mutex_t mutex;  /* protects the pool data */
-    pthread_cond_t jobcv;   /* signal wake up idle threads to do added jobs */
-    pthread_cond_t waitcv;  /* Wait for all queued jobs to complete */
     pthread_cond_t busycv;  /* Wait for the last thread clean up */
-    worker_t *worker;       /* list of threads performing work */
+    worker_t *workers;      /* one slot for each possible worker thread */
+    worker_t *idle_stack;   /* idle workers, the most recently parked first */
     job_t *job_head;        /* head of FIFO job queue */
     job_t *job_tail;        /* tail of FIFO job queue */
-    pthread_attr_t attr;    /* attributes of the worker threads */
+    job_t *prio_tail[THR_PRIO_LEVELS];  /* last job of each priority level
+                                           in the job queue */
+    int urgent;             /* queued jobs above THR_PRIO_NORMAL */
+    int prio_aging;         /* see thr_pool_options_t */
+    int prio_served;        /* jobs taken while lower priorities wait */
+    struct thr_ring *ring;  /* lock-free job queue, THR_QUEUE_RING only */
+    struct thr_slab *jobs;  /* allocator of the job nodes */
+    unsigned long serial;   /* tells the pool from an earlier one at the
+                               same address, see job_cache() */
+    struct thr_pool *live_prev; /* links in the list of live pools */
+    struct thr_pool *live_next;
+    struct thr_slab *futures;   /* allocator of the futures */
+    struct thr_slab *buffers;   /* allocator of the arguments too large
+                                   for a job node */
+    struct thr_topo *topo;  /* CPU topology, unless THR_PLACE_NONE */
+    int placement;          /* THR_PLACE_* */
+    struct thr_trace *traces;   /* event rings, one for each worker slot
+                                   and one for the other threads */
+    int tracing;            /* record events into traces */
+    unsigned long long trace_origin;    /* time of the pool creation, and
+                                           tick 0 of the timers */
+    struct thr_wheel *wheel;    /* pending timers, NULL until the first */
+    struct thr_slab *timers;    /* allocator of the timers */
+    pthread_mutex_t timer_mutex;    /* protects wheel and the timers */
+    pthread_cond_t timercv;     /* wake up the timer thread, which sleeps
+                                   against CLOCK_MONOTONIC */
+    pthread_t timer_thread;     /* moves due timers to the job queue */
+    int timer_stop;             /* the timer thread must exit */
+    unsigned long long timer_wakeup;    /* tick the timer thread sleeps
+                                           until */
+    struct thr_reactor *reactor;    /* I/O readiness, NULL until the first
+                                       registration */
+    int io_waiting;         /* registrations whose job is not queued yet */
+    worker_t *poller;       /* the idle worker polling the reactor */
+    pthread_attr_t attr;    /* attributes of the worker threads, only
+                               used by the spawner */
+    worker_t *spawn_list;   /* claimed slots waiting for their thread */
+    int spawning;           /* claimed slots whose thread is not created
+                               yet, those of spawn_list included */
+    int spawn_stop;         /* the spawner must exit */
+    pthread_cond_t spawncv; /* wake up the spawner */
+    pthread_t spawner;      /* creates the worker threads off the lock */
+    thr_counters_t ext_stats __attribute__((aligned(THR_CACHE_LINE)));
+                            /* jobs handled by other threads */
+    long pending __attribute__((aligned(THR_CACHE_LINE)));
+                            /* jobs queued or running */
+    int wait_waiters;       /* threads blocked in thr_pool_wait() */
+    int wait_nested;        /* jobs of the pool among them */
+    int wait_seq;           /* futex word of thr_pool_wait(), bumped when
+                               pending drops to wait_nested with waiters */
+    long depth __attribute__((aligned(THR_CACHE_LINE)));
+                            /* jobs queued, not started yet */
+    long peak_depth;        /* maximum of depth */
+    long queued __attribute__((aligned(THR_CACHE_LINE)));
+                            /* jobs admitted, not started yet */
+    long max_queued;        /* see thr_pool_options_t */
+    int add_waiters;        /* producers waiting for room */
+    pthread_cond_t notfullcv;   /* Wait for room in a bounded queue */
+    unsigned long spawned;  /* worker threads created */
+    unsigned long retired;  /* worker threads exited after idling */
+    struct thr_scaler *scaler;  /* the scaling controller, or NULL */
+    int target;     /* workers the pool may grow to, max without scaler */
+    unsigned long scale_ups;    /* decisions raising the target */
+    unsigned long scale_downs;  /* decisions lowering the target */
+    unsigned long throttled;    /* workers not created for lack of target */
+    long timeout_ms;    /* milliseconds before idle workers exit */
     int status;
-    int timeout;    /* seconds before idle workers exit */
+    int timeout;    /* seconds before idle workers exit, see timeout_ms */
     int min;        /* minimum number of worker threads */
     int max;        /* maximum number of worker threads */
-    int nthreads;   /* current number of worker threads */
+    int nthreads;   /* current number of worker threads, including those
+                       being created */
     int idle;       /* number of idle workers */
+    int spinning;   /* number of workers spinning or yielding */
+    int spin_count; /* maximum spin budget of a worker */
+    int yield_count;    /* sched_yield() calls before parking */
+    int adaptive_spin;  /* tune the spin budget of every worker */
+    int cooperative;    /* never cancel the workers, see thr_pool_options_t */
 } thr_pool_t;
 
+/* How idle workers got their jobs, see thr_pool_idle_stats() */
+typedef struct thr_idle_stats {
+    unsigned long spin;     /* while spinning */
+    unsigned long yield;    /* while yielding */
+    unsigned long park;     /* after being parked */
+} thr_idle_stats_t;
+
+/*
+ * A snapshot of the statistics of a pool, see thr_pool_stats().
+ * Bucket b > 0 of a histogram counts the durations of [2^(b-1), 2^b)
+ * nanoseconds, bucket 0 those under a nanosecond, and the last bucket
+ * all the longer ones.
+ */
+typedef struct thr_pool_stats {
+    unsigned long enqueued;     /* jobs added */
+    unsigned long completed;    /* jobs that returned */
+    unsigned long failed;       /* jobs cancelled, or dropped */
+    long depth;                 /* jobs queued, not started yet */
+    long peak_depth;            /* maximum of depth */
+    int nthreads;               /* current worker threads */
+    int idle;                   /* idle worker threads */
+    unsigned long spawned;      /* worker threads created */
+    unsigned long retired;      /* worker threads exited after idling */
+    int target;                 /* workers the pool may grow to */
+    unsigned long scale_ups;    /* decisions raising the target */
+    unsigned long scale_downs;  /* decisions lowering the target */
+    unsigned long throttled;    /* workers not created for lack of target */
+    thr_idle_stats_t handoffs;  /* see thr_pool_idle_stats() */
+    unsigned long wait_hist[THR_HIST_BUCKETS];  /* time spent queued */
+    unsigned long run_hist[THR_HIST_BUCKETS];   /* time spent running */
+} thr_pool_stats_t;
+
+/*
+ * Options of thr_pool_create_ex(). Always initialize them with
+ * thr_pool_options_init() so that new fields get sensible defaults.
+ */
+typedef struct thr_pool_options {
+    int min_threads;        /* see thr_pool_create() */
+    int max_threads;        /* see thr_pool_create() */
+    int timeout;            /* see thr_pool_create() */
+    const pthread_attr_t *attr; /* see thr_pool_create() */
+    int queue_mode;         /* THR_QUEUE_LIST (default) or THR_QUEUE_RING */
+    size_t queue_capacity;  /* slots of the ring, rounded up to a power of 2 */
+    size_t deque_capacity;  /* slots of each worker deque, 0 disables them */
+    int job_cache_size;     /* free job nodes cached by each worker, and
+                               by each thread adding jobs to the pool */
+    size_t job_high_water;  /* free job nodes kept by the pool after a burst,
+                               the memory of the others is released */
+    int spin_count;         /* pause instructions an idle worker spins for
+                               before yielding, 0 disables spinning */
+    int yield_count;        /* sched_yield() calls before parking */
+    int adaptive_spin;      /* nonzero: adapt the number of spins of each
+                               worker to the job inter-arrival time */
+    int prio_aging;         /* every prio_aging-th job taken while jobs of
+                               a lower priority wait is the oldest job of the
+                               lowest priority, 0 disables it */
+    int placement;          /* THR_PLACE_*, the CPUs of each worker */
+    size_t trace_capacity;  /* events kept by each trace ring,
+                               0 disables tracing */
+    size_t max_queued;      /* jobs queued and not started yet beyond which
+                               adding a job waits, 0 means unbounded */
+    int timeout_ms;         /* idle timeout in milliseconds, overrides
+                               timeout unless negative */
+    int scale_interval_ms;  /* milliseconds between two decisions of the
+                               scaling policy, 0 creates workers on demand
+                               up to max_threads */
+    const thr_scale_policy_t *scale_policy;
+                            /* NULL: hill climbing, growing while the queue
+                               wait exceeds scale_wait_us and a new worker
+                               raises the throughput */
+    unsigned long scale_wait_us;    /* see scale_policy */
+    int scale_shrink_after; /* decisions without queued jobs and with idle
+                               workers before hill climbing shrinks */
+    int prewarm;            /* nonzero: start min_threads workers before
+                               thr_pool_create_ex() returns */
+    int cooperative;        /* nonzero: jobs are never cancelled, and
+                               thr_pool_destroy() waits for the running
+                               ones to return */
+} thr_pool_options_t;
+
 /** @brief Initialize and create a thread pool.
  *
  *  This function initializes and create a thread pool before we can use it.
@@ -62,39 +406,715 @@ int thr_pool_create(thr_pool_t *pool,
                     int timeout,
                     const pthread_attr_t *attr);
 
+/** @brief Fill opts with the default pool options.
+ *
+ *  The defaults are: min_threads = 1, max_threads = number of online CPUs,
+ *  timeout = 60 seconds, default thread attributes, THR_QUEUE_LIST,
+ *  worker deques of 256 slots, job caches of 64 nodes, a high-water
+ *  mark of 1024 free job nodes, idle workers parking right away, no
+ *  priority aging, THR_PLACE_NONE, no tracing, no prewarming and jobs
+ *  cancelled by thr_pool_destroy().
+ *
+ *  @param[out] opts The options to initialize
+ */
+void thr_pool_options_init(thr_pool_options_t *opts);
+
+/** @brief Initialize and create a thread pool from a set of options.
+ *
+ *  Same as thr_pool_create(), with the extra knobs of thr_pool_options_t.
+ *  With THR_QUEUE_RING, jobs go through a fixed-capacity lock-free ring
+ *  buffer and pool->mutex is only taken to park and wake idle workers.
+ *  Jobs added while the ring is full are queued on the regular list and
+ *  performed once the ring drains.
+ *
+ *  Unless deque_capacity is 0, every worker owns a work-stealing deque:
+ *  jobs added from inside a job go to the deque of the calling worker and
+ *  are performed LIFO by it, while idle workers steal the oldest ones.
+ *
+ *  With a placement other than THR_PLACE_NONE, the affinity of each
+ *  worker is set when it is created, from the CPU topology in sysfs and
+ *  the index of the worker, see thr_worker_index(). It overrides the
+ *  affinity of attr. Workers beyond the number of CPUs, cores or nodes
+ *  wrap around.
+ *
+ *  An idle worker spins for spin_count pause instructions, then yields
+ *  the CPU yield_count times, and only then parks. Jobs submitted while a
+ *  worker spins or yields are handed off without waking anybody up. With
+ *  adaptive_spin, each worker spins about twice the average time it waits
+ *  for a job, and barely spins when jobs come less often than spin_count
+ *  allows to catch them.
+ *
+ *  Worker threads are created by a spawner thread of the pool: adding a
+ *  job only claims a worker slot, and never waits for pthread_create().
+ *  With prewarm, min_threads workers are created before
+ *  thr_pool_create_ex() returns, so that the first jobs do not pay for
+ *  them either.
+ *
+ *  @param[out] pool The pointer to thr_pool_t object
+ *  @param[in]  opts The options of the pool, NULL means the defaults
+ *
+ *  @return          If success, return 0; otherwise return error number,
+ *                   EAGAIN if a prewarmed worker could not be created.
+ */
+int thr_pool_create_ex(thr_pool_t *pool, const thr_pool_options_t *opts);
+
 /** @brief Add a work request to the thread pool job queue.
  *
- *  If there are idle worker threads, awaken one to perform the job.
+ *  If there are idle worker threads, awaken the one which became idle last
+ *  to perform the job.
  *  Else if the maximum number of workers has not been reached,
- *  create a new worker thread to perform the job.
+ *  have the spawner create a new worker thread to perform the job.
  *  Else just return after adding the job to the queue;
  *  an existing worker thread will perform the job when
  *  it finishes the job it is currently performing.
+ *  When called from a worker thread of the same pool, the job is pushed
+ *  on the deque of that worker instead of the shared queue.
  *  The job is performed as if a new thread were created for it:
  *      pthread_create(NULL, attr, void *(*func)(void *), void *arg);
+ *  If the pool was created with a max_queued bound and that many jobs
+ *  wait already, thr_pool_add() first waits for a worker to start one of
+ *  them. Workers of the pool never wait: their jobs are admitted over
+ *  the bound, since a worker waiting for its own pool could wait forever.
+ *  The same goes for all the functions adding jobs, but
+ *  thr_pool_try_add() and thr_pool_timed_add().
  *  On success, thr_pool_add() returns 0; otherwise returns an error number.
  *
  *  @param[in] pool The pointer to thr_pool_t object
  *  @param[in] func The function that will be excuted by a worker thread.
  *  @param[in] arg  The argument is passed to func(), i.e func(arg)
  *
- *  @return         On success return 0; otherwise return an error number.
+ *  @return         On success return 0; otherwise return an error number,
+ *                  ECANCELED if the pool was destroyed while waiting.
  */
 int thr_pool_add(thr_pool_t *pool,
                  void *(*func)(void *), void *arg);
 
+/** @brief Add a work request unless the job queue is full.
+ *
+ *  Same as thr_pool_add(), but fail right away instead of waiting for
+ *  room in a bounded queue, even when called from a worker of the pool.
+ *
+ *  @param[in] pool The pointer to thr_pool_t object
+ *  @param[in] func The function that will be excuted by a worker thread.
+ *  @param[in] arg  The argument is passed to func(), i.e func(arg)
+ *
+ *  @return         On success return 0; EAGAIN if max_queued jobs wait
+ *                  already; otherwise return an error number.
+ */
+int thr_pool_try_add(thr_pool_t *pool,
+                     void *(*func)(void *), void *arg);
+
+/** @brief Add a work request, waiting for room until a deadline.
+ *
+ *  Same as thr_pool_add(), but give up waiting for room in a bounded
+ *  queue at abstime, even when called from a worker of the pool.
+ *
+ *  @param[in] pool    The pointer to thr_pool_t object
+ *  @param[in] func    The function that will be excuted by a worker thread.
+ *  @param[in] arg     The argument is passed to func(), i.e func(arg)
+ *  @param[in] abstime The deadline, measured against CLOCK_REALTIME
+ *
+ *  @return         On success return 0; ETIMEDOUT if the queue was still
+ *                  full at abstime; otherwise return an error number.
+ */
+int thr_pool_timed_add(thr_pool_t *pool, void *(*func)(void *), void *arg,
+                       const struct timespec *abstime);
+
+/** @brief Add a work request along with a copy of its argument.
+ *
+ *  Same as thr_pool_add(), but size bytes at data are copied, and func()
+ *  receives a pointer to the copy, valid until func() returns. Up to
+ *  THR_JOB_INLINE bytes are stored in the job node itself, so the job
+ *  takes a single allocation from the job cache of the pool; up to
+ *  THR_JOB_BUFFER_SIZE bytes go to a buffer pooled by the pool, and
+ *  larger arguments to malloc(). The copy is aligned on 16 bytes.
+ *
+ *  @param[in] pool The pointer to thr_pool_t object
+ *  @param[in] func The function that will be excuted by a worker thread.
+ *  @param[in] data The argument to copy, may be NULL if size is 0
+ *  @param[in] size The number of bytes to copy
+ *
+ *  @return         On success return 0; otherwise return an error number.
+ */
+int thr_pool_add_inline(thr_pool_t *pool, void *(*func)(void *),
+                        const void *data, size_t size);
+
+/** @brief Add a work request to run after a delay.
+ *
+ *  The job is queued as by thr_pool_add() once delay_ns nanoseconds of
+ *  CLOCK_MONOTONIC have elapsed, rounded up to THR_TIMER_TICK_NS. A single
+ *  timer thread per pool, created on first use, keeps the pending timers in
+ *  a hierarchical timer wheel: adding and cancelling a timer are O(1)
+ *  whatever the number of timers, and the timers due at the same tick are
+ *  queued as one batch. thr_pool_wait() does not wait for pending timers.
+ *  If timer is not NULL, it receives a handle to cancel the job with
+ *  thr_timer_cancel(), which must be released with thr_timer_release()
+ *  before the pool is destroyed. Timers pending at thr_pool_destroy()
+ *  never fire.
+ *
+ *  @param[in]  pool     The pointer to thr_pool_t object
+ *  @param[in]  delay_ns Nanoseconds before the job is queued
+ *  @param[in]  func     The function that will be excuted by a worker thread.
+ *  @param[in]  arg      The argument is passed to func(), i.e func(arg)
+ *  @param[out] timer    The handle of the timer, or NULL
+ *
+ *  @return         On success return 0; otherwise return an error number.
+ */
+int thr_pool_add_delayed(thr_pool_t *pool, unsigned long long delay_ns,
+                         void *(*func)(void *), void *arg,
+                         thr_timer_t **timer);
+
+/** @brief Add a work request to run periodically.
+ *
+ *  Same as thr_pool_add_delayed(), then the job is queued again every
+ *  period_ns nanoseconds, at a fixed rate, until the timer is cancelled:
+ *  a run may start before the previous one returned, and the runs missed
+ *  while the pool was overloaded are skipped rather than queued in a burst.
+ *
+ *  @param[in]  pool      The pointer to thr_pool_t object
+ *  @param[in]  delay_ns  Nanoseconds before the first run is queued
+ *  @param[in]  period_ns Nanoseconds between two runs, at least one tick
+ *  @param[in]  func      The function that will be excuted by a worker thread.
+ *  @param[in]  arg       The argument is passed to func(), i.e func(arg)
+ *  @param[out] timer     The handle of the timer, or NULL
+ *
+ *  @return         On success return 0; otherwise return an error number.
+ */
+int thr_pool_add_periodic(thr_pool_t *pool, unsigned long long delay_ns,
+                          unsigned long long period_ns,
+                          void *(*func)(void *), void *arg,
+                          thr_timer_t **timer);
+
+/** @brief Cancel a delayed or periodic job.
+ *
+ *  A pending delayed job is never queued. A periodic job is not queued
+ *  again; a run already queued or running is not affected.
+ *
+ *  @param[in] timer The handle of the timer
+ *
+ *  @return          On success return 0; EALREADY if the delayed job was
+ *                   already queued or the timer already cancelled.
+ */
+int thr_timer_cancel(thr_timer_t *timer);
+
+/** @brief Release the handle of a timer.
+ *
+ *  The timer keeps running; only the handle goes away.
+ *
+ *  @param[in] timer The handle of the timer
+ */
+void thr_timer_release(thr_timer_t *timer);
+
+/** @brief Add a work request to run once a file descriptor is ready.
+ *
+ *  The job is queued as by thr_pool_add() once fd is ready for reading
+ *  or writing, as asked by events, or on error or hang-up: the job then
+ *  performs the I/O without blocking, and no worker sits blocked on it
+ *  meanwhile. The pool keeps one epoll instance, created on first use,
+ *  and it has no thread of its own: one of the idle workers polls it in
+ *  place of sleeping, and hands the ready jobs to the others. While every
+ *  worker is busy, readiness is noticed by the next one that goes idle.
+ *  A registration fires once; add the job again to wait for more, which
+ *  the job itself may do. A file descriptor has at most one registration
+ *  waiting at a time, and must stay open until its job is queued.
+ *  thr_pool_wait() does not wait for the registrations still waiting,
+ *  which never fire once the pool is shut down or destroyed.
+ *
+ *  @param[in] pool   The pointer to thr_pool_t object
+ *  @param[in] fd     The file descriptor
+ *  @param[in] events THR_IO_READ, THR_IO_WRITE or both
+ *  @param[in] func   The function that will be excuted by a worker thread.
+ *  @param[in] arg    The argument is passed to func(), i.e func(arg)
+ *
+ *  @return  On success return 0; EBUSY if fd has a registration whose
+ *           job is not queued yet; ENOTSUP if the system has no epoll;
+ *           otherwise return an error number.
+ */
+int thr_pool_add_io(thr_pool_t *pool, int fd, int events,
+                    void *(*func)(void *), void *arg);
+
+/** @brief Add a work request with a priority.
+ *
+ *  Same as thr_pool_add(), but workers take the jobs of the highest
+ *  priority first, then the oldest ones. thr_pool_add() adds jobs of
+ *  priority THR_PRIO_NORMAL. Jobs of any other priority always go on
+ *  the shared list, and while jobs above THR_PRIO_NORMAL wait there,
+ *  workers take them before any job queued on the ring or a deque.
+ *  The prio_aging option keeps jobs of low priority from starving.
+ *
+ *  @param[in] pool The pointer to thr_pool_t object
+ *  @param[in] func The function that will be excuted by a worker thread.
+ *  @param[in] arg  The argument is passed to func(), i.e func(arg)
+ *  @param[in] prio From THR_PRIO_HIGH to THR_PRIO_BACKGROUND
+ *
+ *  @return         On success return 0; otherwise return an error number.
+ */
+int thr_pool_add_prio(thr_pool_t *pool,
+                      void *(*func)(void *), void *arg, int prio);
+
+/** @brief Add a batch of work requests to the thread pool job queue.
+ *
+ *  Same as calling thr_pool_add() for every element of jobs, in order,
+ *  but the jobs are queued under a single lock acquisition and only
+ *  min(n, idle) idle workers are woken up; new workers are created only
+ *  for the jobs left over, up to the maximum number of workers.
+ *  Either all the jobs are queued or none is.
+ *
+ *  @param[in] pool The pointer to thr_pool_t object
+ *  @param[in] jobs The functions to execute and their arguments
+ *  @param[in] n    The number of elements of jobs
+ *
+ *  @return         On success return 0; otherwise return an error number.
+ */
+int thr_pool_add_batch(thr_pool_t *pool, const thr_job_desc_t *jobs, int n);
+
+/** @brief Add n work requests running the same function.
+ *
+ *  Same as thr_pool_add_batch() with func for every job, i.e.
+ *  func(args[0]), func(args[1]), ..., func(args[n - 1]).
+ *
+ *  @param[in] pool The pointer to thr_pool_t object
+ *  @param[in] func The function that will be excuted by the worker threads
+ *  @param[in] args The arguments passed to func()
+ *  @param[in] n    The number of elements of args
+ *
+ *  @return         On success return 0; otherwise return an error number.
+ */
+int thr_pool_add_batch_args(thr_pool_t *pool,
+                            void *(*func)(void *), void *const *args, int n);
+
+/** @brief Add a work request whose result can be waited for.
+ *
+ *  Same as thr_pool_add(), and the value returned by func(arg) is
+ *  published in a future. Wait for it with thr_future_wait(),
+ *  thr_future_timedwait() or thr_future_get(), then release the future
+ *  with thr_future_release(). All futures must be released before the
+ *  pool is destroyed. The jobs of futures dropped or cancelled by
+ *  thr_pool_destroy() complete as cancelled.
+ *
+ *  @param[in]  pool   The pointer to thr_pool_t object
+ *  @param[in]  func   The function that will be excuted by a worker thread.
+ *  @param[in]  arg    The argument is passed to func(), i.e func(arg)
+ *  @param[out] future The future of the job
+ *
+ *  @return         On success return 0; otherwise return an error number.
+ */
+int thr_pool_submit(thr_pool_t *pool, void *(*func)(void *), void *arg,
+                    thr_future_t **future);
+
+/** @brief Wait for the job of a future to complete.
+ *
+ *  @param[in] future The future returned by thr_pool_submit()
+ *
+ *  @return  0 if the result is available, ECANCELED if the job was
+ *           cancelled, or another error number.
+ */
+int thr_future_wait(thr_future_t *future);
+
+/** @brief Wait for the job of a future to complete, with a timeout.
+ *
+ *  Same as thr_future_wait(), but give up at the absolute time abstime,
+ *  measured against CLOCK_REALTIME as in pthread_cond_timedwait().
+ *
+ *  @param[in] future  The future returned by thr_pool_submit()
+ *  @param[in] abstime The deadline
+ *
+ *  @return  0 if the result is available, ECANCELED if the job was
+ *           cancelled, ETIMEDOUT if the deadline passed first,
+ *           or another error number.
+ */
+int thr_future_timedwait(thr_future_t *future, const struct timespec *abstime);
+
+/** @brief Wait for the job of a future and get its result.
+ *
+ *  @param[in]  future The future returned by thr_pool_submit()
+ *  @param[out] result The value returned by the job, NULL if cancelled
+ *
+ *  @return  0 on success, ECANCELED if the job was cancelled,
+ *           or another error number.
+ */
+int thr_future_get(thr_future_t *future, void **result);
+
+/** @brief Release a future.
+ *
+ *  The future must not be used afterwards. The job itself keeps running
+ *  if it has not completed yet.
+ *
+ *  @param[in] future The future returned by thr_pool_submit()
+ */
+void thr_future_release(thr_future_t *future);
+
+/** @brief Add a work request to run once the job of a future is over.
+ *
+ *  func(arg) is queued on the pool of future as soon as its job returns,
+ *  by the worker that ran it, on its own deque when it has one. If the
+ *  job already returned, func(arg) is queued right away. When the job is
+ *  cancelled or dropped, so is the continuation. func may read the
+ *  result with thr_future_get() as long as future was not released.
+ *  Continuations can be chained, since next is a future as well;
+ *  release it with thr_future_release().
+ *
+ *  @param[in]  future The future returned by thr_pool_submit() or by
+ *                     thr_future_then()
+ *  @param[in]  func   The function that will be excuted by a worker thread.
+ *  @param[in]  arg    The argument is passed to func(), i.e func(arg)
+ *  @param[out] next   The future of the continuation
+ *
+ *  @return         On success return 0; otherwise return an error number.
+ */
+int thr_future_then(thr_future_t *future, void *(*func)(void *), void *arg,
+                    thr_future_t **next);
+
+/** @brief Initialize an empty job group.
+ *
+ *  A group needs no cleanup; it can be reused as soon as it is empty.
+ *
+ *  @param[out] group The group
+ *
+ *  @return  On success return 0; otherwise return an error number.
+ */
+int thr_group_init(thr_group_t *group);
+
+/** @brief Add a work request belonging to a group.
+ *
+ *  Same as thr_pool_add(), and the job counts as outstanding in group
+ *  until it returns, or it is cancelled or dropped by thr_pool_destroy().
+ *  A group may have jobs in several pools.
+ *
+ *  @param[in] pool  The pointer to thr_pool_t object
+ *  @param[in] group The group initialized by thr_group_init()
+ *  @param[in] func  The function that will be excuted by a worker thread.
+ *  @param[in] arg   The argument is passed to func(), i.e func(arg)
+ *
+ *  @return  On success return 0; otherwise return an error number.
+ */
+int thr_pool_add_group(thr_pool_t *pool, thr_group_t *group,
+                       void *(*func)(void *), void *arg);
+
+/** @brief Wait for all the jobs of a group to be over.
+ *
+ *  Unlike thr_pool_wait(), only the jobs of the group are waited for,
+ *  and the pool lock is never taken.
+ *  Called from a job, the worker runs the queued jobs of its pool while
+ *  it waits, the most recent ones it added first; with nothing to run,
+ *  it sleeps and looks again every millisecond. The same goes for every
+ *  wait of the library, so that fork-join jobs never hold the workers
+ *  the jobs they wait for need. A job must not wait for a job below it
+ *  on the same worker, such as one that waits for it.
+ *
+ *  @param[in] group The group
+ *
+ *  @return  On success return 0; otherwise return an error number.
+ */
+int thr_group_wait(thr_group_t *group);
+
+/** @brief Wait for all the jobs of a group to be over, with a timeout.
+ *
+ *  Same as thr_group_wait(), but give up at the absolute time abstime,
+ *  measured against CLOCK_REALTIME as in pthread_cond_timedwait().
+ *
+ *  @param[in] group   The group
+ *  @param[in] abstime The deadline
+ *
+ *  @return  0 when the group is empty, ETIMEDOUT if the deadline passed
+ *           first, or another error number.
+ */
+int thr_group_timedwait(thr_group_t *group, const struct timespec *abstime);
+
+/** @brief Initialize an empty strand.
+ *
+ *  A strand needs no cleanup; it can be reused as soon as it is empty.
+ *
+ *  @param[out] strand The strand
+ *
+ *  @return  On success return 0; otherwise return an error number.
+ */
+int thr_strand_init(thr_strand_t *strand);
+
+/** @brief Add a work request to a strand.
+ *
+ *  The jobs of a strand run in the order they were added, one at a time,
+ *  without any lock: the job that finds the strand empty queues it on the
+ *  pool, then the worker that picks it up runs the jobs of the strand in
+ *  a row, THR_STRAND_BATCH at most before it queues the strand again
+ *  behind the other jobs. The state of the strand stays in the cache of
+ *  that worker, and no worker ever blocks on another one. In the
+ *  statistics, each such batch counts as one job. The jobs of a strand
+ *  are dropped along with it by thr_pool_destroy(), and whenever its run
+ *  cannot be queued, e.g. after thr_pool_shutdown(): the call that found
+ *  the strand empty then returns the error, and its job is dropped as
+ *  well. A call that found the strand busy returns 0 though its job may
+ *  be dropped that way later. A strand must be used with a single pool.
+ *
+ *  @param[in] pool   The pointer to thr_pool_t object
+ *  @param[in] strand The strand initialized by thr_strand_init()
+ *  @param[in] func   The function that will be excuted by a worker thread.
+ *  @param[in] arg    The argument is passed to func(), i.e func(arg)
+ *
+ *  @return  On success return 0; otherwise return an error number.
+ */
+int thr_pool_add_strand(thr_pool_t *pool, thr_strand_t *strand,
+                        void *(*func)(void *), void *arg);
+
+/** @brief Create an empty task graph.
+ *
+ *  Add the tasks with thr_graph_add(), the dependencies between them with
+ *  thr_graph_edge(), then run the graph on a pool with
+ *  thr_pool_run_graph(). A graph can be run again once it is over.
+ *
+ *  @param[out] graph The graph
+ *
+ *  @return  On success return 0; otherwise return an error number.
+ */
+int thr_graph_create(thr_graph_t **graph);
+
+/** @brief Add a task to a graph.
+ *
+ *  @param[in]  graph The graph, not running
+ *  @param[in]  func  The function that will be excuted by a worker thread.
+ *  @param[in]  arg   The argument is passed to func(), i.e func(arg)
+ *  @param[out] task  The task, owned by the graph
+ *
+ *  @return  On success return 0, EBUSY if the graph is running;
+ *           otherwise return an error number.
+ */
+int thr_graph_add(thr_graph_t *graph, void *(*func)(void *), void *arg,
+                  thr_task_t **task);
+
+/** @brief Make a task wait for another one.
+ *
+ *  after is queued once before and all its other predecessors returned,
+ *  by the worker that completed the last of them, on its own deque when
+ *  it has one.
+ *
+ *  @param[in] graph  The graph of both tasks, not running
+ *  @param[in] before The task to run first
+ *  @param[in] after  The task depending on before
+ *
+ *  @return  On success return 0, EBUSY if the graph is running;
+ *           otherwise return an error number.
+ */
+int thr_graph_edge(thr_graph_t *graph, thr_task_t *before, thr_task_t *after);
+
+/** @brief Run a task graph.
+ *
+ *  Queue the tasks without predecessors, the others follow as their
+ *  predecessors return. Wait for the graph with thr_graph_wait().
+ *  When a task is cancelled or dropped by thr_pool_destroy() or
+ *  thr_pool_shutdown(), the tasks not queued yet are skipped.
+ *
+ *  @param[in] pool  The pointer to thr_pool_t object
+ *  @param[in] graph The graph, not running
+ *
+ *  @return  On success return 0, EBUSY if the graph is running, EINVAL if
+ *           its edges make a cycle; otherwise return an error number.
+ */
+int thr_pool_run_graph(thr_pool_t *pool, thr_graph_t *graph);
+
+/** @brief Wait for a task graph to be over.
+ *
+ *  @param[in] graph The graph
+ *
+ *  @return  0 if every task ran, ECANCELED if some were cancelled or
+ *           skipped, or another error number.
+ */
+int thr_graph_wait(thr_graph_t *graph);
+
+/** @brief Wait for a task graph to be over, with a timeout.
+ *
+ *  Same as thr_graph_wait(), but give up at the absolute time abstime,
+ *  measured against CLOCK_REALTIME as in pthread_cond_timedwait().
+ *
+ *  @param[in] graph   The graph
+ *  @param[in] abstime The deadline
+ *
+ *  @return  0 if every task ran, ECANCELED if some were cancelled or
+ *           skipped, ETIMEDOUT if the deadline passed first,
+ *           or another error number.
+ */
+int thr_graph_timedwait(thr_graph_t *graph, const struct timespec *abstime);
+
+/** @brief Get the value a task returned in the last run of its graph.
+ *
+ *  Tasks can read the results of their predecessors.
+ *
+ *  @param[in] task The task
+ *
+ *  @return  The value returned by the task, NULL if it did not run.
+ */
+void *thr_task_result(thr_task_t *task);
+
+/** @brief Free a task graph and its tasks.
+ *
+ *  @param[in] graph The graph, not running
+ */
+void thr_graph_destroy(thr_graph_t *graph);
+
+/** @brief Run a loop over an index range on the pool.
+ *
+ *  Call body(b, e, ctx) on consecutive chunks [b, e) covering
+ *  [begin, end), and return once all of them returned. The chunks are
+ *  claimed by the calling thread and by up to max_threads - 1 helper
+ *  jobs: first large shares of what is left, then smaller and smaller
+ *  ones, never shorter than grain indexes except the last one. A loop of
+ *  at most grain indexes runs on the calling thread alone.
+ *  The function can be called from a job of the same pool.
+ *
+ *  @param[in] pool  The pointer to thr_pool_t object
+ *  @param[in] begin The first index
+ *  @param[in] end   One past the last index
+ *  @param[in] grain The minimum number of indexes of a chunk
+ *  @param[in] body  The function performing a chunk
+ *  @param[in] ctx   The last argument of body()
+ *
+ *  @return  On success return 0; otherwise return an error number.
+ */
+int thr_pool_parallel_for(thr_pool_t *pool, long begin, long end, long grain,
+                          void (*body)(long, long, void *), void *ctx);
+
+/** @brief Run a reduction over an index range on the pool.
+ *
+ *  Same as thr_pool_parallel_for(), but body(b, e, acc, ctx) also gets
+ *  the partial accumulator of the thread performing the chunk. Each
+ *  participant owns a private accumulator of size bytes, alone on its
+ *  cache lines and initialized with a copy of *result, which must hold
+ *  the identity element on entry. The partial accumulators are then
+ *  folded into *result with combine(result, partial, ctx).
+ *
+ *  @param[in]     pool    The pointer to thr_pool_t object
+ *  @param[in]     begin   The first index
+ *  @param[in]     end     One past the last index
+ *  @param[in]     grain   The minimum number of indexes of a chunk
+ *  @param[in]     body    The function performing a chunk
+ *  @param[in]     combine The function folding a partial accumulator
+ *  @param[in,out] result  The identity element, then the result
+ *  @param[in]     size    The size of the accumulator
+ *  @param[in]     ctx     The last argument of body() and combine()
+ *
+ *  @return  On success return 0; otherwise return an error number.
+ */
+int thr_pool_parallel_reduce(thr_pool_t *pool, long begin, long end,
+                             long grain,
+                             void (*body)(long, long, void *, void *),
+                             void (*combine)(void *, const void *, void *),
+                             void *result, size_t size, void *ctx);
+
+/** @brief Get the index of the calling worker thread.
+ *
+ *  Workers of a pool have distinct indexes from 0 to max_threads - 1.
+ *  A worker that exits leaves its index to the next worker created.
+ *
+ *  @return  The index, or -1 if the caller is not a worker thread.
+ */
+int thr_worker_index(void);
+
+/** @brief Get the NUMA node of the calling worker thread.
+ *
+ *  @return  The node the worker is placed on, or -1 if the caller is not
+ *           a worker thread or its pool uses THR_PLACE_NONE.
+ */
+int thr_worker_node(void);
+
+/** @brief Count how idle workers got their jobs.
+ *
+ *  For each phase of the idle policy (spinning, yielding, parked),
+ *  the number of times an idle worker got a job during that phase.
+ *
+ *  @param[in]  pool  The pointer to thr_pool_t object
+ *  @param[out] stats The counters
+ */
+void thr_pool_idle_stats(thr_pool_t *pool, thr_idle_stats_t *stats);
+
+/** @brief Take a snapshot of the statistics of the pool.
+ *
+ *  The counters are summed over the workers without stopping them, so
+ *  the numbers of a snapshot taken while jobs run may be slightly off
+ *  from each other. Build the library with -DTHR_POOL_NO_STATS to stop
+ *  collecting them; then only nthreads, idle, spawned, retired and
+ *  handoffs are filled, and ENOTSUP is returned.
+ *
+ *  @param[in]  pool  The pointer to thr_pool_t object
+ *  @param[out] stats The snapshot
+ *
+ *  @return  On success return 0; otherwise return an error number.
+ */
+int thr_pool_stats(thr_pool_t *pool, thr_pool_stats_t *stats);
+
+/** @brief Turn event tracing on or off.
+ *
+ *  Only pools created with a nonzero trace_capacity can trace; they
+ *  start with tracing on. Each worker records when it starts and ends
+ *  jobs, parks, wakes up and retires, and every thread records the jobs
+ *  it adds and the workers it spawns, into rings of trace_capacity
+ *  events where the oldest events are overwritten. Build the library
+ *  with -DTHR_POOL_NO_TRACE to compile tracing out.
+ *
+ *  @param[in] pool   The pointer to thr_pool_t object
+ *  @param[in] enable Nonzero to record events
+ *
+ *  @return  On success return 0; otherwise return an error number.
+ */
+int thr_pool_trace_enable(thr_pool_t *pool, int enable);
+
+/** @brief Write the recorded events as Chrome trace-event JSON.
+ *
+ *  The output can be loaded in chrome://tracing or ui.perfetto.dev;
+ *  each worker slot is a thread of the timeline. It may be called while
+ *  the pool runs jobs.
+ *
+ *  @param[in] pool The pointer to thr_pool_t object
+ *  @param[in] out  The stream to write to
+ *
+ *  @return  On success return 0; otherwise return an error number.
+ */
+int thr_pool_trace_dump(thr_pool_t *pool, FILE *out);
+
 /** @brief Wait for all queued jobs to complete.
+ *
+ *  Blocks on a futex until the count of queued and running jobs drops to
+ *  0. Jobs complete without taking the pool lock.
+ *  Called from a job of the pool, it waits for the other jobs but those
+ *  waiting in thr_pool_wait() as well, and the worker runs queued jobs
+ *  meanwhile instead of blocking, see thr_group_wait().
  *
  *  @param[in] pool The pointer to thr_pool_t object
  *  @return On success, return 0; otherwise return error number.
  */
 int thr_pool_wait(thr_pool_t *pool);
 
+/** @brief Stop the pool and wait for its workers to exit.
+ *
+ *  Jobs added from then on fail with ECANCELED, but those added by the
+ *  running jobs of the pool while it drains, and pending timers never
+ *  fire. With THR_SHUTDOWN_DRAIN the queued jobs are all performed; with
+ *  THR_SHUTDOWN_DISCARD they are dropped as by thr_pool_destroy(). No job
+ *  is ever cancelled: running jobs return on their own, then each worker
+ *  exits once it finds the queues empty.
+ *  If the workers are still there at deadline, thr_pool_shutdown() may be
+ *  called again to wait further. Either way, release the pool with
+ *  thr_pool_destroy() afterwards, which returns at once when all the
+ *  workers exited.
+ *
+ *  @param[in] pool     The pointer to thr_pool_t object
+ *  @param[in] how      THR_SHUTDOWN_DRAIN or THR_SHUTDOWN_DISCARD
+ *  @param[in] deadline When to give up waiting, measured against
+ *                      CLOCK_REALTIME, NULL to wait as long as it takes
+ *
+ *  @return  On success return 0; ETIMEDOUT if workers were still running
+ *           at deadline; EDEADLK when called from a worker of the pool;
+ *           otherwise return an error number.
+ */
+int thr_pool_shutdown(thr_pool_t *pool, int how,
+                      const struct timespec *deadline);
+
 /** @brief Cancel all queued jobs and destroy the pool.
  *
  *  This function should be called after calling thr_pool_wait() to release
  *  all worker threads. Calling this function when the job queue is not empty
  *  can lead to inconsistent state for program.
+ *  Producers waiting for room in a bounded queue give up with ECANCELED.
+ *  Running jobs are cancelled, unless the pool is cooperative: then they
+ *  are waited for. See thr_pool_shutdown() for a clean stop.
  *
  *  @param[in] pool The pointer to thr_pool_t object
  */
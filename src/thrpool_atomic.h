@@ -0,0 +1,30 @@
+/*
+ * Small helpers shared by the lock-free parts of the pool.
+ * All atomic accesses go through the GCC/Clang __atomic builtins so that
+ * the library keeps building with -std=c99.
+ */
+#ifndef _THRPOOL_ATOMIC_H
+#define _THRPOOL_ATOMIC_H
+
+#ifndef THR_CACHE_LINE
+#define THR_CACHE_LINE 64
+#endif
+
+#define THR_CACHE_ALIGNED __attribute__((aligned(THR_CACHE_LINE)))
+
+#define THR_LIKELY(x)   __builtin_expect(!!(x), 1)
+#define THR_UNLIKELY(x) __builtin_expect(!!(x), 0)
+
+/* Hint the CPU that we are busy waiting */
+static inline void thr_cpu_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+    __asm__ __volatile__("yield" ::: "memory");
+#else
+    __asm__ __volatile__("" ::: "memory");
+#endif
+}
+
+#endif  /* _THRPOOL_ATOMIC_H */
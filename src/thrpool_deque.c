@@ -0,0 +1,86 @@
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "thrpool_deque.h"
+#include <stdlib.h>
+#include <errno.h>
+
+int thr_deque_init(thr_deque_t *dq, size_t capacity)
+{
+    if (dq == NULL || capacity == 0) return EINVAL;
+
+    size_t size = 2;
+    while (size < capacity) size <<= 1;
+
+    dq->buf = (void **) calloc(size, sizeof(void *));
+    if (dq->buf == NULL) return ENOMEM;
+    dq->mask = (long)size - 1;
+    dq->top = 0;
+    dq->bottom = 0;
+    return 0;
+}
+
+void thr_deque_destroy(thr_deque_t *dq)
+{
+    if (dq == NULL) return;
+    free(dq->buf);
+    dq->buf = NULL;
+}
+
+int thr_deque_push(thr_deque_t *dq, void *data)
+{
+    long b = __atomic_load_n(&dq->bottom, __ATOMIC_RELAXED);
+    long t = __atomic_load_n(&dq->top, __ATOMIC_ACQUIRE);
+    if (b - t > dq->mask) return EAGAIN;
+
+    __atomic_store_n(&dq->buf[b & dq->mask], data, __ATOMIC_RELAXED);
+    /* publish the element to the thieves */
+    __atomic_store_n(&dq->bottom, b + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+void *thr_deque_pop(thr_deque_t *dq)
+{
+    long b = __atomic_load_n(&dq->bottom, __ATOMIC_RELAXED) - 1;
+    __atomic_store_n(&dq->bottom, b, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    long t = __atomic_load_n(&dq->top, __ATOMIC_RELAXED);
+
+    void *data = NULL;
+    if (t <= b) {
+        data = __atomic_load_n(&dq->buf[b & dq->mask], __ATOMIC_RELAXED);
+        if (t == b) {
+            /* The last element, race against the thieves */
+            if (!__atomic_compare_exchange_n(&dq->top, &t, t + 1, 0,
+                                             __ATOMIC_SEQ_CST,
+                                             __ATOMIC_RELAXED))
+                data = NULL;
+            __atomic_store_n(&dq->bottom, b + 1, __ATOMIC_RELAXED);
+        }
+    } else {
+        __atomic_store_n(&dq->bottom, b + 1, __ATOMIC_RELAXED);
+    }
+    return data;
+}
+
+void *thr_deque_steal(thr_deque_t *dq)
+{
+    long t = __atomic_load_n(&dq->top, __ATOMIC_ACQUIRE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    long b = __atomic_load_n(&dq->bottom, __ATOMIC_ACQUIRE);
+    if (t >= b) return NULL;
+
+    void *data = __atomic_load_n(&dq->buf[t & dq->mask], __ATOMIC_RELAXED);
+    if (!__atomic_compare_exchange_n(&dq->top, &t, t + 1, 0,
+                                     __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+        return NULL;
+    return data;
+}
+
+int thr_deque_empty(thr_deque_t *dq)
+{
+    long t = __atomic_load_n(&dq->top, __ATOMIC_ACQUIRE);
+    long b = __atomic_load_n(&dq->bottom, __ATOMIC_ACQUIRE);
+    return t >= b;
+}
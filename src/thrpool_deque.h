@@ -0,0 +1,46 @@
+/*
+ * Fixed-capacity Chase-Lev work-stealing deque.
+ *
+ * The owner thread pushes and pops at the bottom (LIFO), any other thread
+ * may steal from the top (FIFO). Memory orderings follow "Correct and
+ * Efficient Work-Stealing for Weak Memory Models" (Le et al., PPoPP'13).
+ * The buffer never grows: a push on a full deque fails and the caller is
+ * expected to fall back on a shared queue.
+ */
+#ifndef _THRPOOL_DEQUE_H
+#define _THRPOOL_DEQUE_H
+
+#include <stddef.h>
+#include "thrpool_atomic.h"
+
+typedef struct thr_deque {
+    long top THR_CACHE_ALIGNED;     /* next element to steal */
+    long bottom THR_CACHE_ALIGNED;  /* next free slot of the owner */
+    void **buf;
+    long mask;
+} thr_deque_t;
+
+/*
+ * Allocate the slots of the deque. capacity is rounded up to a power of two.
+ * Return 0 on success; otherwise return an error number.
+ */
+int thr_deque_init(thr_deque_t *dq, size_t capacity);
+
+void thr_deque_destroy(thr_deque_t *dq);
+
+/* Owner only. Return 0 on success, or EAGAIN if the deque is full */
+int thr_deque_push(thr_deque_t *dq, void *data);
+
+/* Owner only. Return the newest element, or NULL if the deque is empty */
+void *thr_deque_pop(thr_deque_t *dq);
+
+/*
+ * Any thread. Return the oldest element, or NULL if the deque is empty
+ * or another thread won the race for that element.
+ */
+void *thr_deque_steal(thr_deque_t *dq);
+
+/* Any thread. Only a hint when other threads use the deque concurrently */
+int thr_deque_empty(thr_deque_t *dq);
+
+#endif  /* _THRPOOL_DEQUE_H */
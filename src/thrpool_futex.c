@@ -0,0 +1,57 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include "thrpool_futex.h"
+#include <errno.h>
+
+#ifdef __linux__
+
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+int thr_futex_wait(int *addr, int val, const struct timespec *abstime)
+{
+    /* FUTEX_WAIT_BITSET takes an absolute timeout, unlike FUTEX_WAIT */
+    int op = FUTEX_WAIT_BITSET | FUTEX_PRIVATE_FLAG;
+    if (abstime != NULL) op |= FUTEX_CLOCK_REALTIME;
+
+    if (syscall(SYS_futex, addr, op, val, abstime, NULL,
+                FUTEX_BITSET_MATCH_ANY) == 0)
+        return 0;
+    if (errno == ETIMEDOUT || errno == EAGAIN) return errno;
+    return 0;   /* EINTR */
+}
+
+void thr_futex_wake(int *addr, int n)
+{
+    syscall(SYS_futex, addr, FUTEX_WAKE | FUTEX_PRIVATE_FLAG, n,
+            NULL, NULL, 0);
+}
+
+#else   /* !__linux__ */
+
+#include <sched.h>
+
+int thr_futex_wait(int *addr, int val, const struct timespec *abstime)
+{
+    if (__atomic_load_n(addr, __ATOMIC_ACQUIRE) != val) return EAGAIN;
+    if (abstime != NULL) {
+        struct timespec now;
+        clock_gettime(CLOCK_REALTIME, &now);
+        if (now.tv_sec > abstime->tv_sec ||
+            (now.tv_sec == abstime->tv_sec && now.tv_nsec >= abstime->tv_nsec))
+            return ETIMEDOUT;
+    }
+    sched_yield();
+    return 0;
+}
+
+void thr_futex_wake(int *addr, int n)
+{
+    (void) addr;
+    (void) n;
+}
+
+#endif  /* __linux__ */
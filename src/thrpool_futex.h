@@ -0,0 +1,23 @@
+/*
+ * Wait on and wake up the waiters of a 32-bit word, without a mutex.
+ *
+ * On Linux these are thin wrappers around the private futex operations.
+ * Elsewhere, waiters poll the word and yield the CPU between two checks.
+ */
+#ifndef _THRPOOL_FUTEX_H
+#define _THRPOOL_FUTEX_H
+
+#include <time.h>
+
+/*
+ * Block while *addr == val, until woken up or until the absolute
+ * CLOCK_REALTIME time abstime (never if abstime is NULL).
+ * Return 0 when woken up, possibly spuriously, EAGAIN if *addr != val,
+ * or ETIMEDOUT.
+ */
+int thr_futex_wait(int *addr, int val, const struct timespec *abstime);
+
+/* Wake up to n threads blocked in thr_futex_wait() on addr */
+void thr_futex_wake(int *addr, int n);
+
+#endif  /* _THRPOOL_FUTEX_H */
@@ -0,0 +1,116 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include "thrpool_reactor.h"
+#include <errno.h>
+
+#ifdef __linux__
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <stdint.h>
+#include <unistd.h>
+
+int thr_reactor_init(thr_reactor_t *reactor)
+{
+    reactor->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (reactor->epfd < 0) return errno;
+
+    reactor->wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (reactor->wakefd < 0) {
+        int err = errno;
+        close(reactor->epfd);
+        return err;
+    }
+
+    /* Level-triggered: it stays ready until the poll drains it */
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;
+    if (epoll_ctl(reactor->epfd, EPOLL_CTL_ADD, reactor->wakefd, &ev) < 0) {
+        int err = errno;
+        close(reactor->wakefd);
+        close(reactor->epfd);
+        return err;
+    }
+    return 0;
+}
+
+void thr_reactor_destroy(thr_reactor_t *reactor)
+{
+    close(reactor->wakefd);
+    close(reactor->epfd);
+}
+
+int thr_reactor_arm(thr_reactor_t *reactor, int fd, int events, void *data)
+{
+    struct epoll_event ev;
+    ev.events = EPOLLONESHOT;
+    if (events & THR_REACTOR_READ) ev.events |= EPOLLIN | EPOLLRDHUP;
+    if (events & THR_REACTOR_WRITE) ev.events |= EPOLLOUT;
+    ev.data.ptr = data;
+
+    /* Reported registrations leave the set, so fd is still waiting */
+    if (epoll_ctl(reactor->epfd, EPOLL_CTL_ADD, fd, &ev) == 0) return 0;
+    return errno == EEXIST ? EBUSY : errno;
+}
+
+void thr_reactor_disarm(thr_reactor_t *reactor, int fd)
+{
+    struct epoll_event ev;  /* ignored, but not NULL for older kernels */
+    epoll_ctl(reactor->epfd, EPOLL_CTL_DEL, fd, &ev);
+}
+
+int thr_reactor_poll(thr_reactor_t *reactor, void **ready, int max,
+                     int timeout_ms)
+{
+    struct epoll_event events[THR_REACTOR_EVENTS];
+    if (max > THR_REACTOR_EVENTS) max = THR_REACTOR_EVENTS;
+
+    int n = epoll_wait(reactor->epfd, events, max, timeout_ms);
+    int count = 0;
+    for (int i = 0; i < n; i++) {
+        if (events[i].data.ptr == NULL) {
+            uint64_t value;
+            ssize_t rc = read(reactor->wakefd, &value, sizeof(value));
+            (void) rc;
+            continue;
+        }
+        ready[count++] = events[i].data.ptr;
+    }
+    return count;
+}
+
+void thr_reactor_wake(thr_reactor_t *reactor)
+{
+    uint64_t one = 1;
+    ssize_t rc = write(reactor->wakefd, &one, sizeof(one));
+    (void) rc;
+}
+
+#else   /* !__linux__ */
+
+int thr_reactor_init(thr_reactor_t *reactor)
+{
+    return ENOTSUP;
+}
+
+void thr_reactor_destroy(thr_reactor_t *reactor) { }
+
+int thr_reactor_arm(thr_reactor_t *reactor, int fd, int events, void *data)
+{
+    return ENOTSUP;
+}
+
+void thr_reactor_disarm(thr_reactor_t *reactor, int fd) { }
+
+int thr_reactor_poll(thr_reactor_t *reactor, void **ready, int max,
+                     int timeout_ms)
+{
+    return 0;
+}
+
+void thr_reactor_wake(thr_reactor_t *reactor) { }
+
+#endif  /* __linux__ */
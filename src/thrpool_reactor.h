@@ -0,0 +1,54 @@
+/*
+ * Readiness notifications of file descriptors, polled by an idle worker
+ * of the pool instead of a thread of its own.
+ *
+ * On Linux this is an epoll instance holding one-shot registrations, and
+ * an eventfd that interrupts the poll when the pool needs its worker
+ * back. Elsewhere thr_reactor_init() fails with ENOTSUP.
+ * The reactor does no locking: arming and waking may happen from any
+ * thread, polling from one thread at a time.
+ */
+#ifndef _THRPOOL_REACTOR_H
+#define _THRPOOL_REACTOR_H
+
+/* Events of a registration */
+#define THR_REACTOR_READ (1<<0)
+#define THR_REACTOR_WRITE (1<<1)
+
+/* Registrations reported by one poll at most */
+#define THR_REACTOR_EVENTS 64
+
+typedef struct thr_reactor {
+    int epfd;           /* the epoll instance */
+    int wakefd;         /* eventfd interrupting thr_reactor_poll() */
+} thr_reactor_t;
+
+/* Return 0 on success, or an error number */
+int thr_reactor_init(thr_reactor_t *reactor);
+
+void thr_reactor_destroy(thr_reactor_t *reactor);
+
+/*
+ * Report data once fd is ready for events, or on error or hang-up.
+ * The registration is reported once, then stays in the set until
+ * thr_reactor_disarm().
+ * Return 0 on success, EBUSY if fd is in the set already, or another
+ * error number.
+ */
+int thr_reactor_arm(thr_reactor_t *reactor, int fd, int events, void *data);
+
+/* Take fd out of the set, once its registration was reported */
+void thr_reactor_disarm(thr_reactor_t *reactor, int fd);
+
+/*
+ * Wait for timeout_ms milliseconds at most, forever if negative, and
+ * store the data of up to max ready registrations in ready.
+ * Return their number, 0 when woken up or timed out.
+ */
+int thr_reactor_poll(thr_reactor_t *reactor, void **ready, int max,
+                     int timeout_ms);
+
+/* Make the pending or next thr_reactor_poll() return */
+void thr_reactor_wake(thr_reactor_t *reactor);
+
+#endif  /* _THRPOOL_REACTOR_H */
@@ -0,0 +1,100 @@
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "thrpool_ring.h"
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+
+int thr_ring_init(thr_ring_t *ring, size_t capacity)
+{
+    if (ring == NULL || capacity == 0) return EINVAL;
+
+    size_t size = 2;
+    while (size < capacity) {
+        if (size > SIZE_MAX / 2) return EINVAL;
+        size <<= 1;
+    }
+
+    void *cells;
+    if (posix_memalign(&cells, THR_CACHE_LINE, size * sizeof(thr_ring_cell_t)))
+        return ENOMEM;
+
+    ring->cells = (thr_ring_cell_t *) cells;
+    ring->mask = size - 1;
+    for (size_t i = 0; i < size; i++) {
+        ring->cells[i].seq = i;
+        ring->cells[i].data = NULL;
+    }
+    ring->enqueue_pos = 0;
+    ring->dequeue_pos = 0;
+    return 0;
+}
+
+void thr_ring_destroy(thr_ring_t *ring)
+{
+    if (ring == NULL) return;
+    free(ring->cells);
+    ring->cells = NULL;
+}
+
+int thr_ring_push(thr_ring_t *ring, void *data)
+{
+    thr_ring_cell_t *cell;
+    size_t pos = __atomic_load_n(&ring->enqueue_pos, __ATOMIC_RELAXED);
+
+    for (;;) {
+        cell = &ring->cells[pos & ring->mask];
+        size_t seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+        intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+        if (dif == 0) {
+            if (__atomic_compare_exchange_n(&ring->enqueue_pos, &pos, pos + 1,
+                                            1, __ATOMIC_RELAXED,
+                                            __ATOMIC_RELAXED))
+                break;
+        } else if (dif < 0) {
+            return EAGAIN;
+        } else {
+            pos = __atomic_load_n(&ring->enqueue_pos, __ATOMIC_RELAXED);
+        }
+    }
+
+    cell->data = data;
+    __atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+void *thr_ring_pop(thr_ring_t *ring)
+{
+    thr_ring_cell_t *cell;
+    size_t pos = __atomic_load_n(&ring->dequeue_pos, __ATOMIC_RELAXED);
+
+    for (;;) {
+        cell = &ring->cells[pos & ring->mask];
+        size_t seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+        intptr_t dif = (intptr_t)seq - (intptr_t)(pos + 1);
+        if (dif == 0) {
+            if (__atomic_compare_exchange_n(&ring->dequeue_pos, &pos, pos + 1,
+                                            1, __ATOMIC_RELAXED,
+                                            __ATOMIC_RELAXED))
+                break;
+        } else if (dif < 0) {
+            return NULL;
+        } else {
+            pos = __atomic_load_n(&ring->dequeue_pos, __ATOMIC_RELAXED);
+        }
+    }
+
+    void *data = cell->data;
+    __atomic_store_n(&cell->seq, pos + ring->mask + 1, __ATOMIC_RELEASE);
+    return data;
+}
+
+int thr_ring_empty(thr_ring_t *ring)
+{
+    size_t pos = __atomic_load_n(&ring->dequeue_pos, __ATOMIC_ACQUIRE);
+    thr_ring_cell_t *cell = &ring->cells[pos & ring->mask];
+    size_t seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+    return (intptr_t)seq - (intptr_t)(pos + 1) < 0;
+}
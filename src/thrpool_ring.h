@@ -0,0 +1,48 @@
+/*
+ * Bounded multi-producer/multi-consumer ring buffer.
+ *
+ * Every slot carries a sequence number telling whether it is ready to be
+ * written (seq == pos) or read (seq == pos + 1), so both push and pop are
+ * a single CAS on the shared position plus one release store on the slot
+ * (D. Vyukov's bounded MPMC queue).
+ */
+#ifndef _THRPOOL_RING_H
+#define _THRPOOL_RING_H
+
+#include <stddef.h>
+#include "thrpool_atomic.h"
+
+typedef struct thr_ring_cell {
+    size_t seq;
+    void *data;
+} thr_ring_cell_t;
+
+typedef struct thr_ring {
+    thr_ring_cell_t *cells;
+    size_t mask;
+    /* producers and consumers never share a cache line */
+    size_t enqueue_pos THR_CACHE_ALIGNED;
+    size_t dequeue_pos THR_CACHE_ALIGNED;
+} thr_ring_t;
+
+/*
+ * Allocate the slots of the ring. capacity is rounded up to a power of two.
+ * Return 0 on success; otherwise return an error number.
+ */
+int thr_ring_init(thr_ring_t *ring, size_t capacity);
+
+void thr_ring_destroy(thr_ring_t *ring);
+
+/* Return 0 on success, or EAGAIN if the ring is full */
+int thr_ring_push(thr_ring_t *ring, void *data);
+
+/* Return the oldest element, or NULL if the ring is empty */
+void *thr_ring_pop(thr_ring_t *ring);
+
+/*
+ * Return nonzero if no published element is waiting at the head.
+ * This is only a hint when other threads use the ring concurrently.
+ */
+int thr_ring_empty(thr_ring_t *ring);
+
+#endif  /* _THRPOOL_RING_H */
@@ -0,0 +1,60 @@
+#include "thrpool_scale.h"
+
+/* Relative throughput change telling a gain from noise */
+#define HILL_GAIN 0.05
+/* Decisions to wait after a worker did not pay off */
+#define HILL_HOLD 4
+
+void thr_hill_init(thr_hill_t *hill, unsigned long long wait_ns,
+                   int shrink_after)
+{
+    hill->wait_ns = wait_ns;
+    hill->shrink_after = shrink_after > 0 ? shrink_after : 1;
+    hill->quiet = 0;
+    hill->hold = 0;
+    hill->last_move = 0;
+    hill->last_rate = 0;
+}
+
+int thr_hill_decide(void *ctx, const thr_scale_sample_t *sample)
+{
+    thr_hill_t *hill = (thr_hill_t *) ctx;
+    int target = sample->target;
+    double rate = sample->interval_ns == 0 ? 0 :
+                  (double) sample->completed * 1e9 / sample->interval_ns;
+    int move = 0;
+
+    if (sample->depth > 0 && sample->completed == 0) {
+        /* Starving: the workers may all be blocked */
+        hill->quiet = 0;
+        hill->hold = 0;
+        move = 1;
+    } else if (sample->depth > 0 && sample->wait_ns >= hill->wait_ns) {
+        hill->quiet = 0;
+        if (hill->hold > 0) {
+            hill->hold--;
+        } else if (hill->last_move > 0 &&
+                   rate < hill->last_rate * (1 - HILL_GAIN)) {
+            /* The last worker made things worse */
+            move = -1;
+            hill->hold = HILL_HOLD;
+        } else if (hill->last_move > 0 &&
+                   rate < hill->last_rate * (1 + HILL_GAIN)) {
+            /* Plateau */
+            hill->hold = HILL_HOLD;
+        } else if (sample->nthreads >= target) {
+            move = 1;
+        }
+    } else if (sample->depth == 0 && sample->idle > 0) {
+        if (++hill->quiet >= hill->shrink_after) {
+            hill->quiet = 0;
+            move = -1;
+        }
+    } else {
+        hill->quiet = 0;
+    }
+
+    hill->last_move = move;
+    hill->last_rate = rate;
+    return target + move;
+}
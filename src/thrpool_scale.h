@@ -0,0 +1,33 @@
+/*
+ * The default scaling policy of a pool: hill climbing.
+ *
+ * While jobs wait longer than the target queue wait, add one worker per
+ * decision and keep climbing as long as every new worker raises the
+ * throughput by a few percent. When it does not, hold the size for a few
+ * decisions, and step back if the throughput dropped, before probing
+ * again (the thread injection of the .NET thread pool works the same way).
+ * Jobs waiting while none completes may all be blocked: add a worker right
+ * away. The target only goes down after scale_shrink_after decisions in a
+ * row without queued jobs and with idle workers.
+ */
+#ifndef _THRPOOL_SCALE_H
+#define _THRPOOL_SCALE_H
+
+#include "thrpool.h"
+
+typedef struct thr_hill {
+    unsigned long long wait_ns; /* queue wait above which we grow */
+    int shrink_after;           /* quiet decisions before shrinking */
+    int quiet;                  /* quiet decisions in a row */
+    int hold;                   /* decisions left before climbing again */
+    int last_move;              /* +1, -1 or 0: the previous decision */
+    double last_rate;           /* jobs per second before that move */
+} thr_hill_t;
+
+void thr_hill_init(thr_hill_t *hill, unsigned long long wait_ns,
+                   int shrink_after);
+
+/* A thr_scale_policy_t decide() function, ctx is a thr_hill_t */
+int thr_hill_decide(void *ctx, const thr_scale_sample_t *sample);
+
+#endif  /* _THRPOOL_SCALE_H */
@@ -0,0 +1,245 @@
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "thrpool_slab.h"
+#include "thrpool_atomic.h"
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+
+#define ROUND_UP(x, a) (((x) + (a) - 1) / (a) * (a))
+
+/* Free nodes are linked through their first word */
+#define NODE_NEXT(node) (*(void **)(node))
+
+static thr_slab_block_t *slab_of(void *node)
+{
+    return (thr_slab_block_t *)((uintptr_t)node & ~(uintptr_t)(THR_SLAB_SIZE - 1));
+}
+
+static void partial_link(thr_slab_t *a, thr_slab_block_t *slab)
+{
+    slab->prev = NULL;
+    slab->next = a->partial;
+    if (a->partial != NULL) a->partial->prev = slab;
+    a->partial = slab;
+    slab->partial = 1;
+}
+
+static void partial_unlink(thr_slab_t *a, thr_slab_block_t *slab)
+{
+    if (slab->prev != NULL)
+        slab->prev->next = slab->next;
+    else
+        a->partial = slab->next;
+    if (slab->next != NULL) slab->next->prev = slab->prev;
+    slab->partial = 0;
+}
+
+static void slab_release(thr_slab_t *a, thr_slab_block_t *slab)
+{
+    if (slab->partial) partial_unlink(a, slab);
+    if (slab->all_prev != NULL)
+        slab->all_prev->all_next = slab->all_next;
+    else
+        a->all = slab->all_next;
+    if (slab->all_next != NULL) slab->all_next->all_prev = slab->all_prev;
+    a->nfree -= slab->nfree;
+    a->nslabs--;
+    free(slab);
+}
+
+/*
+ * Carve a new slab, all its nodes go to the depot.
+ * Only call this function when acquire a->lock
+ */
+static int slab_grow(thr_slab_t *a)
+{
+    void *mem;
+    if (posix_memalign(&mem, THR_SLAB_SIZE, THR_SLAB_SIZE)) return ENOMEM;
+
+    thr_slab_block_t *slab = (thr_slab_block_t *) mem;
+    slab->free = NULL;
+    char *node = (char *)mem + a->offset;
+    for (int i = 0; i < a->per_slab; i++, node += a->node_size) {
+        NODE_NEXT(node) = slab->free;
+        slab->free = node;
+    }
+    slab->nfree = a->per_slab;
+
+    slab->all_prev = NULL;
+    slab->all_next = a->all;
+    if (a->all != NULL) a->all->all_prev = slab;
+    a->all = slab;
+    partial_link(a, slab);
+
+    a->nfree += a->per_slab;
+    a->nslabs++;
+    return 0;
+}
+
+/* Only call this function when acquire a->lock */
+static void *depot_get(thr_slab_t *a)
+{
+    if (a->partial == NULL && slab_grow(a)) return NULL;
+
+    thr_slab_block_t *slab = a->partial;
+    void *node = slab->free;
+    slab->free = NODE_NEXT(node);
+    if (--slab->nfree == 0) partial_unlink(a, slab);
+    a->nfree--;
+    return node;
+}
+
+/* Only call this function when acquire a->lock */
+static void depot_put(thr_slab_t *a, void *node)
+{
+    thr_slab_block_t *slab = slab_of(node);
+    NODE_NEXT(node) = slab->free;
+    slab->free = node;
+    if (slab->nfree++ == 0) partial_link(a, slab);
+    a->nfree++;
+
+    /* Give the memory of a burst back */
+    if (slab->nfree == a->per_slab && a->nfree > a->high_water)
+        slab_release(a, slab);
+}
+
+int thr_slab_init(thr_slab_t *a, size_t node_size,
+                  int cache_max, size_t high_water)
+{
+    if (a == NULL || node_size == 0) return EINVAL;
+
+    node_size = ROUND_UP(node_size < sizeof(void *) ? sizeof(void *) : node_size,
+                         sizeof(void *) * 2);
+    size_t offset = ROUND_UP(sizeof(thr_slab_block_t), THR_CACHE_LINE);
+    if (offset + node_size > THR_SLAB_SIZE) return EINVAL;
+
+    int err = pthread_mutex_init(&a->lock, NULL);
+    if (err) return err;
+    a->partial = NULL;
+    a->all = NULL;
+    a->node_size = node_size;
+    a->offset = offset;
+    a->per_slab = (int)((THR_SLAB_SIZE - offset) / node_size);
+    a->cache_max = cache_max < 0 ? 0 : cache_max;
+    a->nfree = 0;
+    a->high_water = high_water;
+    a->nslabs = 0;
+    return 0;
+}
+
+void thr_slab_destroy(thr_slab_t *a)
+{
+    if (a == NULL) return;
+    while (a->all != NULL) {
+        thr_slab_block_t *slab = a->all;
+        a->all = slab->all_next;
+        free(slab);
+    }
+    a->partial = NULL;
+    a->nfree = 0;
+    a->nslabs = 0;
+    pthread_mutex_destroy(&a->lock);
+}
+
+void *thr_slab_alloc(thr_slab_t *a, void **cache, int *ncache)
+{
+    void *node;
+
+    if (cache != NULL && *cache != NULL) {
+        node = *cache;
+        *cache = NODE_NEXT(node);
+        --*ncache;
+        return node;
+    }
+
+    pthread_mutex_lock(&a->lock);
+    node = depot_get(a);
+    /* Refill half of the cache while we hold the lock */
+    if (node != NULL && cache != NULL) {
+        while (*ncache < a->cache_max / 2) {
+            void *extra = depot_get(a);
+            if (extra == NULL) break;
+            NODE_NEXT(extra) = *cache;
+            *cache = extra;
+            ++*ncache;
+        }
+    }
+    pthread_mutex_unlock(&a->lock);
+    return node;
+}
+
+void *thr_slab_alloc_chain(thr_slab_t *a, void **cache, int *ncache, int n)
+{
+    void *head = NULL;
+    void *node;
+    int got = 0;
+
+    while (got < n && cache != NULL && *cache != NULL) {
+        node = *cache;
+        *cache = NODE_NEXT(node);
+        --*ncache;
+        NODE_NEXT(node) = head;
+        head = node;
+        got++;
+    }
+    if (got == n) return head;
+
+    pthread_mutex_lock(&a->lock);
+    while (got < n && (node = depot_get(a)) != NULL) {
+        NODE_NEXT(node) = head;
+        head = node;
+        got++;
+    }
+    if (got < n) {
+        while (head != NULL) {
+            node = head;
+            head = NODE_NEXT(node);
+            depot_put(a, node);
+        }
+    }
+    pthread_mutex_unlock(&a->lock);
+    return head;
+}
+
+void thr_slab_free(thr_slab_t *a, void **cache, int *ncache, void *node)
+{
+    if (node == NULL) return;
+
+    if (cache != NULL) {
+        NODE_NEXT(node) = *cache;
+        *cache = node;
+        if (++*ncache <= a->cache_max) return;
+
+        /* Overflow: keep half of the cache, the rest goes to the depot */
+        pthread_mutex_lock(&a->lock);
+        while (*ncache > a->cache_max / 2) {
+            node = *cache;
+            *cache = NODE_NEXT(node);
+            --*ncache;
+            depot_put(a, node);
+        }
+        pthread_mutex_unlock(&a->lock);
+        return;
+    }
+
+    pthread_mutex_lock(&a->lock);
+    depot_put(a, node);
+    pthread_mutex_unlock(&a->lock);
+}
+
+void thr_slab_flush(thr_slab_t *a, void **cache, int *ncache)
+{
+    if (cache == NULL || *cache == NULL) return;
+
+    pthread_mutex_lock(&a->lock);
+    while (*cache != NULL) {
+        void *node = *cache;
+        *cache = NODE_NEXT(node);
+        depot_put(a, node);
+    }
+    *ncache = 0;
+    pthread_mutex_unlock(&a->lock);
+}
@@ -0,0 +1,71 @@
+/*
+ * Fixed-size node allocator used for the job nodes of a pool.
+ *
+ * Nodes are carved out of slabs, blocks of THR_SLAB_SIZE bytes aligned on
+ * their size so that the slab of a node is found by masking its address.
+ * Free nodes sit either in a small per-thread cache, which is a plain
+ * singly linked list touched without any lock, or in the depot shared by
+ * all threads. Slabs whose nodes are all back in the depot are returned to
+ * the system once the depot holds more than high_water nodes.
+ */
+#ifndef _THRPOOL_SLAB_H
+#define _THRPOOL_SLAB_H
+
+#include <pthread.h>
+#include <stddef.h>
+
+#define THR_SLAB_SIZE (16 * 1024)
+
+typedef struct thr_slab_block {
+    struct thr_slab_block *prev;    /* link in the list of partial slabs */
+    struct thr_slab_block *next;
+    struct thr_slab_block *all_prev;/* link in the list of all slabs */
+    struct thr_slab_block *all_next;
+    void *free;                     /* free nodes of the slab in the depot */
+    int nfree;                      /* number of nodes in free */
+    int partial;                    /* linked in the list of partial slabs */
+} thr_slab_block_t;
+
+typedef struct thr_slab {
+    pthread_mutex_t lock;           /* protects the depot */
+    thr_slab_block_t *partial;      /* slabs having nodes in the depot */
+    thr_slab_block_t *all;          /* every slab, to release them */
+    size_t node_size;
+    size_t offset;                  /* offset of the first node of a slab */
+    int per_slab;                   /* nodes in a slab */
+    int cache_max;                  /* nodes kept in a per-thread cache */
+    size_t nfree;                   /* nodes in the depot */
+    size_t high_water;              /* depot nodes kept around after bursts */
+    size_t nslabs;                  /* slabs currently allocated */
+} thr_slab_t;
+
+/*
+ * Initialize an allocator of node_size bytes nodes.
+ * Return 0 on success; otherwise return an error number.
+ */
+int thr_slab_init(thr_slab_t *a, size_t node_size,
+                  int cache_max, size_t high_water);
+
+/* Release every slab, whether its nodes were freed or not */
+void thr_slab_destroy(thr_slab_t *a);
+
+/*
+ * Allocate a node, from the per-thread cache (*cache, *ncache) when given.
+ * cache may be NULL for threads that do not own a cache.
+ */
+void *thr_slab_alloc(thr_slab_t *a, void **cache, int *ncache);
+
+/*
+ * Allocate n nodes at once, taking the depot lock at most once.
+ * The nodes are linked through their first word, the last one links to
+ * NULL. Return NULL, and allocate nothing, if n nodes are not available.
+ */
+void *thr_slab_alloc_chain(thr_slab_t *a, void **cache, int *ncache, int n);
+
+/* Give back a node, to the per-thread cache when given */
+void thr_slab_free(thr_slab_t *a, void **cache, int *ncache, void *node);
+
+/* Move all the nodes of a per-thread cache back to the depot */
+void thr_slab_flush(thr_slab_t *a, void **cache, int *ncache);
+
+#endif  /* _THRPOOL_SLAB_H */
@@ -0,0 +1,199 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include "thrpool_topo.h"
+#include "thrpool.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+
+#define SYSFS_CPU "/sys/devices/system/cpu"
+#define SYSFS_NODE "/sys/devices/system/node"
+
+/* Read a single integer from a sysfs file, or return dflt */
+static int read_int(const char *path, int dflt)
+{
+    FILE *f = fopen(path, "r");
+    if (f == NULL) return dflt;
+    int value;
+    if (fscanf(f, "%d", &value) != 1) value = dflt;
+    fclose(f);
+    return value;
+}
+
+/* Parse a cpulist file such as "0-3,8-11" into set */
+static int read_cpulist(const char *path, cpu_set_t *set)
+{
+    FILE *f = fopen(path, "r");
+    if (f == NULL) return ENOENT;
+
+    CPU_ZERO(set);
+    int first, last;
+    while (fscanf(f, "%d", &first) == 1) {
+        last = first;
+        int c = fgetc(f);
+        if (c == '-') {
+            if (fscanf(f, "%d", &last) != 1) break;
+            c = fgetc(f);
+        }
+        for (int cpu = first; cpu <= last && cpu < CPU_SETSIZE; cpu++)
+            CPU_SET(cpu, set);
+        if (c != ',') break;
+    }
+    fclose(f);
+    return 0;
+}
+
+/* Sort keys of the compact and scatter orders */
+typedef struct cpu_key {
+    int node;
+    int package;
+    int core_id;
+    int cpu;
+    int smt;            /* the rank of the CPU in its core */
+    int node_core;      /* the rank of its core in its node */
+    int node_rank;
+    int index;          /* the rank of the CPU in compact order */
+} cpu_key_t;
+
+static int compare_compact(const void *a, const void *b)
+{
+    const cpu_key_t *x = (const cpu_key_t *) a;
+    const cpu_key_t *y = (const cpu_key_t *) b;
+    if (x->node != y->node) return x->node < y->node ? -1 : 1;
+    if (x->package != y->package) return x->package < y->package ? -1 : 1;
+    if (x->core_id != y->core_id) return x->core_id < y->core_id ? -1 : 1;
+    return x->cpu < y->cpu ? -1 : x->cpu > y->cpu;
+}
+
+/*
+ * Scatter order: the first thread of the first core of every node,
+ * then of their second cores, and so on; the other threads of the cores
+ * come last.
+ */
+static int compare_scatter(const void *a, const void *b)
+{
+    const cpu_key_t *x = (const cpu_key_t *) a;
+    const cpu_key_t *y = (const cpu_key_t *) b;
+    if (x->smt != y->smt) return x->smt < y->smt ? -1 : 1;
+    if (x->node_core != y->node_core)
+        return x->node_core < y->node_core ? -1 : 1;
+    return x->node_rank < y->node_rank ? -1 : x->node_rank > y->node_rank;
+}
+
+int thr_topo_load(thr_topo_t *topo)
+{
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) return errno;
+
+    int ncpus = CPU_COUNT(&allowed);
+    if (ncpus == 0) return ENOENT;
+
+    cpu_key_t *keys = (cpu_key_t *) malloc(ncpus * sizeof(cpu_key_t));
+    topo->cpus = (thr_cpu_t *) malloc(ncpus * sizeof(thr_cpu_t));
+    topo->scatter = (int *) malloc(ncpus * sizeof(int));
+    if (!keys || !topo->cpus || !topo->scatter) {
+        free(keys);
+        thr_topo_destroy(topo);
+        return ENOMEM;
+    }
+
+    /* Machines without NUMA have no node directory: everything on node 0 */
+    char path[128];
+    int n = 0;
+    for (int cpu = 0; cpu < CPU_SETSIZE && n < ncpus; cpu++) {
+        if (!CPU_ISSET(cpu, &allowed)) continue;
+        keys[n].cpu = cpu;
+        snprintf(path, sizeof(path),
+                 SYSFS_CPU "/cpu%d/topology/physical_package_id", cpu);
+        keys[n].package = read_int(path, 0);
+        snprintf(path, sizeof(path), SYSFS_CPU "/cpu%d/topology/core_id", cpu);
+        keys[n].core_id = read_int(path, cpu);
+        keys[n].node = 0;
+        n++;
+    }
+    cpu_set_t nodes, set;
+    if (read_cpulist(SYSFS_NODE "/online", &nodes) != 0) CPU_ZERO(&nodes);
+    for (int node = 0; node < CPU_SETSIZE; node++) {
+        if (!CPU_ISSET(node, &nodes)) continue;
+        snprintf(path, sizeof(path), SYSFS_NODE "/node%d/cpulist", node);
+        if (read_cpulist(path, &set) != 0) continue;
+        for (int i = 0; i < ncpus; i++) {
+            if (CPU_ISSET(keys[i].cpu, &set)) keys[i].node = node;
+        }
+    }
+    qsort(keys, ncpus, sizeof(cpu_key_t), compare_compact);
+
+    /* Rank cores and nodes, and the threads of each core */
+    topo->ncpus = ncpus;
+    topo->ncores = 0;
+    topo->nnodes = 0;
+    for (int i = 0; i < ncpus; i++) {
+        int new_node = i == 0 || keys[i].node != keys[i - 1].node;
+        int new_core = new_node || keys[i].package != keys[i - 1].package ||
+                       keys[i].core_id != keys[i - 1].core_id;
+        if (new_node) topo->nnodes++;
+        if (new_core) topo->ncores++;
+        keys[i].smt = new_core ? 0 : keys[i - 1].smt + 1;
+        keys[i].node_core = new_node ? 0 : keys[i - 1].node_core + new_core;
+        keys[i].node_rank = topo->nnodes - 1;
+        keys[i].index = i;
+        topo->cpus[i].cpu = keys[i].cpu;
+        topo->cpus[i].core = topo->ncores - 1;
+        topo->cpus[i].node = keys[i].node;
+        topo->cpus[i].node_rank = topo->nnodes - 1;
+    }
+
+    qsort(keys, ncpus, sizeof(cpu_key_t), compare_scatter);
+    for (int i = 0; i < ncpus; i++)
+        topo->scatter[i] = keys[i].index;
+
+    free(keys);
+    return 0;
+}
+
+void thr_topo_destroy(thr_topo_t *topo)
+{
+    if (topo == NULL) return;
+    free(topo->cpus);
+    free(topo->scatter);
+    topo->cpus = NULL;
+    topo->scatter = NULL;
+}
+
+void thr_topo_place(const thr_topo_t *topo, int policy, int index,
+                    cpu_set_t *set, int *node)
+{
+    const thr_cpu_t *cpu;
+
+    CPU_ZERO(set);
+    switch (policy) {
+    case THR_PLACE_COMPACT:
+        cpu = &topo->cpus[index % topo->ncpus];
+        CPU_SET(cpu->cpu, set);
+        *node = cpu->node;
+        break;
+    case THR_PLACE_SCATTER:
+        cpu = &topo->cpus[topo->scatter[index % topo->ncpus]];
+        CPU_SET(cpu->cpu, set);
+        *node = cpu->node;
+        break;
+    case THR_PLACE_CORE:
+        for (int i = 0; i < topo->ncpus; i++) {
+            cpu = &topo->cpus[i];
+            if (cpu->core != index % topo->ncores) continue;
+            CPU_SET(cpu->cpu, set);
+            *node = cpu->node;
+        }
+        break;
+    case THR_PLACE_NODE:
+        for (int i = 0; i < topo->ncpus; i++) {
+            cpu = &topo->cpus[i];
+            if (cpu->node_rank != index % topo->nnodes) continue;
+            CPU_SET(cpu->cpu, set);
+            *node = cpu->node;
+        }
+        break;
+    }
+}
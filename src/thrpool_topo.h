@@ -0,0 +1,49 @@
+/*
+ * CPU topology of the machine, as read from sysfs, and the placement of
+ * worker threads on it.
+ *
+ * Only the CPUs the calling thread may run on are considered, in
+ * "compact" order: by NUMA node, package, core, then CPU number, so that
+ * the hardware threads of a core are neighbours.
+ */
+#ifndef _THRPOOL_TOPO_H
+#define _THRPOOL_TOPO_H
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <sched.h>
+
+typedef struct thr_cpu {
+    int cpu;            /* the CPU number */
+    int core;           /* the rank of its core, in compact order */
+    int node;           /* its NUMA node */
+    int node_rank;      /* the rank of that node */
+} thr_cpu_t;
+
+typedef struct thr_topo {
+    thr_cpu_t *cpus;    /* in compact order */
+    int *scatter;       /* indexes in cpus, spreading over nodes and cores */
+    int ncpus;
+    int ncores;
+    int nnodes;
+} thr_topo_t;
+
+/*
+ * Read the topology of the CPUs available to the calling thread.
+ * Return 0 on success; otherwise return an error number.
+ */
+int thr_topo_load(thr_topo_t *topo);
+
+void thr_topo_destroy(thr_topo_t *topo);
+
+/*
+ * Compute the CPUs the index-th worker may run on under a placement
+ * policy, THR_PLACE_* of thrpool.h, and the NUMA node it runs on.
+ * Workers beyond the number of CPUs, cores or nodes wrap around.
+ */
+void thr_topo_place(const thr_topo_t *topo, int policy, int index,
+                    cpu_set_t *set, int *node);
+
+#endif  /* _THRPOOL_TOPO_H */
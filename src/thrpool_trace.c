@@ -0,0 +1,120 @@
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "thrpool_trace.h"
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+
+int thr_trace_init(thr_trace_t *trace, size_t capacity)
+{
+    if (trace == NULL || capacity == 0) return EINVAL;
+
+    size_t size = 2;
+    while (size < capacity) {
+        if (size > SIZE_MAX / 2 / sizeof(thr_trace_event_t)) return EINVAL;
+        size <<= 1;
+    }
+
+    trace->events = (thr_trace_event_t *)
+                    calloc(size, sizeof(thr_trace_event_t));
+    if (trace->events == NULL) return ENOMEM;
+    trace->mask = size - 1;
+    trace->head = 0;
+    return 0;
+}
+
+void thr_trace_destroy(thr_trace_t *trace)
+{
+    if (trace == NULL) return;
+    free(trace->events);
+    trace->events = NULL;
+}
+
+void thr_trace_push(thr_trace_t *trace, int shared, int type, void *arg,
+                    unsigned long long ts)
+{
+    size_t i;
+    if (shared) {
+        i = __atomic_fetch_add(&trace->head, 1, __ATOMIC_RELAXED);
+    } else {
+        i = trace->head;
+        __atomic_store_n(&trace->head, i + 1, __ATOMIC_RELAXED);
+    }
+
+    /* A seqlock of one slot: invalidate, write, publish */
+    thr_trace_event_t *ev = &trace->events[i & trace->mask];
+    __atomic_store_n(&ev->seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&ev->ts, ts, __ATOMIC_RELAXED);
+    __atomic_store_n(&ev->arg, arg, __ATOMIC_RELAXED);
+    __atomic_store_n(&ev->type, type, __ATOMIC_RELAXED);
+    __atomic_store_n(&ev->seq, i + 1, __ATOMIC_RELEASE);
+}
+
+/* Copy event i if it is still in the ring and fully written */
+static int read_event(thr_trace_t *trace, size_t i, thr_trace_event_t *copy)
+{
+    thr_trace_event_t *ev = &trace->events[i & trace->mask];
+    size_t seq = __atomic_load_n(&ev->seq, __ATOMIC_ACQUIRE);
+    if (seq != i + 1) return 0;
+
+    copy->ts = __atomic_load_n(&ev->ts, __ATOMIC_RELAXED);
+    copy->arg = __atomic_load_n(&ev->arg, __ATOMIC_RELAXED);
+    copy->type = __atomic_load_n(&ev->type, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&ev->seq, __ATOMIC_RELAXED) == seq;
+}
+
+static void write_event(FILE *out, int tid, const thr_trace_event_t *ev,
+                        unsigned long long origin, int *first)
+{
+    static const char *const names[] = {
+        "enqueue", "job", "job", "spawn", "parked", "parked", "retire"
+    };
+    static const char phases[] = {'i', 'B', 'E', 'i', 'B', 'E', 'i'};
+
+    if (ev->type < 0 || ev->type > THR_TRACE_RETIRE) return;
+
+    double ts = ev->ts > origin ? (ev->ts - origin) / 1000.0 : 0.0;
+    fprintf(out, "%s\n{\"name\":\"%s\",\"ph\":\"%c\",\"pid\":1,\"tid\":%d,"
+            "\"ts\":%.3f", *first ? "" : ",", names[ev->type],
+            phases[ev->type], tid, ts);
+    if (phases[ev->type] == 'i')
+        fprintf(out, ",\"s\":\"t\"");
+    if (ev->type == THR_TRACE_SPAWN)
+        fprintf(out, ",\"args\":{\"worker\":%lu}", (unsigned long) ev->arg);
+    else if (ev->type != THR_TRACE_PARK && ev->type != THR_TRACE_WAKE &&
+             ev->type != THR_TRACE_RETIRE)
+        fprintf(out, ",\"args\":{\"job\":\"%p\"}", ev->arg);
+    fprintf(out, "}");
+    *first = 0;
+}
+
+int thr_trace_write(thr_trace_t *traces, int n, const char *const *names,
+                    unsigned long long origin, FILE *out)
+{
+    if (traces == NULL || out == NULL) return EINVAL;
+
+    int first = 1;
+    fprintf(out, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+    for (int t = 0; t < n; t++) {
+        thr_trace_t *trace = &traces[t];
+        fprintf(out, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+                "\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+                first ? "" : ",", t, names[t]);
+        first = 0;
+
+        size_t head = __atomic_load_n(&trace->head, __ATOMIC_ACQUIRE);
+        size_t size = trace->mask + 1;
+        size_t i = head > size ? head - size : 0;
+        for (; i < head; i++) {
+            thr_trace_event_t ev;
+            if (read_event(trace, i, &ev))
+                write_event(out, t, &ev, origin, &first);
+        }
+    }
+    fprintf(out, "\n]}\n");
+    return ferror(out) ? EIO : 0;
+}
@@ -0,0 +1,64 @@
+/*
+ * Event tracing into ring buffers, exported as Chrome trace-event JSON
+ * (chrome://tracing, ui.perfetto.dev).
+ *
+ * Each worker records into its own ring; threads outside of the pool
+ * share one more ring. When a ring is full the oldest events are
+ * overwritten. Every slot carries the sequence number of its event, so
+ * a dump running concurrently with the writers skips the slots being
+ * rewritten instead of reporting torn events.
+ */
+#ifndef _THRPOOL_TRACE_H
+#define _THRPOOL_TRACE_H
+
+#include <stddef.h>
+#include <stdio.h>
+#include "thrpool_atomic.h"
+
+/* Event types */
+#define THR_TRACE_ENQUEUE 0     /* a job was added, arg is the job */
+#define THR_TRACE_START 1       /* a worker started a job */
+#define THR_TRACE_END 2         /* the job returned */
+#define THR_TRACE_SPAWN 3       /* a worker was created, arg is its index */
+#define THR_TRACE_PARK 4        /* a worker went to sleep */
+#define THR_TRACE_WAKE 5        /* the worker woke up */
+#define THR_TRACE_RETIRE 6      /* a worker exited after idling */
+
+typedef struct thr_trace_event {
+    size_t seq;                 /* 1 + index of the event, 0 while written */
+    unsigned long long ts;      /* CLOCK_MONOTONIC nanoseconds */
+    void *arg;
+    int type;
+} thr_trace_event_t;
+
+typedef struct thr_trace {
+    thr_trace_event_t *events;
+    size_t mask;
+    size_t head THR_CACHE_ALIGNED;  /* index of the next event */
+} thr_trace_t;
+
+/*
+ * Allocate a ring of capacity events, rounded up to a power of two.
+ * Return 0 on success; otherwise return an error number.
+ */
+int thr_trace_init(thr_trace_t *trace, size_t capacity);
+
+void thr_trace_destroy(thr_trace_t *trace);
+
+/*
+ * Record an event. shared is nonzero if several threads may record into
+ * the ring at the same time.
+ */
+void thr_trace_push(thr_trace_t *trace, int shared, int type, void *arg,
+                    unsigned long long ts);
+
+/*
+ * Write the events of n rings as a Chrome trace-event JSON object.
+ * Ring i is shown as thread i, named after names[i]; timestamps are
+ * relative to origin.
+ * Return 0 on success; otherwise return an error number.
+ */
+int thr_trace_write(thr_trace_t *traces, int n, const char *const *names,
+                    unsigned long long origin, FILE *out);
+
+#endif  /* _THRPOOL_TRACE_H */
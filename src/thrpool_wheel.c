@@ -0,0 +1,152 @@
+#include "thrpool_wheel.h"
+
+#define WHEEL_MASK (THR_WHEEL_SLOTS - 1)
+
+void thr_wheel_init(thr_wheel_t *wheel, unsigned long long now)
+{
+    wheel->now = now;
+    wheel->count = 0;
+    for (int l = 0; l < THR_WHEEL_LEVELS; l++)
+        wheel->occupied[l] = 0;
+    for (int i = 0; i < THR_WHEEL_LEVELS * THR_WHEEL_SLOTS; i++) {
+        wheel->slots[i].next = &wheel->slots[i];
+        wheel->slots[i].prev = &wheel->slots[i];
+        wheel->slots[i].slot = i;
+    }
+}
+
+void thr_wheel_add(thr_wheel_t *wheel, thr_wheel_node_t *node)
+{
+    if (node->expires < wheel->now)
+        node->expires = wheel->now;
+    unsigned long long delta = node->expires - wheel->now;
+    if (delta > THR_WHEEL_MAX_DELTA) {
+        delta = THR_WHEEL_MAX_DELTA;
+        node->expires = wheel->now + delta;
+    }
+
+    /* The lowest level whose range covers the delta */
+    int level = 0;
+    while (delta >> (THR_WHEEL_BITS * (level + 1)))
+        level++;
+    int index = (int) (node->expires >> (THR_WHEEL_BITS * level)) &
+                WHEEL_MASK;
+
+    thr_wheel_node_t *head = &wheel->slots[level * THR_WHEEL_SLOTS + index];
+    node->slot = head->slot;
+    node->next = head;
+    node->prev = head->prev;
+    head->prev->next = node;
+    head->prev = node;
+    wheel->occupied[level] |= 1ULL << index;
+    wheel->count++;
+}
+
+void thr_wheel_del(thr_wheel_t *wheel, thr_wheel_node_t *node)
+{
+    node->prev->next = node->next;
+    node->next->prev = node->prev;
+
+    thr_wheel_node_t *head = &wheel->slots[node->slot];
+    if (head->next == head)
+        wheel->occupied[node->slot / THR_WHEEL_SLOTS] &=
+            ~(1ULL << (node->slot & WHEEL_MASK));
+    node->next = node->prev = NULL;
+    node->slot = -1;
+    wheel->count--;
+}
+
+/* Unlink all the timers of a slot, return them as a NULL terminated list */
+static thr_wheel_node_t *take_slot(thr_wheel_t *wheel, int level, int index)
+{
+    thr_wheel_node_t *head = &wheel->slots[level * THR_WHEEL_SLOTS + index];
+    if (head->next == head) return NULL;
+
+    thr_wheel_node_t *first = head->next;
+    head->prev->next = NULL;
+    head->next = head->prev = head;
+    wheel->occupied[level] &= ~(1ULL << index);
+
+    for (thr_wheel_node_t *node = first; node != NULL; node = node->next) {
+        node->slot = -1;
+        wheel->count--;
+    }
+    return first;
+}
+
+thr_wheel_node_t *thr_wheel_advance(thr_wheel_t *wheel,
+                                    unsigned long long upto)
+{
+    thr_wheel_node_t *expired = NULL;
+
+    while (wheel->now <= upto) {
+        /*
+         * Nothing happens before the next boundary of the lowest level
+         * holding timers, jump there.
+         */
+        int lowest = 0;
+        while (lowest < THR_WHEEL_LEVELS && wheel->occupied[lowest] == 0)
+            lowest++;
+        if (lowest == THR_WHEEL_LEVELS) {
+            wheel->now = upto + 1;
+            break;
+        }
+        if (lowest > 0) {
+            unsigned long long step = 1ULL << (THR_WHEEL_BITS * lowest);
+            unsigned long long next = (wheel->now + step - 1) & ~(step - 1);
+            if (next > upto) {
+                wheel->now = upto + 1;
+                break;
+            }
+            wheel->now = next;
+        }
+
+        /* Cascade the slots whose boundary we are crossing */
+        for (int l = 1; l < THR_WHEEL_LEVELS; l++) {
+            int shift = THR_WHEEL_BITS * l;
+            if (wheel->now & ((1ULL << shift) - 1)) break;
+
+            thr_wheel_node_t *node = take_slot(wheel, l,
+                (int) (wheel->now >> shift) & WHEEL_MASK);
+            while (node != NULL) {
+                thr_wheel_node_t *next = node->next;
+                thr_wheel_add(wheel, node);
+                node = next;
+            }
+        }
+
+        thr_wheel_node_t *node = take_slot(wheel, 0,
+                                           (int) wheel->now & WHEEL_MASK);
+        while (node != NULL) {
+            thr_wheel_node_t *next = node->next;
+            node->next = expired;
+            expired = node;
+            node = next;
+        }
+        wheel->now++;
+    }
+    return expired;
+}
+
+unsigned long long thr_wheel_next(const thr_wheel_t *wheel)
+{
+    unsigned long long best = ~0ULL;
+
+    for (int l = 0; l < THR_WHEEL_LEVELS; l++) {
+        unsigned long long occupied = wheel->occupied[l];
+        if (occupied == 0) continue;
+
+        /* The slots of level l are processed at multiples of 64^l */
+        int shift = THR_WHEEL_BITS * l;
+        unsigned long long first = wheel->now >> shift;
+        if (wheel->now & ((1ULL << shift) - 1)) first++;
+
+        int start = (int) first & WHEEL_MASK;
+        if (start != 0)
+            occupied = (occupied >> start) |
+                       (occupied << (THR_WHEEL_SLOTS - start));
+        unsigned long long tick = (first + __builtin_ctzll(occupied)) << shift;
+        if (tick < best) best = tick;
+    }
+    return best;
+}
@@ -0,0 +1,67 @@
+/*
+ * Hierarchical timer wheel.
+ *
+ * THR_WHEEL_LEVELS wheels of THR_WHEEL_SLOTS slots each: a timer due in
+ * less than 64^(l+1) ticks sits in a slot of level l, chosen by the bits
+ * of its expiry tick for that level. When the current tick crosses the
+ * boundary of a slot of a higher level, the timers of that slot cascade
+ * down to the levels below, so adding and removing a timer are O(1) and
+ * every timer moves at most THR_WHEEL_LEVELS - 1 times before it fires
+ * (G. Varghese and T. Lauck, "Hashed and hierarchical timing wheels").
+ * Ticks are abstract; the wheel does no locking and never allocates.
+ */
+#ifndef _THRPOOL_WHEEL_H
+#define _THRPOOL_WHEEL_H
+
+#include <stddef.h>
+
+#define THR_WHEEL_BITS 6
+#define THR_WHEEL_SLOTS (1 << THR_WHEEL_BITS)
+#define THR_WHEEL_LEVELS 6
+
+/* Timers further than that are clamped to it */
+#define THR_WHEEL_MAX_DELTA \
+    ((1ULL << (THR_WHEEL_BITS * THR_WHEEL_LEVELS)) - 1)
+
+typedef struct thr_wheel_node {
+    struct thr_wheel_node *next;    /* links in a slot, or in the list
+                                       returned by thr_wheel_advance() */
+    struct thr_wheel_node *prev;
+    unsigned long long expires;     /* tick the timer fires at */
+    int slot;                       /* level * THR_WHEEL_SLOTS + index */
+} thr_wheel_node_t;
+
+typedef struct thr_wheel {
+    unsigned long long now;         /* next tick to process */
+    size_t count;                   /* timers in the wheel */
+    unsigned long long occupied[THR_WHEEL_LEVELS];  /* non empty slots */
+    thr_wheel_node_t slots[THR_WHEEL_LEVELS * THR_WHEEL_SLOTS];
+                                    /* heads of circular lists */
+} thr_wheel_t;
+
+/* Initialize an empty wheel whose next tick to process is now */
+void thr_wheel_init(thr_wheel_t *wheel, unsigned long long now);
+
+/*
+ * Insert a timer expiring at node->expires. Timers of past ticks fire at
+ * the next tick processed.
+ */
+void thr_wheel_add(thr_wheel_t *wheel, thr_wheel_node_t *node);
+
+/* Remove a timer still in the wheel */
+void thr_wheel_del(thr_wheel_t *wheel, thr_wheel_node_t *node);
+
+/*
+ * Process every tick up to and including upto. Return the timers that
+ * expired, linked through node->next, in no particular order.
+ */
+thr_wheel_node_t *thr_wheel_advance(thr_wheel_t *wheel,
+                                    unsigned long long upto);
+
+/*
+ * Return the next tick thr_wheel_advance() has work to do at: the earliest
+ * expiry, or an earlier cascade. Return ~0ULL if the wheel is empty.
+ */
+unsigned long long thr_wheel_next(const thr_wheel_t *wheel);
+
+#endif  /* _THRPOOL_WHEEL_H */
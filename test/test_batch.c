@@ -0,0 +1,94 @@
+#include "../src/thrpool.h"
+#include "../src/thrpool_assert.h"
+#include <stdlib.h>
+#include <errno.h>
+
+#define NUM_JOBS 1000
+
+thr_pool_t pool;
+long sum = 0;
+long values[NUM_JOBS];
+void *args[NUM_JOBS];
+thr_job_desc_t jobs[NUM_JOBS];
+
+void *add_func(void *arg)
+{
+    __atomic_add_fetch(&sum, *(long *)arg, __ATOMIC_RELAXED);
+    return NULL;
+}
+
+/* fan out a batch from inside a worker */
+void *fanout_task(void *arg)
+{
+    int err = thr_pool_add_batch_args(&pool, add_func, args, NUM_JOBS);
+    ASSERT_EQ_INT(err, 0);
+    return NULL;
+}
+
+void test_batch(int queue_mode);
+
+int main(void)
+{
+    for (int i = 0; i < NUM_JOBS; i++) {
+        values[i] = i + 1;
+        args[i] = &values[i];
+        jobs[i].func = add_func;
+        jobs[i].arg = &values[i];
+    }
+    test_batch(THR_QUEUE_LIST);
+    test_batch(THR_QUEUE_RING);
+    return 0;
+}
+
+void test_batch(int queue_mode)
+{
+    const long expected = (long)NUM_JOBS * (NUM_JOBS + 1) / 2;
+    thr_pool_options_t opts;
+    thr_pool_options_init(&opts);
+    opts.min_threads = 1;
+    opts.max_threads = 4;
+    opts.queue_mode = queue_mode;
+    opts.queue_capacity = 64;
+    opts.deque_capacity = 128;
+
+    int err = thr_pool_create_ex(&pool, &opts);
+    if (err) {
+        fprintf(stderr, "thr_pool_create_ex() failed!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    /* invalid batches queue nothing */
+    jobs[NUM_JOBS - 1].func = NULL;
+    err = thr_pool_add_batch(&pool, jobs, NUM_JOBS);
+    ASSERT_EQ_INT(err, EINVAL);
+    jobs[NUM_JOBS - 1].func = add_func;
+    ASSERT_EQ_INT(pool.nthreads, 0);
+    ASSERT_IS_NULL(pool.job_head);
+
+    sum = 0;
+    err = thr_pool_add_batch(&pool, jobs, NUM_JOBS);
+    ASSERT_EQ_INT(err, 0);
+    pthread_mutex_lock(&pool.mutex);
+    ASSERT_LE_INT(pool.nthreads, opts.max_threads);
+    pthread_mutex_unlock(&pool.mutex);
+    thr_pool_wait(&pool);
+    ASSERT_EQ_INT((int)sum, (int)expected);
+
+    sum = 0;
+    err = thr_pool_add_batch_args(&pool, add_func, args, NUM_JOBS);
+    ASSERT_EQ_INT(err, 0);
+    thr_pool_wait(&pool);
+    ASSERT_EQ_INT((int)sum, (int)expected);
+
+    sum = 0;
+    thr_pool_add(&pool, fanout_task, NULL);
+    thr_pool_wait(&pool);
+    ASSERT_EQ_INT((int)sum, (int)expected);
+
+    pthread_mutex_lock(&pool.mutex);
+    ASSERT_EQ_INT((int)pool.pending, 0);
+    ASSERT_IS_NULL(pool.job_head);
+    pthread_mutex_unlock(&pool.mutex);
+
+    thr_pool_destroy(&pool);
+}
@@ -0,0 +1,217 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "../src/thrpool.h"
+#include "../src/thrpool_assert.h"
+#include <stdlib.h>
+#include <errno.h>
+#include <sched.h>
+#include <time.h>
+
+#define BOUND 4
+#define NCHILDREN 32
+
+thr_pool_t pool;
+int release = 0;
+int started = 0;
+int count = 0;
+
+void *count_task(void *arg)
+{
+    __atomic_add_fetch(&count, 1, __ATOMIC_RELAXED);
+    return arg;
+}
+
+void *blocking_task(void *arg)
+{
+    __atomic_store_n(&started, 1, __ATOMIC_RELEASE);
+    while (!__atomic_load_n(&release, __ATOMIC_ACQUIRE))
+        sched_yield();
+    return arg;
+}
+
+/* Workers never wait for room, whatever the bound */
+void *parent_task(void *arg)
+{
+    for (int i = 0; i < NCHILDREN; i++)
+        thr_pool_add(&pool, count_task, NULL);
+    return arg;
+}
+
+typedef struct producer {
+    pthread_t thread;
+    int njobs;
+    int err;
+    int done;
+} producer_t;
+
+void *producer_thread(void *arg)
+{
+    producer_t *p = (producer_t *) arg;
+    p->err = 0;
+    for (int i = 0; i < p->njobs && p->err == 0; i++)
+        p->err = thr_pool_add(&pool, count_task, NULL);
+    __atomic_store_n(&p->done, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+void create_bounded_pool(int queue_mode);
+void fill_queue(void);
+void wait_for_producer(void);
+void test_try_and_timed_add(int queue_mode);
+void test_blocking_add(int queue_mode);
+void test_oversized_batch(void);
+void test_worker_never_waits(void);
+void test_destroy_wakes_producers(void);
+
+int main(void)
+{
+    test_try_and_timed_add(THR_QUEUE_LIST);
+    test_try_and_timed_add(THR_QUEUE_RING);
+    test_blocking_add(THR_QUEUE_LIST);
+    test_blocking_add(THR_QUEUE_RING);
+    test_oversized_batch();
+    test_worker_never_waits();
+    test_destroy_wakes_producers();
+    return 0;
+}
+
+void create_bounded_pool(int queue_mode)
+{
+    thr_pool_options_t opts;
+    thr_pool_options_init(&opts);
+    opts.min_threads = 1;
+    opts.max_threads = 1;
+    opts.timeout = -1;
+    opts.queue_mode = queue_mode;
+    opts.max_queued = BOUND;
+    if (thr_pool_create_ex(&pool, &opts) != 0) {
+        fprintf(stderr, "thr_pool_create_ex() failed!\n");
+        exit(EXIT_FAILURE);
+    }
+    release = 0;
+    started = 0;
+    count = 0;
+}
+
+/* Keep the only worker busy, then queue BOUND jobs behind it */
+void fill_queue(void)
+{
+    int err = thr_pool_add(&pool, blocking_task, NULL);
+    ASSERT_EQ_INT(err, 0);
+    while (!__atomic_load_n(&started, __ATOMIC_ACQUIRE))
+        sched_yield();
+    for (int i = 0; i < BOUND; i++) {
+        err = thr_pool_try_add(&pool, count_task, NULL);
+        ASSERT_EQ_INT(err, 0);
+    }
+}
+
+/* Wait until some producer sleeps on the full queue */
+void wait_for_producer(void)
+{
+    while (__atomic_load_n(&pool.add_waiters, __ATOMIC_ACQUIRE) == 0)
+        sched_yield();
+}
+
+void test_try_and_timed_add(int queue_mode)
+{
+    struct timespec deadline;
+    create_bounded_pool(queue_mode);
+    fill_queue();
+
+    int err = thr_pool_try_add(&pool, count_task, NULL);
+    ASSERT_EQ_INT(err, EAGAIN);
+
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_nsec += 20000000;
+    if (deadline.tv_nsec >= 1000000000) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+    }
+    err = thr_pool_timed_add(&pool, count_task, NULL, &deadline);
+    ASSERT_EQ_INT(err, ETIMEDOUT);
+    err = thr_pool_timed_add(&pool, count_task, NULL, NULL);
+    ASSERT_EQ_INT(err, EINVAL);
+
+    /* The queue drains, there is room again */
+    __atomic_store_n(&release, 1, __ATOMIC_RELEASE);
+    thr_pool_wait(&pool);
+    ASSERT_EQ_INT(count, BOUND);
+    ASSERT_EQ_INT((int) pool.queued, 0);
+
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += 5;
+    err = thr_pool_timed_add(&pool, count_task, NULL, &deadline);
+    ASSERT_EQ_INT(err, 0);
+    err = thr_pool_try_add(&pool, count_task, NULL);
+    ASSERT_EQ_INT(err, 0);
+    thr_pool_wait(&pool);
+    ASSERT_EQ_INT(count, BOUND + 2);
+
+    thr_pool_destroy(&pool);
+}
+
+void test_blocking_add(int queue_mode)
+{
+    producer_t p = { .njobs = 3 * BOUND, .done = 0 };
+    create_bounded_pool(queue_mode);
+    fill_queue();
+
+    pthread_create(&p.thread, NULL, producer_thread, &p);
+    wait_for_producer();
+    ASSERT_EQ_INT(__atomic_load_n(&p.done, __ATOMIC_ACQUIRE), 0);
+    ASSERT_EQ_INT((int) pool.queued, BOUND);
+
+    /* The producer goes on as the worker makes room */
+    __atomic_store_n(&release, 1, __ATOMIC_RELEASE);
+    pthread_join(p.thread, NULL);
+    ASSERT_EQ_INT(p.err, 0);
+    ASSERT_LE_INT((int) pool.queued, BOUND);
+
+    thr_pool_wait(&pool);
+    ASSERT_EQ_INT(count, 4 * BOUND);
+    ASSERT_EQ_INT((int) pool.queued, 0);
+    thr_pool_destroy(&pool);
+}
+
+void test_oversized_batch(void)
+{
+    thr_job_desc_t jobs[2 * BOUND];
+    for (int i = 0; i < 2 * BOUND; i++) {
+        jobs[i].func = count_task;
+        jobs[i].arg = NULL;
+    }
+
+    /* A batch larger than the bound goes into an empty queue */
+    create_bounded_pool(THR_QUEUE_LIST);
+    int err = thr_pool_add_batch(&pool, jobs, 2 * BOUND);
+    ASSERT_EQ_INT(err, 0);
+    thr_pool_wait(&pool);
+    ASSERT_EQ_INT(count, 2 * BOUND);
+    ASSERT_EQ_INT((int) pool.queued, 0);
+    thr_pool_destroy(&pool);
+}
+
+void test_worker_never_waits(void)
+{
+    create_bounded_pool(THR_QUEUE_LIST);
+    int err = thr_pool_add(&pool, parent_task, NULL);
+    ASSERT_EQ_INT(err, 0);
+    thr_pool_wait(&pool);
+    ASSERT_EQ_INT(count, NCHILDREN);
+    ASSERT_EQ_INT((int) pool.queued, 0);
+    thr_pool_destroy(&pool);
+}
+
+void test_destroy_wakes_producers(void)
+{
+    producer_t p = { .njobs = 1, .done = 0 };
+    create_bounded_pool(THR_QUEUE_LIST);
+    fill_queue();
+
+    pthread_create(&p.thread, NULL, producer_thread, &p);
+    wait_for_producer();
+    thr_pool_destroy(&pool);
+    pthread_join(p.thread, NULL);
+    ASSERT_EQ_INT(p.err, ECANCELED);
+}
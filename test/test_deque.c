@@ -0,0 +1,64 @@
+#include "../src/thrpool.h"
+#include "../src/thrpool_assert.h"
+#include <stdlib.h>
+
+#define DEPTH 12
+
+thr_pool_t pool;
+long leaves = 0;
+
+/* Every job below DEPTH spawns two children from inside the worker */
+void *spawn_task(void *arg)
+{
+    long depth = (long)arg;
+    if (depth == DEPTH) {
+        __atomic_add_fetch(&leaves, 1, __ATOMIC_RELAXED);
+        return NULL;
+    }
+    int err = thr_pool_add(&pool, spawn_task, (void *)(depth + 1));
+    ASSERT_EQ_INT(err, 0);
+    err = thr_pool_add(&pool, spawn_task, (void *)(depth + 1));
+    ASSERT_EQ_INT(err, 0);
+    return NULL;
+}
+
+void test_recursive_spawn(int queue_mode, size_t deque_capacity);
+
+int main(void)
+{
+    test_recursive_spawn(THR_QUEUE_LIST, 256);
+    test_recursive_spawn(THR_QUEUE_RING, 256);
+    /* a tiny deque overflows on the shared queue */
+    test_recursive_spawn(THR_QUEUE_LIST, 2);
+    test_recursive_spawn(THR_QUEUE_LIST, 0);
+    return 0;
+}
+
+void test_recursive_spawn(int queue_mode, size_t deque_capacity)
+{
+    thr_pool_options_t opts;
+    thr_pool_options_init(&opts);
+    opts.min_threads = 2;
+    opts.max_threads = 4;
+    opts.queue_mode = queue_mode;
+    opts.deque_capacity = deque_capacity;
+
+    int err = thr_pool_create_ex(&pool, &opts);
+    if (err) {
+        fprintf(stderr, "thr_pool_create_ex() failed!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    leaves = 0;
+    thr_pool_add(&pool, spawn_task, (void *)0L);
+    thr_pool_wait(&pool);
+
+    pthread_mutex_lock(&pool.mutex);
+    ASSERT_EQ_INT((int)leaves, 1 << DEPTH);
+    ASSERT_EQ_INT((int)pool.pending, 0);
+    ASSERT_IS_NULL(pool.job_head);
+    pthread_mutex_unlock(&pool.mutex);
+
+    thr_pool_destroy(&pool);
+    ASSERT_EQ_INT(pool.nthreads, 0);
+}
@@ -39,7 +39,7 @@ void test_thr_pool_destroy(void)
     ASSERT_NE_INT(pool.status & THR_POOL_DESTROY, 0);
     ASSERT_EQ_INT(pool.nthreads, 0);
     ASSERT_EQ_INT(pool.idle, 0);
-    ASSERT_IS_NULL(pool.worker);
+    ASSERT_EQ_INT((int)pool.pending, 0);
     ASSERT_IS_NULL(pool.job_head);
     ASSERT_IS_NULL(pool.job_tail);
 }
@@ -0,0 +1,147 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "../src/thrpool.h"
+#include "../src/thrpool_assert.h"
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <sched.h>
+
+#define NFUTURES 1000
+
+int release = 0;
+
+void *square_task(void *arg)
+{
+    intptr_t n = (intptr_t) arg;
+    return (void *) (n * n);
+}
+
+void *blocking_task(void *arg)
+{
+    while (!__atomic_load_n(&release, __ATOMIC_ACQUIRE))
+        sched_yield();
+    return arg;
+}
+
+/* Submit futures from inside a worker, i.e. on its deque */
+void *nested_task(void *arg)
+{
+    thr_pool_t *pool = (thr_pool_t *) arg;
+    thr_future_t *futures[8];
+    intptr_t sum = 0;
+
+    for (intptr_t i = 0; i < 8; i++) {
+        int err = thr_pool_submit(pool, square_task, (void *) i, &futures[i]);
+        ASSERT_EQ_INT(err, 0);
+    }
+    for (int i = 0; i < 8; i++) {
+        void *result;
+        int err = thr_future_get(futures[i], &result);
+        ASSERT_EQ_INT(err, 0);
+        sum += (intptr_t) result;
+        thr_future_release(futures[i]);
+    }
+    return (void *) sum;
+}
+
+void test_future_get(int queue_mode);
+void test_future_timedwait(void);
+
+int main(void)
+{
+    test_future_get(THR_QUEUE_LIST);
+    test_future_get(THR_QUEUE_RING);
+    test_future_timedwait();
+    return 0;
+}
+
+void test_future_get(int queue_mode)
+{
+    thr_pool_t pool;
+    thr_pool_options_t opts;
+    thr_future_t *futures[NFUTURES];
+
+    thr_pool_options_init(&opts);
+    opts.min_threads = 2;
+    opts.max_threads = 4;
+    opts.queue_mode = queue_mode;
+    int err = thr_pool_create_ex(&pool, &opts);
+    if (err) {
+        fprintf(stderr, "thr_pool_create_ex() failed!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (intptr_t i = 0; i < NFUTURES; i++) {
+        err = thr_pool_submit(&pool, square_task, (void *) i, &futures[i]);
+        ASSERT_EQ_INT(err, 0);
+    }
+    for (intptr_t i = 0; i < NFUTURES; i++) {
+        void *result;
+        err = thr_future_get(futures[i], &result);
+        ASSERT_EQ_INT(err, 0);
+        ASSERT_EQ_INT((int) (intptr_t) result, (int) (i * i));
+        thr_future_release(futures[i]);
+    }
+
+    /* waiting on a future from inside a job */
+    thr_future_t *nested;
+    err = thr_pool_submit(&pool, nested_task, &pool, &nested);
+    ASSERT_EQ_INT(err, 0);
+    err = thr_future_wait(nested);
+    ASSERT_EQ_INT(err, 0);
+    ASSERT_EQ_INT((int) (intptr_t) nested->result, 140);
+    thr_future_release(nested);
+
+    /* releasing a future does not wait for its job */
+    thr_future_t *dropped;
+    err = thr_pool_submit(&pool, square_task, (void *) 3, &dropped);
+    ASSERT_EQ_INT(err, 0);
+    thr_future_release(dropped);
+
+    err = thr_pool_submit(&pool, square_task, NULL, NULL);
+    ASSERT_EQ_INT(err, EINVAL);
+
+    thr_pool_wait(&pool);
+    thr_pool_destroy(&pool);
+    ASSERT_EQ_INT(pool.nthreads, 0);
+}
+
+void test_future_timedwait(void)
+{
+    thr_pool_t pool;
+    thr_future_t *future;
+    struct timespec deadline;
+
+    int err = thr_pool_create(&pool, 1, 1, -1, NULL);
+    if (err) {
+        fprintf(stderr, "thr_pool_create() failed!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    err = thr_pool_submit(&pool, blocking_task, (void *) 42, &future);
+    ASSERT_EQ_INT(err, 0);
+
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_nsec += 50000000;
+    if (deadline.tv_nsec >= 1000000000) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+    }
+    err = thr_future_timedwait(future, &deadline);
+    ASSERT_EQ_INT(err, ETIMEDOUT);
+
+    __atomic_store_n(&release, 1, __ATOMIC_RELEASE);
+    void *result;
+    err = thr_future_get(future, &result);
+    ASSERT_EQ_INT(err, 0);
+    ASSERT_EQ_INT((int) (intptr_t) result, 42);
+
+    /* a completed future never times out */
+    err = thr_future_timedwait(future, &deadline);
+    ASSERT_EQ_INT(err, 0);
+    thr_future_release(future);
+
+    thr_pool_wait(&pool);
+    thr_pool_destroy(&pool);
+}
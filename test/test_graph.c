@@ -0,0 +1,322 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "../src/thrpool.h"
+#include "../src/thrpool_assert.h"
+#include <stdlib.h>
+#include <errno.h>
+#include <sched.h>
+#include <time.h>
+
+#define NSTAGES 100
+#define NCHAIN 200000
+
+int started = 0;
+int count = 0;
+
+void sleep_ms(long ms)
+{
+    struct timespec ts = {ms / 1000, (ms % 1000) * 1000000L};
+    nanosleep(&ts, NULL);
+}
+
+/* The stages of a pipeline: parse -> {index, compress} -> write */
+typedef struct stage {
+    thr_task_t *deps[2];
+    long value;
+} stage_t;
+
+/* Sum the results of the predecessors, plus its own value */
+void *stage_task(void *arg)
+{
+    stage_t *stage = (stage_t *) arg;
+    long sum = stage->value;
+    for (int i = 0; i < 2; i++) {
+        if (stage->deps[i] != NULL)
+            sum += (long) thr_task_result(stage->deps[i]);
+    }
+    __atomic_add_fetch(&count, 1, __ATOMIC_RELAXED);
+    return (void *) sum;
+}
+
+void *count_task(void *arg)
+{
+    __atomic_add_fetch(&count, 1, __ATOMIC_RELAXED);
+    return arg;
+}
+
+void *slow_task(void *arg)
+{
+    __atomic_store_n(&started, 1, __ATOMIC_RELEASE);
+    sleep_ms((long) arg);
+    return NULL;
+}
+
+/* Add its own value to the result of the future it follows */
+typedef struct step {
+    thr_future_t *prev;
+    long value;
+} step_t;
+
+void *step_task(void *arg)
+{
+    step_t *step = (step_t *) arg;
+    void *prev = NULL;
+    if (step->prev != NULL)
+        thr_future_get(step->prev, &prev);
+    return (void *) ((long) prev + step->value);
+}
+
+void wait_started(void)
+{
+    while (!__atomic_load_n(&started, __ATOMIC_ACQUIRE))
+        sched_yield();
+}
+
+void test_diamond(thr_pool_t *pool);
+void test_chain(thr_pool_t *pool);
+void test_errors(thr_pool_t *pool);
+void test_then(thr_pool_t *pool);
+void test_discard(void);
+void test_discard_chain(void);
+
+int main(void)
+{
+    thr_pool_t pool;
+    int err = thr_pool_create(&pool, 1, 4, 60, NULL);
+    if (err) {
+        fprintf(stderr, "thr_pool_create() failed!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    test_diamond(&pool);
+    test_chain(&pool);
+    test_errors(&pool);
+    test_then(&pool);
+    thr_pool_destroy(&pool);
+
+    test_discard();
+    test_discard_chain();
+    return 0;
+}
+
+void test_diamond(thr_pool_t *pool)
+{
+    stage_t parse = {{NULL, NULL}, 1};
+    stage_t index = {{NULL, NULL}, 10};
+    stage_t compress = {{NULL, NULL}, 100};
+    stage_t write = {{NULL, NULL}, 1000};
+    thr_task_t *tparse, *tindex, *tcompress, *twrite;
+    thr_graph_t *graph;
+
+    int err = thr_graph_create(&graph);
+    ASSERT_EQ_INT(err, 0);
+    thr_graph_add(graph, stage_task, &parse, &tparse);
+    thr_graph_add(graph, stage_task, &index, &tindex);
+    thr_graph_add(graph, stage_task, &compress, &tcompress);
+    thr_graph_add(graph, stage_task, &write, &twrite);
+    index.deps[0] = compress.deps[0] = tparse;
+    write.deps[0] = tindex;
+    write.deps[1] = tcompress;
+    thr_graph_edge(graph, tparse, tindex);
+    thr_graph_edge(graph, tparse, tcompress);
+    thr_graph_edge(graph, tindex, twrite);
+    thr_graph_edge(graph, tcompress, twrite);
+
+    /* Each stage sees the results of the stages it depends on */
+    for (int run = 0; run < 10; run++) {
+        count = 0;
+        err = thr_pool_run_graph(pool, graph);
+        ASSERT_EQ_INT(err, 0);
+        err = thr_graph_wait(graph);
+        ASSERT_EQ_INT(err, 0);
+        ASSERT_EQ_INT(__atomic_load_n(&count, __ATOMIC_RELAXED), 4);
+        ASSERT_EQ_INT((int) (long) thr_task_result(twrite), 1112);
+    }
+    thr_graph_destroy(graph);
+}
+
+void test_chain(thr_pool_t *pool)
+{
+    stage_t stages[NSTAGES];
+    thr_task_t *tasks[NSTAGES];
+    thr_graph_t *graph;
+
+    thr_graph_create(&graph);
+    for (int i = 0; i < NSTAGES; i++) {
+        stages[i].deps[0] = i > 0 ? tasks[i - 1] : NULL;
+        stages[i].deps[1] = NULL;
+        stages[i].value = 1;
+        int err = thr_graph_add(graph, stage_task, &stages[i], &tasks[i]);
+        ASSERT_EQ_INT(err, 0);
+        if (i > 0) thr_graph_edge(graph, tasks[i - 1], tasks[i]);
+    }
+
+    count = 0;
+    int err = thr_pool_run_graph(pool, graph);
+    ASSERT_EQ_INT(err, 0);
+    err = thr_graph_wait(graph);
+    ASSERT_EQ_INT(err, 0);
+    ASSERT_EQ_INT((int) (long) thr_task_result(tasks[NSTAGES - 1]), NSTAGES);
+    thr_graph_destroy(graph);
+}
+
+void test_errors(thr_pool_t *pool)
+{
+    thr_task_t *a, *b, *c, *slow;
+    thr_graph_t *graph, *other;
+
+    thr_graph_create(&graph);
+    thr_graph_create(&other);
+    thr_graph_add(graph, count_task, NULL, &a);
+    thr_graph_add(graph, count_task, NULL, &b);
+    thr_graph_add(other, count_task, NULL, &c);
+
+    int err = thr_graph_edge(graph, a, a);
+    ASSERT_EQ_INT(err, EINVAL);
+    err = thr_graph_edge(graph, a, c);
+    ASSERT_EQ_INT(err, EINVAL);
+
+    /* A cycle never starts */
+    thr_graph_edge(graph, a, b);
+    thr_graph_edge(graph, b, a);
+    count = 0;
+    err = thr_pool_run_graph(pool, graph);
+    ASSERT_EQ_INT(err, EINVAL);
+    ASSERT_EQ_INT(__atomic_load_n(&count, __ATOMIC_RELAXED), 0);
+    thr_graph_destroy(graph);
+
+    /* Nothing changes while the graph runs */
+    started = 0;
+    thr_graph_add(other, slow_task, (void *) 20L, &slow);
+    err = thr_pool_run_graph(pool, other);
+    ASSERT_EQ_INT(err, 0);
+    wait_started();
+    err = thr_pool_run_graph(pool, other);
+    ASSERT_EQ_INT(err, EBUSY);
+    err = thr_graph_add(other, count_task, NULL, &a);
+    ASSERT_EQ_INT(err, EBUSY);
+    err = thr_graph_edge(other, slow, c);
+    ASSERT_EQ_INT(err, EBUSY);
+    err = thr_graph_wait(other);
+    ASSERT_EQ_INT(err, 0);
+    thr_graph_destroy(other);
+}
+
+void test_then(thr_pool_t *pool)
+{
+    step_t steps[3] = {{NULL, 1}, {NULL, 10}, {NULL, 100}};
+    thr_future_t *futures[3];
+    void *result;
+
+    /* A chain of continuations, each one reading the previous result */
+    int err = thr_pool_submit(pool, step_task, &steps[0], &futures[0]);
+    ASSERT_EQ_INT(err, 0);
+    for (int i = 1; i < 3; i++) {
+        steps[i].prev = futures[i - 1];
+        err = thr_future_then(futures[i - 1], step_task, &steps[i],
+                              &futures[i]);
+        ASSERT_EQ_INT(err, 0);
+    }
+    err = thr_future_get(futures[2], &result);
+    ASSERT_EQ_INT(err, 0);
+    ASSERT_EQ_INT((int) (long) result, 111);
+
+    /* After the job is over, the continuation is queued right away */
+    thr_future_t *late;
+    err = thr_future_then(futures[0], count_task, (void *) 7L, &late);
+    ASSERT_EQ_INT(err, 0);
+    err = thr_future_get(late, &result);
+    ASSERT_EQ_INT(err, 0);
+    ASSERT_EQ_INT((int) (long) result, 7);
+
+    thr_future_release(late);
+    for (int i = 0; i < 3; i++)
+        thr_future_release(futures[i]);
+
+    err = thr_future_then(NULL, count_task, NULL, &late);
+    ASSERT_EQ_INT(err, EINVAL);
+}
+
+void test_discard(void)
+{
+    thr_pool_options_t opts;
+    thr_pool_t pool;
+    thr_future_t *future, *next;
+    thr_task_t *a, *b;
+    thr_graph_t *graph;
+
+    thr_pool_options_init(&opts);
+    opts.min_threads = 1;
+    opts.max_threads = 1;
+    opts.cooperative = 1;
+    int err = thr_pool_create_ex(&pool, &opts);
+    ASSERT_EQ_INT(err, 0);
+
+    started = 0;
+    thr_pool_add(&pool, slow_task, (void *) 20L);
+    wait_started();
+
+    thr_pool_submit(&pool, count_task, NULL, &future);
+    thr_future_then(future, count_task, NULL, &next);
+    thr_graph_create(&graph);
+    thr_graph_add(graph, count_task, NULL, &a);
+    thr_graph_add(graph, count_task, NULL, &b);
+    thr_graph_edge(graph, a, b);
+    err = thr_pool_run_graph(&pool, graph);
+    ASSERT_EQ_INT(err, 0);
+
+    /* Dropped jobs take their continuations and successors along */
+    count = 0;
+    err = thr_pool_shutdown(&pool, THR_SHUTDOWN_DISCARD, NULL);
+    ASSERT_EQ_INT(err, 0);
+    err = thr_future_wait(next);
+    ASSERT_EQ_INT(err, ECANCELED);
+    err = thr_graph_wait(graph);
+    ASSERT_EQ_INT(err, ECANCELED);
+    ASSERT_EQ_INT(__atomic_load_n(&count, __ATOMIC_RELAXED), 0);
+    ASSERT(thr_task_result(b) == NULL);
+
+    thr_future_release(next);
+    thr_future_release(future);
+    thr_graph_destroy(graph);
+    thr_pool_destroy(&pool);
+}
+
+void test_discard_chain(void)
+{
+    thr_pool_options_t opts;
+    thr_pool_t pool;
+    thr_task_t *prev = NULL, *task;
+    thr_graph_t *graph;
+
+    thr_pool_options_init(&opts);
+    opts.min_threads = 1;
+    opts.max_threads = 1;
+    opts.cooperative = 1;
+    int err = thr_pool_create_ex(&pool, &opts);
+    ASSERT_EQ_INT(err, 0);
+
+    started = 0;
+    thr_pool_add(&pool, slow_task, (void *) 20L);
+    wait_started();
+
+    thr_graph_create(&graph);
+    for (int i = 0; i < NCHAIN; i++) {
+        thr_graph_add(graph, count_task, NULL, &task);
+        if (prev != NULL) thr_graph_edge(graph, prev, task);
+        prev = task;
+    }
+    err = thr_pool_run_graph(&pool, graph);
+    ASSERT_EQ_INT(err, 0);
+
+    /* The whole chain is skipped once its root is dropped */
+    count = 0;
+    err = thr_pool_shutdown(&pool, THR_SHUTDOWN_DISCARD, NULL);
+    ASSERT_EQ_INT(err, 0);
+    err = thr_graph_wait(graph);
+    ASSERT_EQ_INT(err, ECANCELED);
+    ASSERT_EQ_INT(__atomic_load_n(&count, __ATOMIC_RELAXED), 0);
+
+    thr_graph_destroy(graph);
+    thr_pool_destroy(&pool);
+}
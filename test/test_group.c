@@ -0,0 +1,152 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "../src/thrpool.h"
+#include "../src/thrpool_assert.h"
+#include <stdlib.h>
+#include <errno.h>
+#include <sched.h>
+
+#define NJOBS 50
+#define DEPTH 8
+
+thr_pool_t pool;
+thr_group_t tree;
+int release = 0;
+int count = 0;
+
+void *count_task(void *arg)
+{
+    __atomic_add_fetch(&count, 1, __ATOMIC_RELAXED);
+    return arg;
+}
+
+void *blocking_task(void *arg)
+{
+    while (!__atomic_load_n(&release, __ATOMIC_ACQUIRE))
+        sched_yield();
+    return arg;
+}
+
+/* Add two children to the group, down to DEPTH */
+void *tree_task(void *arg)
+{
+    long depth = (long) arg;
+    __atomic_add_fetch(&count, 1, __ATOMIC_RELAXED);
+    if (depth < DEPTH) {
+        thr_pool_add_group(&pool, &tree, tree_task, (void *) (depth + 1));
+        thr_pool_add_group(&pool, &tree, tree_task, (void *) (depth + 1));
+    }
+    return NULL;
+}
+
+void test_independent_groups(int queue_mode);
+void test_nested_group(void);
+void test_freed_group(void);
+
+int main(void)
+{
+    test_independent_groups(THR_QUEUE_LIST);
+    test_independent_groups(THR_QUEUE_RING);
+    test_nested_group();
+    test_freed_group();
+    return 0;
+}
+
+void test_independent_groups(int queue_mode)
+{
+    thr_pool_options_t opts;
+    thr_group_t quick, slow;
+    struct timespec deadline;
+
+    thr_pool_options_init(&opts);
+    opts.min_threads = 2;
+    opts.max_threads = 4;
+    opts.queue_mode = queue_mode;
+    int err = thr_pool_create_ex(&pool, &opts);
+    if (err) {
+        fprintf(stderr, "thr_pool_create_ex() failed!\n");
+        exit(EXIT_FAILURE);
+    }
+    thr_group_init(&quick);
+    thr_group_init(&slow);
+    release = count = 0;
+
+    err = thr_pool_add_group(&pool, &slow, blocking_task, NULL);
+    ASSERT_EQ_INT(err, 0);
+    for (int i = 0; i < NJOBS; i++) {
+        err = thr_pool_add_group(&pool, &quick, count_task, NULL);
+        ASSERT_EQ_INT(err, 0);
+    }
+
+    /* the quick group does not wait for the blocked job of the slow one */
+    err = thr_group_wait(&quick);
+    ASSERT_EQ_INT(err, 0);
+    ASSERT_EQ_INT(count, NJOBS);
+    ASSERT_EQ_INT(quick.outstanding, 0);
+
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_nsec += 20000000;
+    if (deadline.tv_nsec >= 1000000000) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+    }
+    err = thr_group_timedwait(&slow, &deadline);
+    ASSERT_EQ_INT(err, ETIMEDOUT);
+
+    __atomic_store_n(&release, 1, __ATOMIC_RELEASE);
+    err = thr_group_wait(&slow);
+    ASSERT_EQ_INT(err, 0);
+
+    /* an empty group never blocks */
+    err = thr_group_wait(&quick);
+    ASSERT_EQ_INT(err, 0);
+
+    err = thr_pool_add_group(&pool, NULL, count_task, NULL);
+    ASSERT_EQ_INT(err, EINVAL);
+
+    thr_pool_wait(&pool);
+    thr_pool_destroy(&pool);
+}
+
+void test_nested_group(void)
+{
+    int err = thr_pool_create(&pool, 1, 4, -1, NULL);
+    if (err) {
+        fprintf(stderr, "thr_pool_create() failed!\n");
+        exit(EXIT_FAILURE);
+    }
+    thr_group_init(&tree);
+    count = 0;
+
+    /* children are added before their parent is over */
+    err = thr_pool_add_group(&pool, &tree, tree_task, (void *) 0);
+    ASSERT_EQ_INT(err, 0);
+    err = thr_group_wait(&tree);
+    ASSERT_EQ_INT(err, 0);
+    ASSERT_EQ_INT(count, (1 << (DEPTH + 1)) - 1);
+
+    thr_pool_destroy(&pool);
+}
+
+void test_freed_group(void)
+{
+    int err = thr_pool_create(&pool, 1, 4, -1, NULL);
+    if (err) {
+        fprintf(stderr, "thr_pool_create() failed!\n");
+        exit(EXIT_FAILURE);
+    }
+    count = 0;
+
+    /* The group goes away as soon as the wait returns */
+    for (int i = 0; i < 1000; i++) {
+        thr_group_t *group = (thr_group_t *) malloc(sizeof(thr_group_t));
+        thr_group_init(group);
+        thr_pool_add_group(&pool, group, count_task, NULL);
+        err = thr_group_wait(group);
+        ASSERT_EQ_INT(err, 0);
+        free(group);
+    }
+    ASSERT_EQ_INT(__atomic_load_n(&count, __ATOMIC_RELAXED), 1000);
+
+    thr_pool_destroy(&pool);
+}
@@ -0,0 +1,125 @@
+#include "../src/thrpool.h"
+#include "../src/thrpool_assert.h"
+#include <stdlib.h>
+
+#define NCHILDREN 20
+
+thr_pool_t pool;
+int count = 0;
+int nested_err = -1;
+
+void *count_task(void *arg)
+{
+    __atomic_add_fetch(&count, 1, __ATOMIC_RELAXED);
+    return arg;
+}
+
+/* Fork-join Fibonacci: each level waits for the futures it submitted */
+void *fib_task(void *arg)
+{
+    long n = (long) arg;
+    if (n < 2) return (void *) n;
+
+    thr_future_t *left, *right;
+    void *a, *b;
+    thr_pool_submit(&pool, fib_task, (void *) (n - 1), &left);
+    thr_pool_submit(&pool, fib_task, (void *) (n - 2), &right);
+    thr_future_get(left, &a);
+    thr_future_get(right, &b);
+    thr_future_release(left);
+    thr_future_release(right);
+    return (void *) ((long) a + (long) b);
+}
+
+/* Add children to the pool, then wait for the whole pool */
+void *parent_task(void *arg)
+{
+    for (int i = 0; i < NCHILDREN; i++)
+        thr_pool_add(&pool, count_task, NULL);
+    nested_err = thr_pool_wait(&pool);
+    /* Nothing but the waiting jobs left */
+    if (__atomic_load_n(&count, __ATOMIC_RELAXED) < NCHILDREN)
+        nested_err = -1;
+    return arg;
+}
+
+/* Add children to a group of its own, then wait for them */
+void *group_task(void *arg)
+{
+    thr_group_t group;
+    thr_group_init(&group);
+    for (int i = 0; i < NCHILDREN; i++)
+        thr_pool_add_group(&pool, &group, count_task, NULL);
+    thr_group_wait(&group);
+    return arg;
+}
+
+void create_pool(int max)
+{
+    int err = thr_pool_create(&pool, 1, max, 60, NULL);
+    if (err) {
+        fprintf(stderr, "thr_pool_create() failed!\n");
+        exit(EXIT_FAILURE);
+    }
+    count = 0;
+}
+
+void test_fib(void);
+void test_nested_wait(void);
+void test_groups(void);
+
+int main(void)
+{
+    test_fib();
+    test_nested_wait();
+    test_groups();
+    return 0;
+}
+
+void test_fib(void)
+{
+    void *result;
+    thr_future_t *future;
+
+    /* A single worker runs the whole tree while its jobs wait */
+    for (int max = 1; max <= 4; max *= 2) {
+        create_pool(max);
+        int err = thr_pool_submit(&pool, fib_task, (void *) 15L, &future);
+        ASSERT_EQ_INT(err, 0);
+        err = thr_future_get(future, &result);
+        ASSERT_EQ_INT(err, 0);
+        ASSERT_EQ_INT((int) (long) result, 610);
+        thr_future_release(future);
+        thr_pool_destroy(&pool);
+    }
+}
+
+void test_nested_wait(void)
+{
+    create_pool(1);
+    thr_pool_add(&pool, parent_task, NULL);
+    thr_pool_wait(&pool);
+    ASSERT_EQ_INT(nested_err, 0);
+    ASSERT_EQ_INT(__atomic_load_n(&count, __ATOMIC_RELAXED), NCHILDREN);
+    thr_pool_destroy(&pool);
+
+    /* Two parents wait for each other's children, not for each other */
+    create_pool(2);
+    thr_pool_add(&pool, parent_task, NULL);
+    thr_pool_add(&pool, parent_task, NULL);
+    thr_pool_wait(&pool);
+    ASSERT_EQ_INT(nested_err, 0);
+    ASSERT_EQ_INT(__atomic_load_n(&count, __ATOMIC_RELAXED), 2 * NCHILDREN);
+    thr_pool_destroy(&pool);
+}
+
+void test_groups(void)
+{
+    /* More waiting parents than workers */
+    create_pool(2);
+    for (int i = 0; i < 8; i++)
+        thr_pool_add(&pool, group_task, NULL);
+    thr_pool_wait(&pool);
+    ASSERT_EQ_INT(__atomic_load_n(&count, __ATOMIC_RELAXED), 8 * NCHILDREN);
+    thr_pool_destroy(&pool);
+}
@@ -0,0 +1,156 @@
+#include "../src/thrpool.h"
+#include "../src/thrpool_assert.h"
+#include <stdlib.h>
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+
+#define NJOBS 1000
+
+/* A typical small context: a few pointers and ints */
+typedef struct ctx {
+    int *sum;
+    int index;
+    int weight;
+    void *unused[2];
+} ctx_t;
+
+/* A payload checked byte by byte */
+typedef struct blob {
+    size_t size;
+    unsigned char seed;
+    unsigned char bytes[];
+} blob_t;
+
+int sum = 0;
+int checked = 0;
+int misaligned = 0;
+
+void *ctx_task(void *arg)
+{
+    ctx_t *ctx = (ctx_t *) arg;
+    if ((uintptr_t) arg % 16 != 0)
+        __atomic_add_fetch(&misaligned, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(ctx->sum, ctx->index * ctx->weight, __ATOMIC_RELAXED);
+    return NULL;
+}
+
+void *blob_task(void *arg)
+{
+    blob_t *blob = (blob_t *) arg;
+    for (size_t i = 0; i < blob->size; i++) {
+        if (blob->bytes[i] != (unsigned char) (blob->seed + i))
+            return NULL;
+    }
+    __atomic_add_fetch(&checked, 1, __ATOMIC_RELAXED);
+    return NULL;
+}
+
+void *empty_task(void *arg)
+{
+    __atomic_add_fetch(&checked, 1, __ATOMIC_RELAXED);
+    return arg;
+}
+
+/* Add a blob of size bytes in all */
+int add_blob(thr_pool_t *pool, size_t size, unsigned char seed)
+{
+    blob_t *blob = (blob_t *) malloc(size);
+    blob->size = size - sizeof(blob_t);
+    blob->seed = seed;
+    for (size_t i = 0; i < blob->size; i++)
+        blob->bytes[i] = (unsigned char) (seed + i);
+    int err = thr_pool_add_inline(pool, blob_task, blob, size);
+    /* The pool works on its own copy */
+    memset(blob, 0, size);
+    free(blob);
+    return err;
+}
+
+void test_node_layout(void);
+void test_small(thr_pool_t *pool);
+void test_sizes(thr_pool_t *pool);
+void test_destroy_queued(void);
+
+int main(void)
+{
+    thr_pool_t pool;
+    int err = thr_pool_create(&pool, 1, 4, 60, NULL);
+    if (err) {
+        fprintf(stderr, "thr_pool_create() failed!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    test_node_layout();
+    test_small(&pool);
+    test_sizes(&pool);
+    thr_pool_destroy(&pool);
+
+    test_destroy_queued();
+    return 0;
+}
+
+void test_node_layout(void)
+{
+    ASSERT_EQ_INT((int) sizeof(job_t), 2 * THR_CACHE_LINE);
+    ASSERT_GE_INT(THR_JOB_INLINE, (int) sizeof(ctx_t));
+}
+
+void test_small(thr_pool_t *pool)
+{
+    ctx_t ctx;
+    int expected = 0;
+
+    ctx.sum = &sum;
+    ctx.weight = 3;
+    for (int i = 0; i < NJOBS; i++) {
+        ctx.index = i;
+        int err = thr_pool_add_inline(pool, ctx_task, &ctx, sizeof(ctx));
+        ASSERT_EQ_INT(err, 0);
+        expected += i * 3;
+    }
+    thr_pool_wait(pool);
+    ASSERT_EQ_INT(__atomic_load_n(&sum, __ATOMIC_RELAXED), expected);
+    ASSERT_EQ_INT(misaligned, 0);
+
+    int err = thr_pool_add_inline(pool, NULL, &ctx, sizeof(ctx));
+    ASSERT_EQ_INT(err, EINVAL);
+    err = thr_pool_add_inline(pool, ctx_task, NULL, sizeof(ctx));
+    ASSERT_EQ_INT(err, EINVAL);
+}
+
+void test_sizes(thr_pool_t *pool)
+{
+    /* In the node, in a pooled buffer, and from malloc() */
+    size_t sizes[] = {
+        sizeof(blob_t), THR_JOB_INLINE, THR_JOB_INLINE + 1,
+        THR_JOB_BUFFER_SIZE, THR_JOB_BUFFER_SIZE + 1, 10000
+    };
+    int nsizes = (int) (sizeof(sizes) / sizeof(sizes[0]));
+
+    checked = 0;
+    for (int i = 0; i < 100; i++) {
+        int err = add_blob(pool, sizes[i % nsizes], (unsigned char) i);
+        ASSERT_EQ_INT(err, 0);
+    }
+    int err = thr_pool_add_inline(pool, empty_task, NULL, 0);
+    ASSERT_EQ_INT(err, 0);
+    thr_pool_wait(pool);
+    ASSERT_EQ_INT(__atomic_load_n(&checked, __ATOMIC_RELAXED), 101);
+}
+
+void test_destroy_queued(void)
+{
+    thr_pool_t pool;
+    thr_pool_options_t opts;
+
+    /* Dropped jobs give their buffers back */
+    thr_pool_options_init(&opts);
+    opts.min_threads = 0;
+    opts.max_threads = 1;
+    int err = thr_pool_create_ex(&pool, &opts);
+    ASSERT_EQ_INT(err, 0);
+    for (int i = 0; i < 100; i++)
+        add_blob(&pool, i % 2 ? THR_JOB_BUFFER_SIZE : 4096, 0);
+    thr_pool_destroy(&pool);
+}
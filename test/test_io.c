@@ -0,0 +1,285 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "../src/thrpool.h"
+#include "../src/thrpool_assert.h"
+#include <stdlib.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+
+#define NPIPES 32
+#define NROUNDS 10
+
+thr_pool_t pool;
+int pipes[NPIPES][2];
+int count = 0;
+int slow_done = 0;
+
+void sleep_ms(long ms)
+{
+    struct timespec ts = {ms / 1000, (ms % 1000) * 1000000L};
+    nanosleep(&ts, NULL);
+}
+
+/* Wait up to a few seconds for count to reach n */
+int wait_count(int n)
+{
+    for (int i = 0; i < 5000; i++) {
+        if (__atomic_load_n(&count, __ATOMIC_ACQUIRE) >= n) return 1;
+        sleep_ms(1);
+    }
+    return 0;
+}
+
+void *count_task(void *arg)
+{
+    __atomic_add_fetch(&count, 1, __ATOMIC_RELEASE);
+    return arg;
+}
+
+/* Consume one byte, then wait for the next one */
+void *read_task(void *arg)
+{
+    int *fds = (int *) arg;
+    char c;
+    if (read(fds[0], &c, 1) == 1 && c != 'q')
+        thr_pool_add_io(&pool, fds[0], THR_IO_READ, read_task, fds);
+    __atomic_add_fetch(&count, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+/* Keep a worker busy for arg milliseconds */
+void *slow_task(void *arg)
+{
+    sleep_ms((long) arg);
+    __atomic_store_n(&slow_done, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+/* Wait up to a few seconds for count to reach n, before slow_task is over */
+int wait_count_busy(int n)
+{
+    int ok = wait_count(n);
+    return ok && !__atomic_load_n(&slow_done, __ATOMIC_ACQUIRE);
+}
+
+void open_pipes(void)
+{
+    for (int i = 0; i < NPIPES; i++) {
+        int err = pipe(pipes[i]);
+        ASSERT_EQ_INT(err, 0);
+    }
+}
+
+void close_pipes(void)
+{
+    for (int i = 0; i < NPIPES; i++) {
+        close(pipes[i][0]);
+        close(pipes[i][1]);
+    }
+}
+
+void create_pool(int max)
+{
+    int err = thr_pool_create(&pool, 1, max, 60, NULL);
+    if (err) {
+        fprintf(stderr, "thr_pool_create() failed!\n");
+        exit(EXIT_FAILURE);
+    }
+    count = 0;
+}
+
+void test_ready(void);
+void test_rounds(void);
+void test_busy(void);
+void test_handoff(void);
+void test_errors(void);
+void test_destroy_waiting(void);
+
+int main(void)
+{
+    open_pipes();
+    test_ready();
+    test_rounds();
+    test_busy();
+    test_handoff();
+    test_errors();
+    test_destroy_waiting();
+    close_pipes();
+    return 0;
+}
+
+void test_ready(void)
+{
+    create_pool(4);
+
+    /* Nothing runs, nor is waited for, until the pipe is readable */
+    int err = thr_pool_add_io(&pool, pipes[0][0], THR_IO_READ,
+                              count_task, NULL);
+    ASSERT_EQ_INT(err, 0);
+    sleep_ms(20);
+    thr_pool_wait(&pool);
+    ASSERT_EQ_INT(__atomic_load_n(&count, __ATOMIC_ACQUIRE), 0);
+
+    ssize_t rc = write(pipes[0][1], "x", 1);
+    ASSERT_EQ_INT((int) rc, 1);
+    ASSERT(wait_count(1));
+    char c;
+    rc = read(pipes[0][0], &c, 1);
+    ASSERT_EQ_INT((int) rc, 1);
+
+    /* An empty pipe is writable right away */
+    err = thr_pool_add_io(&pool, pipes[0][1], THR_IO_WRITE, count_task, NULL);
+    ASSERT_EQ_INT(err, 0);
+    ASSERT(wait_count(2));
+    thr_pool_destroy(&pool);
+}
+
+void test_rounds(void)
+{
+    /* Each job registers the pipe again, more pipes than workers */
+    create_pool(4);
+    for (int i = 0; i < NPIPES; i++) {
+        int err = thr_pool_add_io(&pool, pipes[i][0], THR_IO_READ,
+                                  read_task, pipes[i]);
+        ASSERT_EQ_INT(err, 0);
+    }
+    for (int round = 0; round < NROUNDS; round++) {
+        char c = round + 1 < NROUNDS ? 'x' : 'q';
+        for (int i = 0; i < NPIPES; i++) {
+            ssize_t rc = write(pipes[i][1], &c, 1);
+            ASSERT_EQ_INT((int) rc, 1);
+        }
+        ASSERT(wait_count((round + 1) * NPIPES));
+    }
+    thr_pool_wait(&pool);
+    ASSERT_EQ_INT(__atomic_load_n(&count, __ATOMIC_ACQUIRE),
+                  NROUNDS * NPIPES);
+    thr_pool_destroy(&pool);
+}
+
+void test_busy(void)
+{
+    /* The only worker polls, and still runs the other jobs */
+    create_pool(1);
+    int err = thr_pool_add_io(&pool, pipes[0][0], THR_IO_READ,
+                              count_task, NULL);
+    ASSERT_EQ_INT(err, 0);
+    sleep_ms(20);
+    for (int i = 0; i < 10; i++)
+        thr_pool_add(&pool, count_task, NULL);
+    thr_pool_wait(&pool);
+    ASSERT_EQ_INT(__atomic_load_n(&count, __ATOMIC_ACQUIRE), 10);
+
+    ssize_t rc = write(pipes[0][1], "x", 1);
+    ASSERT_EQ_INT((int) rc, 1);
+    ASSERT(wait_count(11));
+    char c;
+    rc = read(pipes[0][0], &c, 1);
+    ASSERT_EQ_INT((int) rc, 1);
+    thr_pool_destroy(&pool);
+}
+
+void test_handoff(void)
+{
+    thr_pool_options_t opts;
+    char c;
+
+    thr_pool_options_init(&opts);
+    opts.min_threads = 2;
+    opts.max_threads = 2;
+    opts.timeout = -1;
+    opts.prewarm = 1;
+    int err = thr_pool_create_ex(&pool, &opts);
+    ASSERT_EQ_INT(err, 0);
+    count = 0;
+
+    /* A job for the idle workers, while one of them polls */
+    err = thr_pool_add_io(&pool, pipes[0][0], THR_IO_READ, count_task, NULL);
+    ASSERT_EQ_INT(err, 0);
+    sleep_ms(20);
+    slow_done = 0;
+    thr_pool_add(&pool, slow_task, (void *) 1000L);
+    sleep_ms(20);
+    ssize_t rc = write(pipes[0][1], "x", 1);
+    ASSERT_EQ_INT((int) rc, 1);
+    ASSERT(wait_count_busy(1));
+    rc = read(pipes[0][0], &c, 1);
+    ASSERT_EQ_INT((int) rc, 1);
+    thr_pool_wait(&pool);
+
+    /* The poller runs a ready job itself, the other worker polls on */
+    slow_done = 0;
+    err = thr_pool_add_io(&pool, pipes[0][0], THR_IO_READ,
+                          slow_task, (void *) 1000L);
+    ASSERT_EQ_INT(err, 0);
+    err = thr_pool_add_io(&pool, pipes[1][0], THR_IO_READ, count_task, NULL);
+    ASSERT_EQ_INT(err, 0);
+    sleep_ms(20);
+    rc = write(pipes[0][1], "x", 1);
+    ASSERT_EQ_INT((int) rc, 1);
+    sleep_ms(20);
+    rc = write(pipes[1][1], "x", 1);
+    ASSERT_EQ_INT((int) rc, 1);
+    ASSERT(wait_count_busy(2));
+    thr_pool_wait(&pool);
+    rc = read(pipes[0][0], &c, 1);
+    ASSERT_EQ_INT((int) rc, 1);
+    rc = read(pipes[1][0], &c, 1);
+    ASSERT_EQ_INT((int) rc, 1);
+    thr_pool_destroy(&pool);
+}
+
+void test_errors(void)
+{
+    int fds[2];
+
+    create_pool(2);
+    int err = thr_pool_add_io(&pool, -1, THR_IO_READ, count_task, NULL);
+    ASSERT_EQ_INT(err, EINVAL);
+    err = thr_pool_add_io(&pool, pipes[0][0], 0, count_task, NULL);
+    ASSERT_EQ_INT(err, EINVAL);
+    err = thr_pool_add_io(&pool, pipes[0][0], THR_IO_READ, NULL, NULL);
+    ASSERT_EQ_INT(err, EINVAL);
+
+    /* The reactor exists by now, and does not reuse the closed number */
+    err = thr_pool_add_io(&pool, pipes[0][1], THR_IO_WRITE, count_task, NULL);
+    ASSERT_EQ_INT(err, 0);
+    ASSERT(wait_count(1));
+    err = pipe(fds);
+    ASSERT_EQ_INT(err, 0);
+    close(fds[0]);
+    close(fds[1]);
+    err = thr_pool_add_io(&pool, fds[0], THR_IO_READ, count_task, NULL);
+    ASSERT_EQ_INT(err, EBADF);
+
+    /* The second registration of a waiting fd is refused */
+    err = thr_pool_add_io(&pool, pipes[1][0], THR_IO_READ, count_task, NULL);
+    ASSERT_EQ_INT(err, 0);
+    err = thr_pool_add_io(&pool, pipes[1][0], THR_IO_WRITE, count_task, NULL);
+    ASSERT_EQ_INT(err, EBUSY);
+    ssize_t rc = write(pipes[1][1], "x", 1);
+    ASSERT_EQ_INT((int) rc, 1);
+    ASSERT(wait_count(2));
+    char c;
+    rc = read(pipes[1][0], &c, 1);
+    ASSERT_EQ_INT((int) rc, 1);
+    /* Nothing left waiting: the first registration was kept */
+    ASSERT_EQ_INT(__atomic_load_n(&pool.io_waiting, __ATOMIC_RELAXED), 0);
+
+    thr_pool_shutdown(&pool, THR_SHUTDOWN_DRAIN, NULL);
+    err = thr_pool_add_io(&pool, pipes[0][0], THR_IO_READ, count_task, NULL);
+    ASSERT_EQ_INT(err, ECANCELED);
+    thr_pool_destroy(&pool);
+}
+
+void test_destroy_waiting(void)
+{
+    /* Registrations still waiting never fire */
+    create_pool(2);
+    for (int i = 0; i < NPIPES; i++)
+        thr_pool_add_io(&pool, pipes[i][0], THR_IO_READ, count_task, NULL);
+    sleep_ms(20);
+    thr_pool_destroy(&pool);
+    ASSERT_EQ_INT(__atomic_load_n(&count, __ATOMIC_ACQUIRE), 0);
+}
@@ -0,0 +1,151 @@
+#include "../src/thrpool.h"
+#include "../src/thrpool_assert.h"
+#include <stdlib.h>
+#include <errno.h>
+#include <stdint.h>
+
+#define N 100000
+
+thr_pool_t pool;
+int hits[N];
+
+void mark_body(long begin, long end, void *ctx)
+{
+    for (long i = begin; i < end; i++)
+        __atomic_add_fetch(&hits[i], 1, __ATOMIC_RELAXED);
+    (void) ctx;
+}
+
+void sum_body(long begin, long end, void *acc, void *ctx)
+{
+    long *sum = (long *) acc;
+    for (long i = begin; i < end; i++) *sum += i;
+    (void) ctx;
+}
+
+void sum_combine(void *acc, const void *partial, void *ctx)
+{
+    *(long *) acc += *(const long *) partial;
+    (void) ctx;
+}
+
+/* On an accumulator that needs more than the alignment of a pointer */
+void ldsum_body(long begin, long end, void *acc, void *ctx)
+{
+    if ((uintptr_t) acc % THR_CACHE_LINE != 0)
+        __atomic_add_fetch((int *) ctx, 1, __ATOMIC_RELAXED);
+    long double *sum = (long double *) acc;
+    for (long i = begin; i < end; i++) *sum += i;
+}
+
+void ldsum_combine(void *acc, const void *partial, void *ctx)
+{
+    *(long double *) acc += *(const long double *) partial;
+    (void) ctx;
+}
+
+/* A parallel loop inside a job of the same pool */
+void *nested_task(void *arg)
+{
+    long *sum = (long *) arg;
+    *sum = 0;
+    thr_pool_parallel_reduce(&pool, 0, 1000, 10, sum_body, sum_combine,
+                             sum, sizeof(long), NULL);
+    return NULL;
+}
+
+void test_parallel_for(int min, int max);
+void test_parallel_reduce(int min, int max);
+void test_after_shutdown(void);
+
+int main(void)
+{
+    test_parallel_for(1, 1);
+    test_parallel_for(2, 4);
+    test_parallel_reduce(1, 1);
+    test_parallel_reduce(2, 4);
+    test_after_shutdown();
+    return 0;
+}
+
+void test_parallel_for(int min, int max)
+{
+    int err = thr_pool_create(&pool, min, max, -1, NULL);
+    if (err) {
+        fprintf(stderr, "thr_pool_create() failed!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (long grain = 1; grain <= N * 2; grain *= 64) {
+        for (long i = 0; i < N; i++) hits[i] = 0;
+        err = thr_pool_parallel_for(&pool, 0, N, grain, mark_body, NULL);
+        ASSERT_EQ_INT(err, 0);
+        for (long i = 0; i < N; i++)
+            ASSERT_EQ_INT(hits[i], 1);
+    }
+
+    /* empty and invalid ranges */
+    err = thr_pool_parallel_for(&pool, 5, 5, 1, mark_body, NULL);
+    ASSERT_EQ_INT(err, 0);
+    err = thr_pool_parallel_for(&pool, 5, 4, 1, mark_body, NULL);
+    ASSERT_EQ_INT(err, EINVAL);
+
+    thr_pool_wait(&pool);
+    thr_pool_destroy(&pool);
+}
+
+void test_parallel_reduce(int min, int max)
+{
+    int err = thr_pool_create(&pool, min, max, -1, NULL);
+    if (err) {
+        fprintf(stderr, "thr_pool_create() failed!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    long sum = 0;
+    err = thr_pool_parallel_reduce(&pool, 0, N, 100, sum_body, sum_combine,
+                                   &sum, sizeof(sum), NULL);
+    ASSERT_EQ_INT(err, 0);
+    ASSERT(sum == (long) N * (N - 1) / 2);
+
+    /* Each accumulator starts a cache line */
+    long double ldsum = 0;
+    int misaligned = 0;
+    err = thr_pool_parallel_reduce(&pool, 0, N, 100, ldsum_body,
+                                   ldsum_combine, &ldsum, sizeof(ldsum),
+                                   &misaligned);
+    ASSERT_EQ_INT(err, 0);
+    ASSERT(ldsum == (long double) N * (N - 1) / 2);
+    ASSERT_EQ_INT(misaligned, 0);
+
+    long nested = -1;
+    thr_pool_add(&pool, nested_task, &nested);
+    thr_pool_wait(&pool);
+    ASSERT_EQ_INT((int) nested, 999 * 1000 / 2);
+
+    thr_pool_wait(&pool);
+    thr_pool_destroy(&pool);
+}
+
+void test_after_shutdown(void)
+{
+    thr_pool_options_t opts;
+
+    thr_pool_options_init(&opts);
+    opts.min_threads = 2;
+    opts.max_threads = 4;
+    opts.max_queued = 64;
+    int err = thr_pool_create_ex(&pool, &opts);
+    ASSERT_EQ_INT(err, 0);
+    thr_pool_shutdown(&pool, THR_SHUTDOWN_DRAIN, NULL);
+
+    /* The pool refuses the helpers, the caller does it all */
+    for (long i = 0; i < N; i++) hits[i] = 0;
+    err = thr_pool_parallel_for(&pool, 0, N, 100, mark_body, NULL);
+    ASSERT_EQ_INT(err, 0);
+    for (long i = 0; i < N; i++)
+        ASSERT_EQ_INT(hits[i], 1);
+    ASSERT_EQ_INT((int) pool.queued, 0);
+    ASSERT_EQ_INT((int) pool.pending, 0);
+    thr_pool_destroy(&pool);
+}
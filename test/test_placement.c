@@ -0,0 +1,89 @@
+#define _GNU_SOURCE
+
+#include "../src/thrpool.h"
+#include "../src/thrpool_assert.h"
+#include <stdlib.h>
+#include <errno.h>
+#include <sched.h>
+
+#define NWORKERS 4
+
+int release = 0;
+int started = 0;
+int node[NWORKERS];
+int ncpus[NWORKERS];
+
+/* Record the placement of the worker, then keep it busy */
+void *record_task(void *arg)
+{
+    int index = thr_worker_index();
+    cpu_set_t set;
+
+    ASSERT(index >= 0 && index < NWORKERS);
+    pthread_getaffinity_np(pthread_self(), sizeof(set), &set);
+    ncpus[index] = CPU_COUNT(&set);
+    node[index] = thr_worker_node();
+    __atomic_add_fetch(&started, 1, __ATOMIC_RELEASE);
+    while (!__atomic_load_n(&release, __ATOMIC_ACQUIRE))
+        sched_yield();
+    return arg;
+}
+
+void run_placement(int placement);
+
+int main(void)
+{
+    ASSERT_EQ_INT(thr_worker_index(), -1);
+    ASSERT_EQ_INT(thr_worker_node(), -1);
+
+    run_placement(THR_PLACE_NONE);
+    run_placement(THR_PLACE_COMPACT);
+    run_placement(THR_PLACE_SCATTER);
+    run_placement(THR_PLACE_CORE);
+    run_placement(THR_PLACE_NODE);
+
+    thr_pool_t pool;
+    thr_pool_options_t opts;
+    thr_pool_options_init(&opts);
+    opts.placement = THR_PLACE_NODE + 1;
+    ASSERT_EQ_INT(thr_pool_create_ex(&pool, &opts), EINVAL);
+    return 0;
+}
+
+void run_placement(int placement)
+{
+    thr_pool_t pool;
+    thr_pool_options_t opts;
+
+    thr_pool_options_init(&opts);
+    opts.min_threads = NWORKERS;
+    opts.max_threads = NWORKERS;
+    opts.placement = placement;
+    int err = thr_pool_create_ex(&pool, &opts);
+    if (err) {
+        fprintf(stderr, "thr_pool_create_ex() failed!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    release = started = 0;
+    for (int i = 0; i < NWORKERS; i++)
+        thr_pool_add(&pool, record_task, NULL);
+    while (__atomic_load_n(&started, __ATOMIC_ACQUIRE) < NWORKERS)
+        sched_yield();
+
+    for (int i = 0; i < NWORKERS; i++) {
+        if (placement == THR_PLACE_NONE) {
+            ASSERT_EQ_INT(node[i], -1);
+        } else {
+            ASSERT_GE_INT(node[i], 0);
+        }
+        if (placement == THR_PLACE_COMPACT || placement == THR_PLACE_SCATTER)
+            ASSERT_EQ_INT(ncpus[i], 1);
+        else
+            ASSERT_GE_INT(ncpus[i], 1);
+    }
+
+    __atomic_store_n(&release, 1, __ATOMIC_RELEASE);
+    thr_pool_wait(&pool);
+    thr_pool_destroy(&pool);
+}
@@ -0,0 +1,120 @@
+#include "../src/thrpool.h"
+#include "../src/thrpool_assert.h"
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <sched.h>
+
+int started = 0;
+int release = 0;
+int order[16];
+int norder = 0;
+
+void *blocking_task(void *arg)
+{
+    __atomic_store_n(&started, 1, __ATOMIC_RELEASE);
+    while (!__atomic_load_n(&release, __ATOMIC_ACQUIRE))
+        sched_yield();
+    return arg;
+}
+
+void *record_task(void *arg)
+{
+    order[norder++] = (int) (intptr_t) arg;
+    return arg;
+}
+
+void block_worker(thr_pool_t *pool);
+void test_prio_order(int queue_mode);
+void test_prio_aging(void);
+
+int main(void)
+{
+    test_prio_order(THR_QUEUE_LIST);
+    test_prio_order(THR_QUEUE_RING);
+    test_prio_aging();
+    return 0;
+}
+
+/* Keep the only worker busy until release is set */
+void block_worker(thr_pool_t *pool)
+{
+    started = release = norder = 0;
+    thr_pool_add(pool, blocking_task, NULL);
+    while (!__atomic_load_n(&started, __ATOMIC_ACQUIRE))
+        sched_yield();
+}
+
+void test_prio_order(int queue_mode)
+{
+    thr_pool_t pool;
+    thr_pool_options_t opts;
+
+    thr_pool_options_init(&opts);
+    opts.min_threads = 1;
+    opts.max_threads = 1;
+    opts.queue_mode = queue_mode;
+    int err = thr_pool_create_ex(&pool, &opts);
+    if (err) {
+        fprintf(stderr, "thr_pool_create_ex() failed!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    block_worker(&pool);
+    thr_pool_add_prio(&pool, record_task, (void *) 30, THR_PRIO_BACKGROUND);
+    thr_pool_add_prio(&pool, record_task, (void *) 20, THR_PRIO_LOW);
+    thr_pool_add(&pool, record_task, (void *) 10);
+    thr_pool_add_prio(&pool, record_task, (void *) 0, THR_PRIO_HIGH);
+    thr_pool_add_prio(&pool, record_task, (void *) 21, THR_PRIO_LOW);
+    thr_pool_add_prio(&pool, record_task, (void *) 11, THR_PRIO_NORMAL);
+    thr_pool_add_prio(&pool, record_task, (void *) 1, THR_PRIO_HIGH);
+    __atomic_store_n(&release, 1, __ATOMIC_RELEASE);
+    thr_pool_wait(&pool);
+
+    /* by priority, then in submission order */
+    int expected[] = {0, 1, 10, 11, 20, 21, 30};
+    ASSERT_EQ_INT(norder, 7);
+    for (int i = 0; i < 7; i++)
+        ASSERT_EQ_INT(order[i], expected[i]);
+    ASSERT_EQ_INT(pool.urgent, 0);
+    ASSERT_IS_NULL(pool.job_head);
+    ASSERT_IS_NULL(pool.job_tail);
+
+    err = thr_pool_add_prio(&pool, record_task, NULL, THR_PRIO_LEVELS);
+    ASSERT_EQ_INT(err, EINVAL);
+    err = thr_pool_add_prio(&pool, record_task, NULL, -1);
+    ASSERT_EQ_INT(err, EINVAL);
+
+    thr_pool_destroy(&pool);
+}
+
+void test_prio_aging(void)
+{
+    thr_pool_t pool;
+    thr_pool_options_t opts;
+
+    thr_pool_options_init(&opts);
+    opts.min_threads = 1;
+    opts.max_threads = 1;
+    opts.prio_aging = 2;
+    int err = thr_pool_create_ex(&pool, &opts);
+    if (err) {
+        fprintf(stderr, "thr_pool_create_ex() failed!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    block_worker(&pool);
+    thr_pool_add_prio(&pool, record_task, (void *) 30, THR_PRIO_BACKGROUND);
+    for (intptr_t i = 0; i < 4; i++)
+        thr_pool_add_prio(&pool, record_task, (void *) i, THR_PRIO_HIGH);
+    __atomic_store_n(&release, 1, __ATOMIC_RELEASE);
+    thr_pool_wait(&pool);
+
+    /* the background job gets its turn after two high priority jobs */
+    int expected[] = {0, 30, 1, 2, 3};
+    ASSERT_EQ_INT(norder, 5);
+    for (int i = 0; i < 5; i++)
+        ASSERT_EQ_INT(order[i], expected[i]);
+
+    thr_pool_destroy(&pool);
+}
@@ -0,0 +1,73 @@
+#include "../src/thrpool.h"
+#include "../src/thrpool_assert.h"
+#include <stdlib.h>
+
+#define NUM_PRODUCERS 4
+#define JOBS_PER_PRODUCER 10000
+
+long counter = 0;
+
+void *counter_func(void *arg)
+{
+    __atomic_add_fetch(&counter, 1, __ATOMIC_RELAXED);
+    return arg;
+}
+
+void *producer(void *arg)
+{
+    thr_pool_t *pool = (thr_pool_t *)arg;
+    for (int i = 0; i < JOBS_PER_PRODUCER; i++) {
+        int err = thr_pool_add(pool, counter_func, NULL);
+        ASSERT_EQ_INT(err, 0);
+    }
+    return NULL;
+}
+
+void test_ring_queue(void);
+
+int main(void)
+{
+    test_ring_queue();
+    return 0;
+}
+
+void test_ring_queue(void)
+{
+    thr_pool_options_t opts;
+    thr_pool_options_init(&opts);
+    opts.min_threads = 2;
+    opts.max_threads = 4;
+    opts.queue_mode = THR_QUEUE_RING;
+    opts.queue_capacity = 100;  /* small enough to overflow on the list */
+
+    thr_pool_t pool;
+    int err = thr_pool_create_ex(&pool, &opts);
+    if (err) {
+        fprintf(stderr, "thr_pool_create_ex() failed!\n");
+        exit(EXIT_FAILURE);
+    }
+    ASSERT_NOT_NULL(pool.ring);
+
+    pthread_t producers[NUM_PRODUCERS];
+    for (int i = 0; i < NUM_PRODUCERS; i++)
+        pthread_create(&producers[i], NULL, producer, &pool);
+    for (int i = 0; i < NUM_PRODUCERS; i++)
+        pthread_join(producers[i], NULL);
+
+    thr_pool_wait(&pool);
+
+    pthread_mutex_lock(&pool.mutex);
+    ASSERT_EQ_INT((int)counter, NUM_PRODUCERS * JOBS_PER_PRODUCER);
+    ASSERT_EQ_INT((int)pool.pending, 0);
+    ASSERT_EQ_INT(pool.status & THR_POOL_WAIT, 0);
+    ASSERT_LE_INT(pool.nthreads, opts.max_threads);
+    ASSERT_IS_NULL(pool.job_head);
+    pthread_mutex_unlock(&pool.mutex);
+
+    thr_pool_destroy(&pool);
+
+    ASSERT_NE_INT(pool.status & THR_POOL_DESTROY, 0);
+    ASSERT_EQ_INT(pool.nthreads, 0);
+    ASSERT_EQ_INT(pool.idle, 0);
+    ASSERT_IS_NULL(pool.ring);
+}
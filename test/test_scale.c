@@ -0,0 +1,220 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "../src/thrpool.h"
+#include "../src/thrpool_scale.h"
+#include "../src/thrpool_assert.h"
+#include <stdlib.h>
+#include <sched.h>
+#include <time.h>
+
+#define MS 1000000ULL
+
+int decisions = 0;
+int count = 0;
+
+void sleep_ms(long ms)
+{
+    struct timespec ts = {ms / 1000, (ms % 1000) * 1000000L};
+    nanosleep(&ts, NULL);
+}
+
+void *sleep_task(void *arg)
+{
+    sleep_ms((long) arg);
+    __atomic_add_fetch(&count, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+/* A policy asking for three workers, whatever happens */
+int fixed_decide(void *ctx, const thr_scale_sample_t *sample)
+{
+    __atomic_add_fetch(&decisions, 1, __ATOMIC_RELAXED);
+    return *(int *) ctx;
+}
+
+/* Poll the pool until cond(pool) holds, for 10 seconds at most */
+void wait_for(thr_pool_t *pool, int (*cond)(thr_pool_t *))
+{
+    for (int i = 0; i < 10000 && !cond(pool); i++)
+        sleep_ms(1);
+    ASSERT(cond(pool));
+}
+
+int one_thread(thr_pool_t *pool)
+{
+    return __atomic_load_n(&pool->nthreads, __ATOMIC_ACQUIRE) == 1;
+}
+
+int shrunk(thr_pool_t *pool)
+{
+    thr_pool_stats_t stats;
+    thr_pool_stats(pool, &stats);
+    return stats.scale_downs > 0 && stats.nthreads <= stats.target;
+}
+
+void test_hill_climbing(void);
+void test_custom_policy(void);
+void test_default_policy(void);
+void test_timeout_ms(void);
+
+int main(void)
+{
+    test_hill_climbing();
+    test_custom_policy();
+    test_default_policy();
+    test_timeout_ms();
+    return 0;
+}
+
+void test_hill_climbing(void)
+{
+    thr_hill_t hill;
+    int t;
+    thr_scale_sample_t s = {
+        .interval_ns = 100 * MS, .completed = 1000, .wait_ns = 5 * MS,
+        .depth = 50, .nthreads = 2, .idle = 0, .target = 2,
+        .min = 1, .max = 8
+    };
+    thr_hill_init(&hill, 1 * MS, 3);
+
+    /* Jobs wait too long: climb */
+    t = thr_hill_decide(&hill, &s);
+    ASSERT_EQ_INT(t, 3);
+
+    /* The new worker paid off: climb again */
+    s.nthreads = s.target = 3;
+    s.completed = 1500;
+    t = thr_hill_decide(&hill, &s);
+    ASSERT_EQ_INT(t, 4);
+
+    /* No gain: hold the size for a while */
+    s.nthreads = s.target = 4;
+    s.completed = 1510;
+    t = thr_hill_decide(&hill, &s);
+    ASSERT_EQ_INT(t, 4);
+    for (int i = 0; i < 4; i++) {
+        t = thr_hill_decide(&hill, &s);
+        ASSERT_EQ_INT(t, 4);
+    }
+    t = thr_hill_decide(&hill, &s);
+    ASSERT_EQ_INT(t, 5);
+
+    /* The throughput collapsed after that worker: step back */
+    s.nthreads = s.target = 5;
+    s.completed = 1000;
+    t = thr_hill_decide(&hill, &s);
+    ASSERT_EQ_INT(t, 4);
+
+    /* Jobs wait and none completes: grow at once */
+    s.nthreads = s.target = 4;
+    s.completed = 0;
+    t = thr_hill_decide(&hill, &s);
+    ASSERT_EQ_INT(t, 5);
+
+    /* Idle, shrink after three quiet decisions only */
+    s.nthreads = s.target = 5;
+    s.depth = 0;
+    s.idle = 3;
+    s.completed = 10;
+    t = thr_hill_decide(&hill, &s);
+    ASSERT_EQ_INT(t, 5);
+    t = thr_hill_decide(&hill, &s);
+    ASSERT_EQ_INT(t, 5);
+    t = thr_hill_decide(&hill, &s);
+    ASSERT_EQ_INT(t, 4);
+}
+
+void test_custom_policy(void)
+{
+    int want = 3;
+    thr_scale_policy_t policy = { fixed_decide, &want };
+    thr_pool_options_t opts;
+    thr_pool_stats_t stats;
+    thr_pool_t pool;
+
+    thr_pool_options_init(&opts);
+    opts.min_threads = 1;
+    opts.max_threads = 8;
+    opts.deque_capacity = 0;
+    opts.scale_interval_ms = 5;
+    opts.scale_policy = &policy;
+    int err = thr_pool_create_ex(&pool, &opts);
+    if (err) {
+        fprintf(stderr, "thr_pool_create_ex() failed!\n");
+        exit(EXIT_FAILURE);
+    }
+    ASSERT_EQ_INT(pool.target, 1);
+
+    count = 0;
+    for (int i = 0; i < 40; i++)
+        thr_pool_add(&pool, sleep_task, (void *) 2L);
+    thr_pool_wait(&pool);
+    ASSERT_EQ_INT(count, 40);
+    ASSERT_GT_INT(__atomic_load_n(&decisions, __ATOMIC_RELAXED), 0);
+
+    /* Never above the target, however long the queue */
+    thr_pool_stats(&pool, &stats);
+    ASSERT_EQ_INT(stats.target, 3);
+    ASSERT_LE_INT(stats.nthreads, 3);
+    ASSERT_LE_INT((int) stats.spawned, 3);
+    ASSERT_EQ_INT((int) stats.scale_ups, 1);
+    ASSERT_GT_INT((int) stats.throttled, 0);
+    thr_pool_destroy(&pool);
+}
+
+void test_default_policy(void)
+{
+    thr_pool_options_t opts;
+    thr_pool_stats_t stats;
+    thr_pool_t pool;
+
+    thr_pool_options_init(&opts);
+    opts.min_threads = 1;
+    opts.max_threads = 8;
+    opts.timeout_ms = 10;
+    opts.deque_capacity = 0;
+    opts.scale_interval_ms = 5;
+    opts.scale_shrink_after = 2;
+    int err = thr_pool_create_ex(&pool, &opts);
+    ASSERT_EQ_INT(err, 0);
+
+    /* Blocking jobs starve a single worker, the pool grows step by step */
+    count = 0;
+    for (int i = 0; i < 64; i++)
+        thr_pool_add(&pool, sleep_task, (void *) 10L);
+    thr_pool_wait(&pool);
+    thr_pool_stats(&pool, &stats);
+    ASSERT_EQ_INT(count, 64);
+    ASSERT_GT_INT((int) stats.scale_ups, 0);
+    ASSERT_GT_INT((int) stats.spawned, 1);
+    ASSERT_GT_INT((int) stats.throttled, 0);
+
+    /* Then shrinks once idle, through the idle timeout */
+    wait_for(&pool, shrunk);
+    thr_pool_destroy(&pool);
+}
+
+void test_timeout_ms(void)
+{
+    thr_pool_options_t opts;
+    thr_pool_t pool;
+
+    thr_pool_options_init(&opts);
+    opts.min_threads = 1;
+    opts.max_threads = 4;
+    opts.timeout = 60;
+    opts.timeout_ms = 20;
+    int err = thr_pool_create_ex(&pool, &opts);
+    ASSERT_EQ_INT(err, 0);
+    ASSERT_EQ_INT(pool.target, 4);
+
+    count = 0;
+    for (int i = 0; i < 4; i++)
+        thr_pool_add(&pool, sleep_task, (void *) 10L);
+    thr_pool_wait(&pool);
+    ASSERT_EQ_INT(count, 4);
+
+    /* Milliseconds, not the 60 seconds of timeout */
+    wait_for(&pool, one_thread);
+    thr_pool_destroy(&pool);
+}
@@ -0,0 +1,194 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "../src/thrpool.h"
+#include "../src/thrpool_assert.h"
+#include <stdlib.h>
+#include <errno.h>
+#include <sched.h>
+#include <time.h>
+
+#define NJOBS 50
+
+thr_pool_t pool;
+int count = 0;
+int started = 0;
+int shutdown_err = 0;
+
+void sleep_ms(long ms)
+{
+    struct timespec ts = {ms / 1000, (ms % 1000) * 1000000L};
+    nanosleep(&ts, NULL);
+}
+
+void *count_task(void *arg)
+{
+    if (arg != NULL) sleep_ms((long) arg);
+    __atomic_add_fetch(&count, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+/* Announce itself, then take ms milliseconds */
+void *slow_task(void *arg)
+{
+    __atomic_store_n(&started, 1, __ATOMIC_RELEASE);
+    sleep_ms((long) arg);
+    __atomic_add_fetch(&count, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+/* Add the next link of the chain from the worker */
+void *chain_task(void *arg)
+{
+    long n = (long) arg;
+    __atomic_store_n(&started, 1, __ATOMIC_RELEASE);
+    sleep_ms(1);
+    __atomic_add_fetch(&count, 1, __ATOMIC_RELEASE);
+    if (n > 0) {
+        int err = thr_pool_add(&pool, chain_task, (void *) (n - 1));
+        ASSERT_EQ_INT(err, 0);
+    }
+    return NULL;
+}
+
+void *shutdown_task(void *arg)
+{
+    shutdown_err = thr_pool_shutdown(&pool, THR_SHUTDOWN_DRAIN, NULL);
+    return arg;
+}
+
+void wait_started(void)
+{
+    while (!__atomic_load_n(&started, __ATOMIC_ACQUIRE))
+        sched_yield();
+}
+
+void create_pool(int min, int max)
+{
+    thr_pool_options_t opts;
+    thr_pool_options_init(&opts);
+    opts.min_threads = min;
+    opts.max_threads = max;
+    opts.cooperative = 1;
+    int err = thr_pool_create_ex(&pool, &opts);
+    if (err) {
+        fprintf(stderr, "thr_pool_create_ex() failed!\n");
+        exit(EXIT_FAILURE);
+    }
+    count = 0;
+    started = 0;
+}
+
+void test_drain(void);
+void test_drain_chain(void);
+void test_discard(void);
+void test_deadline(void);
+void test_from_worker(void);
+void test_cooperative_destroy(void);
+
+int main(void)
+{
+    test_drain();
+    test_drain_chain();
+    test_discard();
+    test_deadline();
+    test_from_worker();
+    test_cooperative_destroy();
+    return 0;
+}
+
+void test_drain(void)
+{
+    create_pool(1, 4);
+    for (int i = 0; i < NJOBS; i++)
+        thr_pool_add(&pool, count_task, (void *) 1L);
+
+    int err = thr_pool_shutdown(&pool, THR_SHUTDOWN_DRAIN, NULL);
+    ASSERT_EQ_INT(err, 0);
+    ASSERT_EQ_INT(__atomic_load_n(&count, __ATOMIC_ACQUIRE), NJOBS);
+    ASSERT_EQ_INT(pool.nthreads, 0);
+
+    /* Stopped for good */
+    err = thr_pool_add(&pool, count_task, NULL);
+    ASSERT_EQ_INT(err, ECANCELED);
+    err = thr_pool_add_delayed(&pool, 0, count_task, NULL, NULL);
+    ASSERT_EQ_INT(err, ECANCELED);
+    err = thr_pool_shutdown(&pool, 2, NULL);
+    ASSERT_EQ_INT(err, EINVAL);
+    thr_pool_destroy(&pool);
+}
+
+void test_drain_chain(void)
+{
+    create_pool(1, 2);
+    thr_pool_add(&pool, chain_task, (void *) 9L);
+    wait_started();
+
+    /* The jobs added by the running ones still get in */
+    int err = thr_pool_shutdown(&pool, THR_SHUTDOWN_DRAIN, NULL);
+    ASSERT_EQ_INT(err, 0);
+    ASSERT_EQ_INT(__atomic_load_n(&count, __ATOMIC_ACQUIRE), 10);
+    thr_pool_destroy(&pool);
+}
+
+void test_discard(void)
+{
+    thr_pool_stats_t stats;
+    create_pool(1, 1);
+    thr_pool_add(&pool, slow_task, (void *) 20L);
+    wait_started();
+    for (int i = 0; i < NJOBS; i++)
+        thr_pool_add(&pool, count_task, NULL);
+
+    /* The running job returns, the queued ones are dropped */
+    int err = thr_pool_shutdown(&pool, THR_SHUTDOWN_DISCARD, NULL);
+    ASSERT_EQ_INT(err, 0);
+    ASSERT_EQ_INT(__atomic_load_n(&count, __ATOMIC_ACQUIRE), 1);
+    thr_pool_stats(&pool, &stats);
+    ASSERT_EQ_INT((int) stats.failed, NJOBS);
+    ASSERT_EQ_INT((int) stats.completed, 1);
+    thr_pool_destroy(&pool);
+}
+
+void test_deadline(void)
+{
+    struct timespec deadline;
+    create_pool(1, 1);
+    thr_pool_add(&pool, slow_task, (void *) 200L);
+    wait_started();
+
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_nsec += 20000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+    int err = thr_pool_shutdown(&pool, THR_SHUTDOWN_DRAIN, &deadline);
+    ASSERT_EQ_INT(err, ETIMEDOUT);
+    ASSERT_EQ_INT(__atomic_load_n(&count, __ATOMIC_ACQUIRE), 0);
+
+    /* Then wait for good */
+    err = thr_pool_shutdown(&pool, THR_SHUTDOWN_DRAIN, NULL);
+    ASSERT_EQ_INT(err, 0);
+    ASSERT_EQ_INT(__atomic_load_n(&count, __ATOMIC_ACQUIRE), 1);
+    thr_pool_destroy(&pool);
+}
+
+void test_from_worker(void)
+{
+    create_pool(1, 2);
+    thr_pool_add(&pool, shutdown_task, NULL);
+    thr_pool_wait(&pool);
+    ASSERT_EQ_INT(shutdown_err, EDEADLK);
+    thr_pool_destroy(&pool);
+}
+
+void test_cooperative_destroy(void)
+{
+    create_pool(1, 1);
+    thr_pool_add(&pool, slow_task, (void *) 20L);
+    wait_started();
+
+    /* The running job is waited for, not cancelled */
+    thr_pool_destroy(&pool);
+    ASSERT_EQ_INT(__atomic_load_n(&count, __ATOMIC_ACQUIRE), 1);
+}
@@ -0,0 +1,141 @@
+#include "../src/thrpool.h"
+#include "../src/thrpool_slab.h"
+#include "../src/thrpool_assert.h"
+#include <stdlib.h>
+#include <pthread.h>
+#include <sched.h>
+
+#define NUM_NODES 10000
+#define NUM_PRODUCERS 8
+#define NUM_JOBS 2000
+
+thr_pool_t pool;
+int count = 0;
+
+void *count_task(void *arg)
+{
+    __atomic_add_fetch(&count, 1, __ATOMIC_RELAXED);
+    return arg;
+}
+
+void *producer_thread(void *arg)
+{
+    for (int i = 0; i < NUM_JOBS; i++)
+        thr_pool_add(&pool, count_task, arg);
+    return NULL;
+}
+
+/* Nodes neither in the depot nor in the cache of a worker */
+int nodes_out(void)
+{
+    thr_slab_t *slab = (thr_slab_t *) pool.jobs;
+    long out = (long) slab->nslabs * slab->per_slab - (long) slab->nfree;
+    for (int i = 0; i < pool.max; i++)
+        out -= pool.workers[i].job_ncache;
+    return (int) out;
+}
+
+void test_slab_burst(void);
+void test_producer_caches(void);
+void test_cache_outlives_pool(void);
+
+int main(void)
+{
+    test_slab_burst();
+    test_producer_caches();
+    test_cache_outlives_pool();
+    return 0;
+}
+
+void test_slab_burst(void)
+{
+    const size_t high_water = 256;
+    thr_slab_t slab;
+    void *cache = NULL;
+    int ncache = 0;
+    void **nodes = (void **) malloc(NUM_NODES * sizeof(void *));
+
+    int err = thr_slab_init(&slab, 48, 16, high_water);
+    ASSERT_EQ_INT(err, 0);
+
+    /* a burst: every node is in use at the same time */
+    for (int i = 0; i < NUM_NODES; i++) {
+        nodes[i] = thr_slab_alloc(&slab, i % 2 ? &cache : NULL,
+                                  i % 2 ? &ncache : NULL);
+        ASSERT_NOT_NULL(nodes[i]);
+        /* nodes are distinct and writable */
+        ((long *)nodes[i])[5] = i;
+    }
+    for (int i = 0; i < NUM_NODES; i++)
+        ASSERT_EQ_INT((int)((long *)nodes[i])[5], i);
+    ASSERT_GE_INT((int)slab.nslabs, NUM_NODES / slab.per_slab);
+
+    for (int i = 0; i < NUM_NODES; i++) {
+        thr_slab_free(&slab, i % 2 ? &cache : NULL,
+                      i % 2 ? &ncache : NULL, nodes[i]);
+        ASSERT_LE_INT(ncache, 16);
+    }
+    thr_slab_flush(&slab, &cache, &ncache);
+    ASSERT_IS_NULL(cache);
+    ASSERT_EQ_INT(ncache, 0);
+
+    /* after the burst, at most high_water free nodes stay around */
+    ASSERT_LE_INT((int)slab.nfree, (int)high_water + slab.per_slab);
+
+    thr_slab_destroy(&slab);
+    ASSERT_EQ_INT((int)slab.nslabs, 0);
+    free(nodes);
+}
+
+void test_producer_caches(void)
+{
+    pthread_t threads[NUM_PRODUCERS];
+
+    int err = thr_pool_create(&pool, 1, 4, -1, NULL);
+    ASSERT_EQ_INT(err, 0);
+    count = 0;
+
+    /* Each producer caches nodes, and gives them back when it exits */
+    for (int i = 0; i < NUM_PRODUCERS; i++)
+        pthread_create(&threads[i], NULL, producer_thread, NULL);
+    for (int i = 0; i < NUM_PRODUCERS; i++)
+        pthread_join(threads[i], NULL);
+    thr_pool_wait(&pool);
+    ASSERT_EQ_INT(__atomic_load_n(&count, __ATOMIC_RELAXED),
+                  NUM_PRODUCERS * NUM_JOBS);
+    ASSERT_EQ_INT(nodes_out(), 0);
+    thr_pool_destroy(&pool);
+}
+
+void *step_thread(void *arg)
+{
+    int *step = (int *) arg;
+    for (int round = 1; round <= 2; round++) {
+        while (__atomic_load_n(step, __ATOMIC_ACQUIRE) != 2 * round - 1)
+            sched_yield();
+        producer_thread(NULL);
+        __atomic_store_n(step, 2 * round, __ATOMIC_RELEASE);
+    }
+    return NULL;
+}
+
+void test_cache_outlives_pool(void)
+{
+    pthread_t thread;
+    int step = 0;
+
+    /* A producer keeps its cache across a pool at the same address */
+    pthread_create(&thread, NULL, step_thread, &step);
+    for (int round = 1; round <= 2; round++) {
+        int err = thr_pool_create(&pool, 1, 2, -1, NULL);
+        ASSERT_EQ_INT(err, 0);
+        count = 0;
+        __atomic_store_n(&step, 2 * round - 1, __ATOMIC_RELEASE);
+        while (__atomic_load_n(&step, __ATOMIC_ACQUIRE) != 2 * round)
+            sched_yield();
+        thr_pool_wait(&pool);
+        ASSERT_EQ_INT(__atomic_load_n(&count, __ATOMIC_RELAXED), NUM_JOBS);
+        thr_pool_destroy(&pool);
+    }
+    pthread_join(thread, NULL);
+}
@@ -0,0 +1,117 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "../src/thrpool.h"
+#include "../src/thrpool_assert.h"
+#include <stdlib.h>
+#include <time.h>
+
+int count = 0;
+
+void sleep_ms(long ms)
+{
+    struct timespec ts = {ms / 1000, (ms % 1000) * 1000000L};
+    nanosleep(&ts, NULL);
+}
+
+void *count_task(void *arg)
+{
+    if (arg != NULL) sleep_ms((long) arg);
+    __atomic_add_fetch(&count, 1, __ATOMIC_RELAXED);
+    return NULL;
+}
+
+/* Poll the pool until cond(pool) holds, for 10 seconds at most */
+void wait_for(thr_pool_t *pool, int (*cond)(thr_pool_t *))
+{
+    for (int i = 0; i < 10000 && !cond(pool); i++)
+        sleep_ms(1);
+    ASSERT(cond(pool));
+}
+
+int all_idle(thr_pool_t *pool)
+{
+    return __atomic_load_n(&pool->idle, __ATOMIC_ACQUIRE) == pool->min;
+}
+
+void test_prewarm(void);
+void test_on_demand(void);
+void test_destroy_spawning(void);
+
+int main(void)
+{
+    test_prewarm();
+    test_on_demand();
+    test_destroy_spawning();
+    return 0;
+}
+
+void test_prewarm(void)
+{
+    thr_pool_options_t opts;
+    thr_pool_stats_t stats;
+    thr_pool_t pool;
+
+    thr_pool_options_init(&opts);
+    opts.min_threads = 3;
+    opts.max_threads = 4;
+    opts.prewarm = 1;
+    int err = thr_pool_create_ex(&pool, &opts);
+    if (err) {
+        fprintf(stderr, "thr_pool_create_ex() failed!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    /* The workers exist before the first job */
+    thr_pool_stats(&pool, &stats);
+    ASSERT_EQ_INT(stats.nthreads, 3);
+    ASSERT_EQ_INT((int) stats.spawned, 3);
+    ASSERT_EQ_INT(pool.spawning, 0);
+    wait_for(&pool, all_idle);
+
+    count = 0;
+    for (int i = 0; i < 3; i++)
+        thr_pool_add(&pool, count_task, NULL);
+    thr_pool_wait(&pool);
+    ASSERT_EQ_INT(__atomic_load_n(&count, __ATOMIC_RELAXED), 3);
+    thr_pool_destroy(&pool);
+}
+
+void test_on_demand(void)
+{
+    thr_pool_stats_t stats;
+    thr_pool_t pool;
+
+    int err = thr_pool_create(&pool, 2, 4, 60, NULL);
+    ASSERT_EQ_INT(err, 0);
+    thr_pool_stats(&pool, &stats);
+    ASSERT_EQ_INT(stats.nthreads, 0);
+    ASSERT_EQ_INT((int) stats.spawned, 0);
+
+    /* The spawner creates the workers the jobs ask for */
+    count = 0;
+    for (int i = 0; i < 16; i++)
+        thr_pool_add(&pool, count_task, (void *) 2L);
+    thr_pool_wait(&pool);
+    thr_pool_stats(&pool, &stats);
+    ASSERT_EQ_INT(__atomic_load_n(&count, __ATOMIC_RELAXED), 16);
+    ASSERT_GT_INT((int) stats.spawned, 0);
+    ASSERT_LE_INT((int) stats.spawned, 4);
+    ASSERT_LE_INT(stats.nthreads, 4);
+    thr_pool_destroy(&pool);
+}
+
+void test_destroy_spawning(void)
+{
+    thr_pool_t pool;
+
+    /* Destroy right after claiming slots the spawner did not fill yet */
+    for (int round = 0; round < 100; round++) {
+        int err = thr_pool_create(&pool, 0, 8, 60, NULL);
+        ASSERT_EQ_INT(err, 0);
+        for (int i = 0; i < 8; i++)
+            thr_pool_add(&pool, count_task, NULL);
+        thr_pool_destroy(&pool);
+        ASSERT_EQ_INT(pool.nthreads, 0);
+        ASSERT_EQ_INT(pool.spawning, 0);
+    }
+}
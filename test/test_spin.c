@@ -0,0 +1,80 @@
+#include "../src/thrpool.h"
+#include "../src/thrpool_assert.h"
+#include <stdlib.h>
+#include <sched.h>
+
+#define NJOBS 20000
+
+int done = 0;
+
+void *count_task(void *arg)
+{
+    __atomic_add_fetch(&done, 1, __ATOMIC_RELAXED);
+    return arg;
+}
+
+void run_pool(int queue_mode, int spin_count, int yield_count, int adaptive);
+void test_spin_then_park(void);
+void test_no_spin(void);
+
+int main(void)
+{
+    test_spin_then_park();
+    test_no_spin();
+    return 0;
+}
+
+void run_pool(int queue_mode, int spin_count, int yield_count, int adaptive)
+{
+    thr_pool_t pool;
+    thr_pool_options_t opts;
+    thr_idle_stats_t stats;
+
+    thr_pool_options_init(&opts);
+    opts.min_threads = 2;
+    opts.max_threads = 4;
+    opts.queue_mode = queue_mode;
+    opts.spin_count = spin_count;
+    opts.yield_count = yield_count;
+    opts.adaptive_spin = adaptive;
+    int err = thr_pool_create_ex(&pool, &opts);
+    if (err) {
+        fprintf(stderr, "thr_pool_create_ex() failed!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    /* trickle jobs so that workers go idle between them */
+    done = 0;
+    for (int i = 0; i < NJOBS; i++) {
+        err = thr_pool_add(&pool, count_task, NULL);
+        ASSERT_EQ_INT(err, 0);
+        if (i % 64 == 0) sched_yield();
+    }
+    thr_pool_wait(&pool);
+    ASSERT_EQ_INT(done, NJOBS);
+
+    thr_pool_idle_stats(&pool, &stats);
+    if (spin_count == 0 && yield_count == 0) {
+        ASSERT_EQ_INT((int) stats.spin, 0);
+        ASSERT_EQ_INT((int) stats.yield, 0);
+    }
+    ASSERT_LE_INT((int) (stats.spin + stats.yield + stats.park), NJOBS);
+
+    thr_pool_destroy(&pool);
+    ASSERT_EQ_INT(pool.nthreads, 0);
+    ASSERT_EQ_INT(pool.spinning, 0);
+}
+
+void test_spin_then_park(void)
+{
+    run_pool(THR_QUEUE_LIST, 4096, 4, 0);
+    run_pool(THR_QUEUE_RING, 4096, 4, 0);
+    run_pool(THR_QUEUE_LIST, 4096, 0, 1);
+    run_pool(THR_QUEUE_RING, 0, 8, 1);
+}
+
+void test_no_spin(void)
+{
+    run_pool(THR_QUEUE_LIST, 0, 0, 0);
+    run_pool(THR_QUEUE_RING, 0, 0, 0);
+}
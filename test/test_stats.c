@@ -0,0 +1,79 @@
+#include "../src/thrpool.h"
+#include "../src/thrpool_assert.h"
+#include <stdlib.h>
+#include <errno.h>
+
+#define NJOBS 1000
+
+void *quick_task(void *arg) { return arg; }
+
+/* Add jobs from inside a worker, counted by that worker */
+void *spawn_task(void *arg)
+{
+    thr_pool_t *pool = (thr_pool_t *) arg;
+    for (int i = 0; i < 10; i++)
+        thr_pool_add(pool, quick_task, NULL);
+    return NULL;
+}
+
+unsigned long hist_total(const unsigned long *hist);
+void test_stats(int queue_mode);
+
+int main(void)
+{
+    test_stats(THR_QUEUE_LIST);
+    test_stats(THR_QUEUE_RING);
+    return 0;
+}
+
+unsigned long hist_total(const unsigned long *hist)
+{
+    unsigned long total = 0;
+    for (int b = 0; b < THR_HIST_BUCKETS; b++) total += hist[b];
+    return total;
+}
+
+void test_stats(int queue_mode)
+{
+    thr_pool_t pool;
+    thr_pool_options_t opts;
+    thr_pool_stats_t stats;
+
+    thr_pool_options_init(&opts);
+    opts.min_threads = 1;
+    opts.max_threads = 4;
+    opts.queue_mode = queue_mode;
+    int err = thr_pool_create_ex(&pool, &opts);
+    if (err) {
+        fprintf(stderr, "thr_pool_create_ex() failed!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    err = thr_pool_stats(&pool, &stats);
+    ASSERT_EQ_INT(err, 0);
+    ASSERT_EQ_INT((int) stats.enqueued, 0);
+    ASSERT_EQ_INT((int) stats.depth, 0);
+
+    for (int i = 0; i < NJOBS; i++)
+        thr_pool_add(&pool, quick_task, NULL);
+    thr_pool_add(&pool, spawn_task, &pool);
+    thr_pool_wait(&pool);
+
+    err = thr_pool_stats(&pool, &stats);
+    ASSERT_EQ_INT(err, 0);
+    ASSERT_EQ_INT((int) stats.enqueued, NJOBS + 11);
+    ASSERT_EQ_INT((int) stats.completed, NJOBS + 11);
+    ASSERT_EQ_INT((int) stats.failed, 0);
+    ASSERT_EQ_INT((int) stats.depth, 0);
+    ASSERT_GE_INT((int) stats.peak_depth, 1);
+    ASSERT_EQ_INT((int) hist_total(stats.wait_hist), NJOBS + 11);
+    ASSERT_EQ_INT((int) hist_total(stats.run_hist), NJOBS + 11);
+    ASSERT_GE_INT((int) stats.spawned, 1);
+    ASSERT_GE_INT(stats.nthreads, 1);
+    ASSERT_LE_INT(stats.idle, stats.nthreads);
+
+    err = thr_pool_stats(&pool, NULL);
+    ASSERT_EQ_INT(err, EINVAL);
+
+    thr_pool_destroy(&pool);
+}
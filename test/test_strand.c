@@ -0,0 +1,242 @@
+#include "../src/thrpool.h"
+#include "../src/thrpool_assert.h"
+#include <stdlib.h>
+#include <errno.h>
+#include <pthread.h>
+
+#define NSTRANDS 4
+#define NJOBS 2000
+#define NPRODUCERS 2
+#define NFED (1000 * THR_STRAND_BATCH + 1)
+
+/* The state a strand protects, never touched by two workers at once */
+typedef struct shard {
+    thr_strand_t strand;
+    int inside;         /* jobs running, must stay at most 1 */
+    int overlaps;
+    long next[NPRODUCERS];  /* next sequence number of each producer */
+    long disorders;
+    long count;
+} shard_t;
+
+typedef struct msg {
+    shard_t *shard;
+    int producer;
+    long seq;
+} msg_t;
+
+thr_pool_t pool;
+shard_t shards[NSTRANDS];
+long fed = 0;           /* jobs run by the strand of fed_task() */
+long plain_at = -1;     /* the value of fed when plain_task() ran */
+
+void *msg_task(void *arg)
+{
+    msg_t *msg = (msg_t *) arg;
+    shard_t *shard = msg->shard;
+
+    if (__atomic_add_fetch(&shard->inside, 1, __ATOMIC_ACQUIRE) != 1)
+        __atomic_add_fetch(&shard->overlaps, 1, __ATOMIC_RELAXED);
+    /* Plain accesses: the strand orders the jobs */
+    if (shard->next[msg->producer] != msg->seq)
+        shard->disorders++;
+    shard->next[msg->producer] = msg->seq + 1;
+    shard->count++;
+    __atomic_sub_fetch(&shard->inside, 1, __ATOMIC_RELEASE);
+    free(msg);
+    return NULL;
+}
+
+int post(shard_t *shard, int producer, long seq)
+{
+    msg_t *msg = (msg_t *) malloc(sizeof(msg_t));
+    msg->shard = shard;
+    msg->producer = producer;
+    msg->seq = seq;
+    int err = thr_pool_add_strand(&pool, &shard->strand, msg_task, msg);
+    if (err) free(msg);
+    return err;
+}
+
+void *producer_thread(void *arg)
+{
+    int producer = (int) (long) arg;
+    for (long seq = 0; seq < NJOBS; seq++) {
+        for (int i = 0; i < NSTRANDS; i++)
+            post(&shards[i], producer, seq);
+    }
+    return NULL;
+}
+
+void *block_task(void *arg)
+{
+    pthread_mutex_t *lock = (pthread_mutex_t *) arg;
+    pthread_mutex_lock(lock);
+    pthread_mutex_unlock(lock);
+    return NULL;
+}
+
+/* Add the next job of the strand, until plain_task() ran */
+void *fed_task(void *arg)
+{
+    long n = __atomic_add_fetch(&fed, 1, __ATOMIC_RELAXED);
+    if (n < NFED && __atomic_load_n(&plain_at, __ATOMIC_RELAXED) < 0)
+        thr_pool_add_strand(&pool, &shards[0].strand, fed_task, NULL);
+    return arg;
+}
+
+void *plain_task(void *arg)
+{
+    __atomic_store_n(&plain_at, __atomic_load_n(&fed, __ATOMIC_RELAXED),
+                     __ATOMIC_RELAXED);
+    return arg;
+}
+
+void init_shards(void)
+{
+    for (int i = 0; i < NSTRANDS; i++) {
+        shard_t *shard = &shards[i];
+        int err = thr_strand_init(&shard->strand);
+        ASSERT_EQ_INT(err, 0);
+        shard->inside = 0;
+        shard->overlaps = 0;
+        for (int p = 0; p < NPRODUCERS; p++)
+            shard->next[p] = 0;
+        shard->disorders = 0;
+        shard->count = 0;
+    }
+}
+
+void test_order(void);
+void test_producers(void);
+void test_batches(void);
+void test_fed(void);
+void test_destroy_queued(void);
+
+int main(void)
+{
+    int err = thr_pool_create(&pool, 1, 4, 60, NULL);
+    if (err) {
+        fprintf(stderr, "thr_pool_create() failed!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    test_order();
+    test_producers();
+    thr_pool_destroy(&pool);
+
+    test_batches();
+    test_fed();
+    test_destroy_queued();
+    return 0;
+}
+
+void test_order(void)
+{
+    init_shards();
+    producer_thread((void *) 0L);
+    thr_pool_wait(&pool);
+    for (int i = 0; i < NSTRANDS; i++) {
+        ASSERT_EQ_INT(shards[i].overlaps, 0);
+        ASSERT_EQ_INT((int) shards[i].disorders, 0);
+        ASSERT_EQ_INT((int) shards[i].count, NJOBS);
+        ASSERT_EQ_INT((int) shards[i].strand.count, 0);
+    }
+
+    int err = thr_pool_add_strand(&pool, NULL, msg_task, NULL);
+    ASSERT_EQ_INT(err, EINVAL);
+    err = thr_pool_add_strand(&pool, &shards[0].strand, NULL, NULL);
+    ASSERT_EQ_INT(err, EINVAL);
+}
+
+void test_producers(void)
+{
+    pthread_t threads[NPRODUCERS];
+
+    /* Each producer sees its own jobs in order */
+    init_shards();
+    for (long p = 0; p < NPRODUCERS; p++)
+        pthread_create(&threads[p], NULL, producer_thread, (void *) p);
+    for (int p = 0; p < NPRODUCERS; p++)
+        pthread_join(threads[p], NULL);
+    thr_pool_wait(&pool);
+    for (int i = 0; i < NSTRANDS; i++) {
+        ASSERT_EQ_INT(shards[i].overlaps, 0);
+        ASSERT_EQ_INT((int) shards[i].disorders, 0);
+        ASSERT_EQ_INT((int) shards[i].count, NPRODUCERS * NJOBS);
+    }
+}
+
+void test_batches(void)
+{
+    pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+    thr_pool_stats_t stats;
+
+    int err = thr_pool_create(&pool, 1, 1, 60, NULL);
+    ASSERT_EQ_INT(err, 0);
+
+    /* The backlog builds up behind a blocked worker */
+    init_shards();
+    pthread_mutex_lock(&lock);
+    thr_pool_add(&pool, block_task, &lock);
+    for (long seq = 0; seq < NJOBS; seq++)
+        post(&shards[0], 0, seq);
+    pthread_mutex_unlock(&lock);
+    thr_pool_wait(&pool);
+    ASSERT_EQ_INT((int) shards[0].count, NJOBS);
+    ASSERT_EQ_INT((int) shards[0].disorders, 0);
+
+    /* Then drains in batches, each one counted as a job */
+    int batches = (NJOBS + THR_STRAND_BATCH - 1) / THR_STRAND_BATCH;
+    if (thr_pool_stats(&pool, &stats) == 0)
+        ASSERT_EQ_INT((int) stats.completed, 1 + batches);
+
+    /* A refused job is reported, and leaves the strand empty */
+    thr_pool_shutdown(&pool, THR_SHUTDOWN_DRAIN, NULL);
+    err = post(&shards[1], 0, 0);
+    ASSERT_EQ_INT(err, ECANCELED);
+    ASSERT_EQ_INT((int) shards[1].strand.count, 0);
+    thr_pool_destroy(&pool);
+}
+
+void test_fed(void)
+{
+    int err = thr_pool_create(&pool, 1, 1, 60, NULL);
+    ASSERT_EQ_INT(err, 0);
+
+    /* A strand that never runs dry lets the other jobs in between batches */
+    init_shards();
+    err = thr_pool_add_strand(&pool, &shards[0].strand, fed_task, NULL);
+    ASSERT_EQ_INT(err, 0);
+    while (__atomic_load_n(&fed, __ATOMIC_RELAXED) == 0)
+        ;
+    thr_pool_add(&pool, plain_task, NULL);
+    thr_pool_wait(&pool);
+    ASSERT(plain_at >= 0 && plain_at < NFED);
+    int phase = (int) (plain_at % THR_STRAND_BATCH);
+    ASSERT_EQ_INT(phase, 0);
+    thr_pool_destroy(&pool);
+}
+
+void test_destroy_queued(void)
+{
+    pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+    thr_pool_options_t opts;
+
+    /* Destroyed with a strand waiting behind a blocked worker */
+    thr_pool_options_init(&opts);
+    opts.min_threads = 1;
+    opts.max_threads = 1;
+    opts.cooperative = 1;
+    int err = thr_pool_create_ex(&pool, &opts);
+    ASSERT_EQ_INT(err, 0);
+
+    init_shards();
+    pthread_mutex_lock(&lock);
+    thr_pool_add(&pool, block_task, &lock);
+    for (long seq = 0; seq < 100; seq++)
+        thr_pool_add_strand(&pool, &shards[0].strand, block_task, &lock);
+    pthread_mutex_unlock(&lock);
+    thr_pool_destroy(&pool);
+    ASSERT_EQ_INT((int) shards[0].strand.count, 0);
+}
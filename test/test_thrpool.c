@@ -1,6 +1,9 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include "../src/thrpool.h"
 #include "../src/thrpool_assert.h"
 #include <stdlib.h>
+#include <time.h>
 
 int counter = 0;
 pthread_mutex_t counter_lock = PTHREAD_MUTEX_INITIALIZER;
@@ -12,11 +15,28 @@ void *counter_func(void *arg) {
     return arg;
 }
 
+void *sleep_func(void *arg) {
+    struct timespec ts = {0, 1000000L};
+    nanosleep(&ts, NULL);
+    return counter_func(arg);
+}
+
+void *wait_func(void *arg) {
+    thr_pool_t *pool = (thr_pool_t *)arg;
+    thr_pool_wait(pool);
+    pthread_mutex_lock(&counter_lock);
+    int done = counter;
+    pthread_mutex_unlock(&counter_lock);
+    return (void *)(long)done;
+}
+
 void test_thr_pool(void);
+void test_concurrent_wait(void);
 
 int main(void)
 {
     test_thr_pool();
+    test_concurrent_wait();
     pthread_mutex_destroy(&counter_lock);
     return 0;
 }
@@ -45,7 +65,7 @@ void test_thr_pool(void)
     ASSERT_EQ_INT(pool.status, THR_POOL_NEW);
     ASSERT_EQ_INT(pool.nthreads, 0);
     ASSERT_EQ_INT(pool.idle, 0);
-    ASSERT_IS_NULL(pool.worker);
+    ASSERT_EQ_INT((int)pool.pending, 0);
     ASSERT_IS_NULL(pool.job_head);
     ASSERT_IS_NULL(pool.job_tail);
     pthread_mutex_unlock(&pool.mutex);
@@ -67,7 +87,7 @@ void test_thr_pool(void)
     ASSERT_EQ_INT(pool.status & THR_POOL_WAIT, 0);
     ASSERT_IS_NULL(pool.job_head);
     ASSERT_IS_NULL(pool.job_tail);
-    ASSERT_IS_NULL(pool.worker);
+    ASSERT_EQ_INT((int)pool.pending, 0);
     pthread_mutex_unlock(&pool.mutex);
 
     thr_pool_destroy(&pool);
@@ -76,7 +96,33 @@ void test_thr_pool(void)
     ASSERT_NE_INT(pool.status & THR_POOL_DESTROY, 0);
     ASSERT_EQ_INT(pool.nthreads, 0);
     ASSERT_EQ_INT(pool.idle, 0);
-    ASSERT_IS_NULL(pool.worker);
+    ASSERT_EQ_INT((int)pool.pending, 0);
     ASSERT_IS_NULL(pool.job_head);
     ASSERT_IS_NULL(pool.job_tail);
 }
+
+void test_concurrent_wait(void)
+{
+    int num_jobs = 100;
+    int num_waiters = 4;
+    pthread_t waiters[4];
+
+    thr_pool_t pool;
+    int err = thr_pool_create(&pool, 1, 4, 60, NULL);
+    ASSERT_EQ_INT(err, 0);
+
+    /* Every waiter returns once all the jobs are done */
+    counter = 0;
+    for (int i = 0; i < num_jobs; i++)
+        thr_pool_add(&pool, sleep_func, NULL);
+    for (int i = 0; i < num_waiters; i++)
+        pthread_create(&waiters[i], NULL, wait_func, &pool);
+    for (int i = 0; i < num_waiters; i++) {
+        void *done;
+        pthread_join(waiters[i], &done);
+        ASSERT_EQ_INT((int)(long)done, num_jobs);
+    }
+    ASSERT_EQ_INT((int)pool.pending, 0);
+    ASSERT_EQ_INT(pool.wait_waiters, 0);
+    thr_pool_destroy(&pool);
+}
@@ -0,0 +1,164 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "../src/thrpool.h"
+#include "../src/thrpool_assert.h"
+#include <stdlib.h>
+#include <errno.h>
+#include <sched.h>
+#include <time.h>
+
+#define NTIMERS 10000
+#define MS 1000000ULL
+
+typedef struct sample {
+    unsigned long long due;     /* earliest time the job may run */
+    unsigned long long ran;
+} sample_t;
+
+thr_pool_t pool;
+sample_t samples[NTIMERS];
+int count = 0;
+
+unsigned long long now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long) ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+void *count_task(void *arg)
+{
+    __atomic_add_fetch(&count, 1, __ATOMIC_RELAXED);
+    return arg;
+}
+
+void *stamp_task(void *arg)
+{
+    sample_t *s = (sample_t *) arg;
+    s->ran = now_ns();
+    __atomic_add_fetch(&count, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+/* Wait until count reaches n, for 10 seconds at most */
+void wait_count(int n)
+{
+    unsigned long long deadline = now_ns() + 10000 * MS;
+    while (__atomic_load_n(&count, __ATOMIC_ACQUIRE) < n) {
+        ASSERT(now_ns() < deadline);
+        sched_yield();
+    }
+}
+
+void sleep_ms(long ms)
+{
+    struct timespec ts = {ms / 1000, (ms % 1000) * 1000000L};
+    nanosleep(&ts, NULL);
+}
+
+void test_delayed(void);
+void test_periodic(void);
+void test_cancel(void);
+void test_destroy_pending(void);
+
+int main(void)
+{
+    int err = thr_pool_create(&pool, 1, 4, -1, NULL);
+    if (err) {
+        fprintf(stderr, "thr_pool_create() failed!\n");
+        exit(EXIT_FAILURE);
+    }
+    test_delayed();
+    test_periodic();
+    test_cancel();
+    thr_pool_destroy(&pool);
+
+    test_destroy_pending();
+    return 0;
+}
+
+void test_delayed(void)
+{
+    count = 0;
+    unsigned int seed = 1;
+    for (int i = 0; i < NTIMERS; i++) {
+        unsigned long long delay = (unsigned long long) (rand_r(&seed) % 50)
+                                   * MS;
+        samples[i].due = now_ns() + delay;
+        int err = thr_pool_add_delayed(&pool, delay, stamp_task,
+                                       &samples[i], NULL);
+        ASSERT_EQ_INT(err, 0);
+    }
+    wait_count(NTIMERS);
+
+    /* Never early */
+    for (int i = 0; i < NTIMERS; i++)
+        ASSERT(samples[i].ran >= samples[i].due);
+}
+
+void test_periodic(void)
+{
+    thr_timer_t *timer;
+    count = 0;
+
+    int err = thr_pool_add_periodic(&pool, 0, 0, count_task, NULL, &timer);
+    ASSERT_EQ_INT(err, EINVAL);
+
+    unsigned long long start = now_ns();
+    err = thr_pool_add_periodic(&pool, 2 * MS, 5 * MS, count_task, NULL,
+                                &timer);
+    ASSERT_EQ_INT(err, 0);
+    wait_count(5);
+    /* The first run after 2 ms, then one every 5 ms */
+    ASSERT(now_ns() - start >= 22 * MS);
+
+    err = thr_timer_cancel(timer);
+    ASSERT_EQ_INT(err, 0);
+    err = thr_timer_cancel(timer);
+    ASSERT_EQ_INT(err, EALREADY);
+    thr_timer_release(timer);
+
+    /* Runs already queued may still complete, no new one starts */
+    thr_pool_wait(&pool);
+    int after = __atomic_load_n(&count, __ATOMIC_ACQUIRE);
+    sleep_ms(30);
+    ASSERT_EQ_INT(__atomic_load_n(&count, __ATOMIC_ACQUIRE), after);
+}
+
+void test_cancel(void)
+{
+    thr_timer_t *pending, *fired;
+    count = 0;
+
+    int err = thr_pool_add_delayed(&pool, 10000 * MS, count_task, NULL,
+                                   &pending);
+    ASSERT_EQ_INT(err, 0);
+    err = thr_pool_add_delayed(&pool, 0, count_task, NULL, &fired);
+    ASSERT_EQ_INT(err, 0);
+    wait_count(1);
+
+    err = thr_timer_cancel(fired);
+    ASSERT_EQ_INT(err, EALREADY);
+    err = thr_timer_cancel(pending);
+    ASSERT_EQ_INT(err, 0);
+    thr_timer_release(fired);
+    thr_timer_release(pending);
+    ASSERT_EQ_INT(__atomic_load_n(&count, __ATOMIC_ACQUIRE), 1);
+}
+
+void test_destroy_pending(void)
+{
+    thr_pool_t local;
+    count = 0;
+
+    int err = thr_pool_create(&local, 1, 2, -1, NULL);
+    ASSERT_EQ_INT(err, 0);
+    for (int i = 0; i < 100; i++) {
+        err = thr_pool_add_delayed(&local, 10000 * MS, count_task, NULL,
+                                   NULL);
+        ASSERT_EQ_INT(err, 0);
+    }
+    thr_pool_destroy(&local);
+    ASSERT_EQ_INT(count, 0);
+    ASSERT_IS_NULL(local.wheel);
+}
@@ -0,0 +1,132 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "../src/thrpool.h"
+#include "../src/thrpool_assert.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#define NJOBS 100
+
+void *quick_task(void *arg) { return arg; }
+
+int count_matches(const char *text, const char *pattern);
+char *dump_trace(thr_pool_t *pool);
+void test_trace(void);
+void test_trace_wraps(void);
+void test_no_trace(void);
+
+int main(void)
+{
+    test_trace();
+    test_trace_wraps();
+    test_no_trace();
+    return 0;
+}
+
+int count_matches(const char *text, const char *pattern)
+{
+    int n = 0;
+    for (const char *p = text; (p = strstr(p, pattern)) != NULL; p++) n++;
+    return n;
+}
+
+/* Return the JSON written by thr_pool_trace_dump() */
+char *dump_trace(thr_pool_t *pool)
+{
+    FILE *f = tmpfile();
+    ASSERT_NOT_NULL(f);
+    int err = thr_pool_trace_dump(pool, f);
+    ASSERT_EQ_INT(err, 0);
+
+    long size = ftell(f);
+    char *text = (char *) malloc(size + 1);
+    rewind(f);
+    size_t nread = fread(text, 1, size, f);
+    ASSERT_EQ_INT((int) nread, (int) size);
+    text[size] = '\0';
+    fclose(f);
+    return text;
+}
+
+void test_trace(void)
+{
+    thr_pool_t pool;
+    thr_pool_options_t opts;
+
+    thr_pool_options_init(&opts);
+    opts.min_threads = 1;
+    opts.max_threads = 2;
+    opts.trace_capacity = 4 * NJOBS;
+    int err = thr_pool_create_ex(&pool, &opts);
+    if (err) {
+        fprintf(stderr, "thr_pool_create_ex() failed!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (int i = 0; i < NJOBS; i++)
+        thr_pool_add(&pool, quick_task, NULL);
+    thr_pool_wait(&pool);
+
+    /* not recorded */
+    thr_pool_trace_enable(&pool, 0);
+    thr_pool_add(&pool, quick_task, NULL);
+    thr_pool_wait(&pool);
+
+    char *text = dump_trace(&pool);
+    ASSERT_EQ_INT(strncmp(text, "{\"displayTimeUnit\"", 18), 0);
+    ASSERT_EQ_INT(count_matches(text, "\"name\":\"enqueue\""), NJOBS);
+    ASSERT_EQ_INT(count_matches(text, "\"name\":\"job\",\"ph\":\"B\""), NJOBS);
+    ASSERT_EQ_INT(count_matches(text, "\"name\":\"job\",\"ph\":\"E\""), NJOBS);
+    ASSERT_GE_INT(count_matches(text, "\"name\":\"spawn\""), 1);
+    ASSERT_EQ_INT(count_matches(text, "\"thread_name\""), 3);
+    ASSERT_EQ_INT(count_matches(text, "{"), count_matches(text, "}"));
+    free(text);
+
+    thr_pool_destroy(&pool);
+}
+
+void test_trace_wraps(void)
+{
+    thr_pool_t pool;
+    thr_pool_options_t opts;
+
+    thr_pool_options_init(&opts);
+    opts.min_threads = 1;
+    opts.max_threads = 1;
+    opts.trace_capacity = 16;
+    int err = thr_pool_create_ex(&pool, &opts);
+    if (err) {
+        fprintf(stderr, "thr_pool_create_ex() failed!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (int i = 0; i < NJOBS; i++)
+        thr_pool_add(&pool, quick_task, NULL);
+    thr_pool_wait(&pool);
+
+    /* only the most recent events of each ring are kept */
+    char *text = dump_trace(&pool);
+    ASSERT_EQ_INT(count_matches(text, "\"name\":\"enqueue\""), 16);
+    ASSERT_LE_INT(count_matches(text, "\"name\":\"job\""), 16);
+    free(text);
+
+    thr_pool_destroy(&pool);
+}
+
+void test_no_trace(void)
+{
+    thr_pool_t pool;
+    int err = thr_pool_create(&pool, 1, 1, -1, NULL);
+    if (err) {
+        fprintf(stderr, "thr_pool_create() failed!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    err = thr_pool_trace_dump(&pool, stdout);
+    ASSERT_EQ_INT(err, EINVAL);
+    err = thr_pool_trace_enable(&pool, 1);
+    ASSERT_EQ_INT(err, EINVAL);
+
+    thr_pool_destroy(&pool);
+}
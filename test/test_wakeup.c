@@ -0,0 +1,77 @@
+#include "../src/thrpool.h"
+#include "../src/thrpool_assert.h"
+#include <stdlib.h>
+#include <sched.h>
+
+pthread_t runner;
+int release = 0;
+
+void *record_task(void *arg)
+{
+    runner = pthread_self();
+    while (!__atomic_load_n(&release, __ATOMIC_ACQUIRE))
+        sched_yield();
+    return arg;
+}
+
+void *quick_task(void *arg) { return arg; }
+
+int wait_all_idle(thr_pool_t *pool);
+void test_targeted_wakeup(void);
+
+int main(void)
+{
+    test_targeted_wakeup();
+    return 0;
+}
+
+/* Wait until every worker is parked, return their number */
+int wait_all_idle(thr_pool_t *pool)
+{
+    for (;;) {
+        pthread_mutex_lock(&pool->mutex);
+        int idle = pool->idle;
+        int nthreads = pool->nthreads;
+        pthread_mutex_unlock(&pool->mutex);
+        if (idle == nthreads) return idle;
+        sched_yield();
+    }
+}
+
+void test_targeted_wakeup(void)
+{
+    const int nthreads = 4;
+    thr_pool_t pool;
+    int err = thr_pool_create(&pool, nthreads, nthreads, -1, NULL);
+    if (err) {
+        fprintf(stderr, "thr_pool_create() failed!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (int i = 0; i < nthreads; i++)
+        thr_pool_add(&pool, quick_task, NULL);
+    thr_pool_wait(&pool);
+    int idle = wait_all_idle(&pool);
+    ASSERT_GT_INT(idle, 0);
+
+    /* one job takes exactly one worker off the idle stack */
+    thr_pool_add(&pool, record_task, NULL);
+    pthread_mutex_lock(&pool.mutex);
+    ASSERT_EQ_INT(pool.idle, idle - 1);
+    pthread_mutex_unlock(&pool.mutex);
+
+    __atomic_store_n(&release, 1, __ATOMIC_RELEASE);
+    thr_pool_wait(&pool);
+    wait_all_idle(&pool);
+    pthread_t first = runner;
+
+    /* the most recently parked worker gets the next job */
+    thr_pool_add(&pool, record_task, NULL);
+    thr_pool_wait(&pool);
+    ASSERT_NE_INT(pthread_equal(first, runner), 0);
+
+    thr_pool_destroy(&pool);
+    ASSERT_EQ_INT(pool.nthreads, 0);
+    ASSERT_EQ_INT(pool.idle, 0);
+    ASSERT_IS_NULL(pool.idle_stack);
+}
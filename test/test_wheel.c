@@ -0,0 +1,106 @@
+#include "../src/thrpool_wheel.h"
+#include "../src/thrpool_assert.h"
+#include <stdlib.h>
+
+#define NTIMERS 100000
+#define HORIZON (1ULL << 26)    /* spans five levels of the wheel */
+
+thr_wheel_node_t nodes[NTIMERS];
+int fired[NTIMERS];
+int cancelled[NTIMERS];
+
+/* xorshift64, reproducible */
+unsigned long long seed = 88172645463325252ULL;
+unsigned long long rnd(void)
+{
+    seed ^= seed << 13;
+    seed ^= seed >> 7;
+    seed ^= seed << 17;
+    return seed;
+}
+
+void test_fire_on_time(void);
+void test_clamp_and_past(void);
+
+int main(void)
+{
+    test_fire_on_time();
+    test_clamp_and_past();
+    return 0;
+}
+
+void test_fire_on_time(void)
+{
+    thr_wheel_t wheel;
+    thr_wheel_init(&wheel, 1000);
+
+    unsigned long long earliest = ~0ULL;
+    for (int i = 0; i < NTIMERS; i++) {
+        /* mostly short timers, some far ones */
+        unsigned long long delta = rnd() % (i % 4 ? 4096 : HORIZON);
+        nodes[i].expires = wheel.now + delta;
+        if (nodes[i].expires < earliest) earliest = nodes[i].expires;
+        thr_wheel_add(&wheel, &nodes[i]);
+    }
+    ASSERT_EQ_INT((int) wheel.count, NTIMERS);
+    ASSERT(thr_wheel_next(&wheel) <= earliest);
+
+    /* Remove every third timer */
+    for (int i = 0; i < NTIMERS; i += 3) {
+        thr_wheel_del(&wheel, &nodes[i]);
+        cancelled[i] = 1;
+    }
+
+    /* Advance by random steps, every timer fires in the step covering it */
+    int nfired = 0;
+    while (wheel.count > 0) {
+        unsigned long long from = wheel.now;
+        unsigned long long next = thr_wheel_next(&wheel);
+        ASSERT(next >= from);
+
+        /* Nothing expires before the next tick with work */
+        if (next > from) {
+            thr_wheel_node_t *none = thr_wheel_advance(&wheel, next - 1);
+            ASSERT_IS_NULL(none);
+            from = wheel.now;
+        }
+
+        unsigned long long upto = from + rnd() % 5000;
+        thr_wheel_node_t *node = thr_wheel_advance(&wheel, upto);
+        for (; node != NULL; node = node->next) {
+            int i = (int) (node - nodes);
+            ASSERT_EQ_INT(cancelled[i], 0);
+            ASSERT_EQ_INT(fired[i], 0);
+            ASSERT(node->expires >= from && node->expires <= upto);
+            fired[i] = 1;
+            nfired++;
+        }
+        ASSERT(wheel.now == upto + 1);
+    }
+    ASSERT_EQ_INT(nfired, NTIMERS - (NTIMERS + 2) / 3);
+    ASSERT(thr_wheel_next(&wheel) == ~0ULL);
+}
+
+void test_clamp_and_past(void)
+{
+    thr_wheel_t wheel;
+    thr_wheel_node_t past, far;
+    thr_wheel_init(&wheel, 500);
+
+    /* A timer in the past fires at the next tick */
+    past.expires = 10;
+    thr_wheel_add(&wheel, &past);
+    ASSERT(thr_wheel_next(&wheel) == 500);
+
+    far.expires = ~0ULL;
+    thr_wheel_add(&wheel, &far);
+    ASSERT(far.expires == 500 + THR_WHEEL_MAX_DELTA);
+
+    thr_wheel_node_t *node = thr_wheel_advance(&wheel, 500);
+    ASSERT_EQ_ADDR(node, &past);
+    ASSERT_IS_NULL(node->next);
+
+    node = thr_wheel_advance(&wheel, far.expires);
+    ASSERT_EQ_ADDR(node, &far);
+    ASSERT_EQ_INT((int) wheel.count, 0);
+}